@@ -0,0 +1,20 @@
+//====================================================
+// Lesson4: Rasterization Stage
+// Bounding box proxy drawn inside occlusion queries.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+out vec4 fromFragColor;
+
+//====================================================
+
+void main()
+{
+    // Color writes are masked off, only the depth test matters.
+    fromFragColor = vec4( 1.0 );
+}
+
+//====================================================
@@ -0,0 +1,26 @@
+//====================================================
+// Lesson4: Rasterization Stage
+// Bounding box proxy drawn inside occlusion queries.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+#include "uniforms.glsl"
+
+//====================================================
+
+layout (location = 0) in vec3 aPos;     // unit cube corner
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+//====================================================
+
+void main()
+{
+    vec3 wsPos = mix( boxMin, boxMax, aPos );
+    gl_Position = projection * view * vec4( wsPos, 1.0 );
+}
+
+//====================================================
@@ -0,0 +1,40 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Per froxel light lists (see lightclusters.h).
+// Needs uniforms.glsl for the cluster constants.
+//====================================================
+
+uniform usamplerBuffer clusterGrid;             // offset, count per froxel
+uniform usamplerBuffer clusterLightIndices;     // the lists, back to back
+
+//====================================================
+
+// Offset and count of the lights touching the froxel
+// at this pixel and view depth.
+uvec2 clusterLightRange( vec2 fragCoord, float viewDepth )
+{
+    ivec2 tile = min( ivec2( fragCoord * clusterScale.xy ), clusterDims.xy - 1 );
+    int slice = clamp( int( floor( log( viewDepth ) * clusterScale.z + clusterScale.w ) ), 0, clusterDims.z - 1 );
+    return texelFetch( clusterGrid, (slice * clusterDims.y + tile.y) * clusterDims.x + tile.x ).xy;
+}
+
+//====================================================
+
+// The same for a vertex, from its clip space position.
+// Only the froxels inside the view frustum have lists,
+// so the vertex has to be inside it too.
+uvec2 clusterLightRangeClip( vec4 clipPos, float viewDepth )
+{
+    vec2 fragCoord = (clipPos.xy / clipPos.w * 0.5 + 0.5) * viewportSize.xy;
+    return clusterLightRange( fragCoord, viewDepth );
+}
+
+//====================================================
+
+int clusterLight( uint index )
+{
+    return int( texelFetch( clusterLightIndices, int( index ) ).r );
+}
+
+//====================================================
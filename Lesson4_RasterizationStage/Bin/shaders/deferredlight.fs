@@ -0,0 +1,74 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Deferred shading, light pass (see deferred.h).
+// Adds one light's diffuse and specular for the
+// pixels inside its radius.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+#include "uniforms.glsl"
+#include "vertexformat.glsl"
+
+//====================================================
+
+const float screenGamma = 2.2;
+uniform sampler2D gbufferAlbedo;
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferDepth;
+uniform mat4 inverseViewProjection;
+flat in int fromVtxLight;
+out vec4 fromFragColor;
+
+//====================================================
+
+void main()
+{
+    ivec2 pixel = ivec2( gl_FragCoord.xy );
+    float depth = texelFetch( gbufferDepth, pixel, 0 ).r;
+    if (depth == 1.0)
+        discard;
+
+    // World position back from depth.
+    vec2 uv = gl_FragCoord.xy / vec2( textureSize( gbufferDepth, 0 ) );
+    vec4 wsPos = inverseViewProjection * vec4( vec3( uv, depth ) * 2.0 - 1.0, 1.0 );
+    vec3 vertPos = wsPos.xyz / wsPos.w;
+
+    vec3 lightPos = lights[fromVtxLight].positionRadius.xyz;
+    float lightRadius = lights[fromVtxLight].positionRadius.w;
+    vec3 lightDir = lightPos - vertPos;
+    float distance = length( lightDir );
+    if (distance >= lightRadius)
+        discard;
+    lightDir /= distance;
+
+    vec4 albedoSpecular = texelFetch( gbufferAlbedo, pixel, 0 );
+    vec4 normalMaterial = texelFetch( gbufferNormal, pixel, 0 );
+    vec3 vertNormal = octahedralDecode( normalMaterial.xy );
+    float shininess = normalMaterial.z;
+
+    // Same model as handlePointLight() in model.fs.
+    float diffuse = max( dot( lightDir, vertNormal ), 0.0 );
+    float specular = 0.0;
+    if (diffuse > 0.0)
+    {
+        vec3 viewDir = normalize( cameraPos.xyz - vertPos );
+        vec3 halfDir = normalize( lightDir + viewDir );
+        float specAngle = max( dot( halfDir, vertNormal ), 0.0 );
+        specular = pow( specAngle, shininess );
+
+        float atten = 1.0 - distance / lightRadius;
+        diffuse *= atten;
+        specular *= atten;
+    }
+
+    vec3 albedo = pow( albedoSpecular.rgb, vec3( screenGamma ) );
+    vec3 lightColor = lights[fromVtxLight].color.rgb;
+    fromFragColor.rgb = lightColor * (diffuse * normalMaterial.w * albedo + specular * albedoSpecular.a);
+    fromFragColor.w = 1.0;
+}
+
+//====================================================
@@ -0,0 +1,56 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Deferred shading, light pass (see deferred.h).
+// Instance i is a quad over the screen rectangle of
+// light i's sphere, drawn as a 4 vertex strip.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+#include "uniforms.glsl"
+
+//====================================================
+
+flat out int fromVtxLight;
+
+//====================================================
+
+void main()
+{
+    vec3 center = (view * vec4( lights[gl_InstanceID].positionRadius.xyz, 1.0 )).xyz;
+    float radius = lights[gl_InstanceID].positionRadius.w;
+    float depth = -center.z;
+
+    // The whole screen if the camera is inside the sphere,
+    // nothing if the sphere is behind it.
+    vec2 lo = vec2( -1.0 );
+    vec2 hi = vec2( 1.0 );
+    if (depth + radius <= 0.0)
+    {
+        hi = lo;
+    }
+    else if (depth - radius > 0.0)
+    {
+        // Bounds of the sphere's view space box, which is all in front of the eye.
+        lo = vec2( 1.0 );
+        hi = vec2( -1.0 );
+        for (int i = 0; i < 8; i++)
+        {
+            vec3 corner = center + radius * vec3( (i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0 );
+            vec4 clip = projection * vec4( corner, 1.0 );
+            lo = min( lo, clip.xy / clip.w );
+            hi = max( hi, clip.xy / clip.w );
+        }
+        lo = clamp( lo, -1.0, 1.0 );
+        hi = clamp( hi, -1.0, 1.0 );
+    }
+
+    vec2 corner = vec2( gl_VertexID & 1, gl_VertexID >> 1 );
+    gl_Position = vec4( mix( lo, hi, corner ), 0.0, 1.0 );
+    fromVtxLight = gl_InstanceID;
+}
+
+//====================================================
@@ -0,0 +1,33 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Deferred shading, resolve (see deferred.h). Ambient
+// plus the accumulated lights, gamma, and the depth
+// of the G-buffer for whatever is drawn next.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+const vec3 ambientColor = vec3( 0.25 );
+const float screenGamma = 2.2;
+uniform sampler2D gbufferAlbedo;
+uniform sampler2D gbufferDepth;
+uniform sampler2D lightAccumulation;
+out vec4 fromFragColor;
+
+//====================================================
+
+void main()
+{
+    ivec2 pixel = ivec2( gl_FragCoord.xy );
+    vec3 albedo = pow( texelFetch( gbufferAlbedo, pixel, 0 ).rgb, vec3( screenGamma ) );
+    vec3 lit = ambientColor * albedo + texelFetch( lightAccumulation, pixel, 0 ).rgb;
+
+    fromFragColor.rgb = pow( lit, vec3( 1.0 / screenGamma ) );
+    fromFragColor.w = 1.0;
+    gl_FragDepth = texelFetch( gbufferDepth, pixel, 0 ).r;
+}
+
+//====================================================
@@ -0,0 +1,16 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Depth pre-pass (see depthprepass.h). Colour writes
+// are masked off, only depth comes out.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+void main()
+{
+}
+
+//====================================================
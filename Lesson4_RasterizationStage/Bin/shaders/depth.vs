@@ -0,0 +1,29 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Depth pre-pass (see depthprepass.h). Position only;
+// the transform must match model.vs exactly, hence the
+// invariant gl_Position in both.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+#include "uniforms.glsl"
+
+//====================================================
+
+layout (location = 0) in vec4 aPos;     // quantized, w is the bitangent sign times (1 + material layer)
+layout (location = 5) in mat4 aModel;   // per instance, locations 5-8, includes the dequantization
+invariant gl_Position;
+
+//====================================================
+
+void main()
+{
+    vec3 wsPos = (aModel * vec4( aPos.xyz, 1.0 )).xyz;
+    gl_Position = projection * view * vec4( wsPos, 1.0 );
+}
+
+//====================================================
@@ -0,0 +1,18 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// One triangle covering the screen, drawn with
+// glDrawArrays( GL_TRIANGLES, 0, 3 ) and no attributes.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+void main()
+{
+    vec2 p = vec2( (gl_VertexID << 1) & 2, gl_VertexID & 2 );
+    gl_Position = vec4( p * 2.0 - 1.0, 0.0, 1.0 );
+}
+
+//====================================================
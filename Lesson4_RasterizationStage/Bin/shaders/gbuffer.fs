@@ -0,0 +1,57 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Deferred shading, geometry pass (see deferred.h).
+// Writes the surface instead of lighting it.
+// NO_TEXTURE and MATERIAL_ARRAY are defined per
+// variant, see shadervariants.h.
+//====================================================
+
+#version 330 core
+
+//====================================================
+
+#if defined MATERIAL_ARRAY
+uniform sampler2DArray texture_diffuse1;
+flat in float fromVtxMaterialLayer;
+#else
+uniform sampler2D texture_diffuse1;
+#endif
+uniform float shininess;
+uniform float diffuseScale;
+uniform float specularScale;
+in vec3 fromVtxPos;
+in vec3 fromVtxNormal;
+in vec2 fromVtxTexCoords;
+layout (location = 0) out vec4 toAlbedo;   // rgb albedo (not linearized), a specular scale
+layout (location = 1) out vec4 toNormal;   // xy octahedral normal, z shininess, w diffuse scale
+
+//====================================================
+
+vec2 octahedralEncode( vec3 n )
+{
+    n /= abs( n.x ) + abs( n.y ) + abs( n.z );
+    if (n.z < 0.0)
+    {
+        vec2 signs = vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );
+        n.xy = (1.0 - abs( n.yx )) * signs;
+    }
+    return n.xy;
+}
+
+//====================================================
+
+void main()
+{
+#if defined NO_TEXTURE
+    toAlbedo.rgb = vec3( 1.0 );
+#elif defined MATERIAL_ARRAY
+    toAlbedo.rgb = texture( texture_diffuse1, vec3( fromVtxTexCoords, fromVtxMaterialLayer ) ).rgb;
+#else
+    toAlbedo.rgb = texture( texture_diffuse1, fromVtxTexCoords ).rgb;
+#endif
+    toAlbedo.a = specularScale;     // the target clamps this to [0, 1]
+    toNormal = vec4( octahedralEncode( normalize( fromVtxNormal ) ), shininess, diffuseScale );
+}
+
+//====================================================
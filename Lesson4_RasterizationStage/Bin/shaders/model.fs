@@ -6,17 +6,41 @@
 
 //====================================================
 
-// Uncomment this to use vertex lighting
-//#define VERTEX_LIGHTING
+#include "uniforms.glsl"
+#include "clusters.glsl"
+
+//====================================================
+
+// VERTEX_LIGHTING, NO_SPECULAR, NO_TEXTURE and
+// MATERIAL_ARRAY are defined per variant, see
+// shadervariants.h.
 
 //====================================================
 
 const vec3 ambientColor = vec3( 0.25 );
 const float screenGamma = 2.2;
+#if defined MATERIAL_ARRAY
+uniform sampler2DArray texture_diffuse1;
+flat in float fromVtxMaterialLayer;
+#else
 uniform sampler2D texture_diffuse1;
+#endif
 in vec2 fromVtxTexCoords;
 out vec4 fromFragColor;
 
+//====================================================
+
+vec3 sampleAlbedo()
+{
+#if defined NO_TEXTURE
+    return vec3( 1.0 );
+#elif defined MATERIAL_ARRAY
+    return pow( texture( texture_diffuse1, vec3( fromVtxTexCoords, fromVtxMaterialLayer ) ).rgb, vec3( screenGamma ) );
+#else
+    return pow( texture( texture_diffuse1, fromVtxTexCoords ).rgb, vec3( screenGamma ) );
+#endif
+}
+
 //====================================================
 // Vertex Lighting Mode
 //====================================================
@@ -24,14 +48,20 @@ out vec4 fromFragColor;
 //====================================================
 
 in vec3 fromVtxDiffuseColor;
+#if !defined NO_SPECULAR
 in vec3 fromVtxSpecularColor;
+#endif
 
 //====================================================
 
 void main()
 {
-    vec3 txtrClr = pow( texture( texture_diffuse1, fromVtxTexCoords ).rgb, vec3( screenGamma ) );
+    vec3 txtrClr = sampleAlbedo();
+#if defined NO_SPECULAR
+    fromFragColor.rgb = (ambientColor + fromVtxDiffuseColor) * txtrClr;
+#else
     fromFragColor.rgb = ((ambientColor + fromVtxDiffuseColor) * txtrClr) + fromVtxSpecularColor;
+#endif
     //fromFragColor.rgb = (ambientColor + fromVtxDiffuseColor) + fromVtxSpecularColor + (txtrClr * 0.001);
 
     fromFragColor.rgb = pow(fromFragColor.rgb, vec3(1.0/screenGamma));
@@ -44,11 +74,6 @@ void main()
 #else
 //====================================================
 
-const int numLights = 10;
-uniform vec3 lightPositions[numLights];
-uniform vec3 lightColors[numLights];
-uniform float lightRadii[numLights];
-uniform vec3 cameraPos;
 uniform float shininess;
 uniform float diffuseScale;
 uniform float specularScale;
@@ -68,10 +93,12 @@ void handlePointLight( inout vec3 diffuseColor, inout vec3 specularColor, vec3 v
 
     if(diffuse > 0.0)
     {
-        vec3 viewDir = normalize(cameraPos - vertPos);
+#if !defined NO_SPECULAR
+        vec3 viewDir = normalize(cameraPos.xyz - vertPos);
         vec3 halfDir = normalize(lightDir + viewDir);
         float specAngle = max(dot(halfDir, vertNormal), 0.0);
         specular = pow(specAngle, shininess);
+#endif
 
         float atten = 1.0 - min( distance, lightRadius ) / lightRadius;
         //float atten = 1.0 / (distance * distance);
@@ -80,7 +107,9 @@ void handlePointLight( inout vec3 diffuseColor, inout vec3 specularColor, vec3 v
     }
 
     diffuseColor += lightColor * diffuse;
+#if !defined NO_SPECULAR
     specularColor += lightColor * specular;
+#endif
 }
 
 //====================================================
@@ -90,15 +119,33 @@ void main()
     vec3 wsNormal = normalize( fromVtxNormal );
     vec3 diffuseColor = vec3( 0.0 );
     vec3 specularColor = vec3( 0.0 );
-    for (int i = 0; i < numLights; i++)
+    if (clusterDims.w != 0)
     {
-        handlePointLight( diffuseColor, specularColor, fromVtxPos, wsNormal, lightPositions[i], lightColors[i], lightRadii[i] );
+        // Only the lights whose spheres touch this fragment's froxel.
+        float viewDepth = -(view * vec4( fromVtxPos, 1.0 )).z;
+        uvec2 range = clusterLightRange( gl_FragCoord.xy, viewDepth );
+        for (uint i = range.x; i < range.x + range.y; i++)
+        {
+            int l = clusterLight( i );
+            handlePointLight( diffuseColor, specularColor, fromVtxPos, wsNormal, lights[l].positionRadius.xyz, lights[l].color.rgb, lights[l].positionRadius.w );
+        }
+    }
+    else
+    {
+        for (int i = 0; i < numLights; i++)
+        {
+            handlePointLight( diffuseColor, specularColor, fromVtxPos, wsNormal, lights[i].positionRadius.xyz, lights[i].color.rgb, lights[i].positionRadius.w );
+        }
     }
     diffuseColor *= diffuseScale;
-    specularColor *= specularScale;
 
-    vec3 txtrClr = pow( texture( texture_diffuse1, fromVtxTexCoords ).rgb, vec3( screenGamma ) );
+    vec3 txtrClr = sampleAlbedo();
+#if defined NO_SPECULAR
+    fromFragColor.rgb = (ambientColor + diffuseColor) * txtrClr;
+#else
+    specularColor *= specularScale;
     fromFragColor.rgb = ((ambientColor + diffuseColor) * txtrClr) + specularColor;
+#endif
     //fromFragColor.rgb = (ambientColor + diffuseColor) + specularColor + (txtrClr * 0.001);
 
     fromFragColor.rgb = pow(fromFragColor.rgb, vec3(1.0/screenGamma));
@@ -6,18 +6,27 @@
 
 //====================================================
 
-// Uncomment this to use vertex lighting
-//#define VERTEX_LIGHTING
+#include "uniforms.glsl"
+#include "clusters.glsl"
+#include "vertexformat.glsl"
 
 //====================================================
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// VERTEX_LIGHTING, NO_SPECULAR, NO_TEXTURE and
+// MATERIAL_ARRAY are defined per variant, see
+// shadervariants.h.
+
+//====================================================
+
+layout (location = 0) in vec4 aPos;             // quantized, w is the bitangent sign times (1 + material layer)
+layout (location = 1) in vec4 aNormalTangent;   // octahedral normal (xy) and tangent (zw)
 layout (location = 2) in vec2 aTexCoords;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat3 itModel;
+layout (location = 5) in mat4 aModel;     // per instance, locations 5-8, includes the dequantization
+layout (location = 9) in mat3 aItModel;   // per instance, locations 9-11
+invariant gl_Position;                    // must match depth.vs for the depth pre-pass
+#if defined MATERIAL_ARRAY
+flat out float fromVtxMaterialLayer;
+#endif
 
 //====================================================
 // Vertex Lighting Mode
@@ -25,17 +34,14 @@ uniform mat3 itModel;
 #if defined VERTEX_LIGHTING
 //====================================================
 
-const int numLights = 10;
-uniform vec3 lightPositions[numLights];
-uniform vec3 lightColors[numLights];
-uniform float lightRadii[numLights];
-uniform vec3 cameraPos;
 uniform float shininess;
 uniform float diffuseScale;
 uniform float specularScale;
 out vec2 fromVtxTexCoords;
 out vec3 fromVtxDiffuseColor;
+#if !defined NO_SPECULAR
 out vec3 fromVtxSpecularColor;
+#endif
 
 //====================================================
 
@@ -50,10 +56,12 @@ void handlePointLight( inout vec3 diffuseColor, inout vec3 specularColor, vec3 v
 
     if(diffuse > 0.0)
     {
-        vec3 viewDir = normalize(cameraPos - vertPos);
+#if !defined NO_SPECULAR
+        vec3 viewDir = normalize(cameraPos.xyz - vertPos);
         vec3 halfDir = normalize(lightDir + viewDir);
         float specAngle = max(dot(halfDir, vertNormal), 0.0);
         specular = pow(specAngle, shininess);
+#endif
 
         float atten = 1.0 - min( distance, lightRadius ) / lightRadius;
         //float atten = 1.0 / (distance * distance);
@@ -62,25 +70,48 @@ void handlePointLight( inout vec3 diffuseColor, inout vec3 specularColor, vec3 v
     }
 
     diffuseColor += lightColor * diffuse;
+#if !defined NO_SPECULAR
     specularColor += lightColor * specular;
+#endif
 }
 
 //====================================================
 
 void main()
 {
-    vec3 wsPos = (model * vec4( aPos, 1.0 )).xyz;
-    vec3 wsNormal = normalize( itModel * aNormal );
+    vec3 wsPos = (aModel * vec4( aPos.xyz, 1.0 )).xyz;
+    vec3 wsNormal = normalize( aItModel * decodeNormal( aNormalTangent ) );
     fromVtxTexCoords = aTexCoords;
-    fromVtxDiffuseColor = vec3( 0.0 );
-    fromVtxSpecularColor = vec3( 0.0 );
-    for (int i = 0; i < numLights; i++)
+#if defined MATERIAL_ARRAY
+    fromVtxMaterialLayer = decodeMaterialLayer( aPos );
+#endif
+    vec4 vsPos = view * vec4( wsPos, 1.0 );
+    vec4 clipPos = projection * vsPos;
+    vec3 diffuseColor = vec3( 0.0 );
+    vec3 specularColor = vec3( 0.0 );
+    if (clusterDims.w != 0 && all( lessThanEqual( abs( clipPos.xyz ), vec3( clipPos.w ) ) ))
+    {
+        // Only the lights whose spheres touch this vertex's froxel.
+        uvec2 range = clusterLightRangeClip( clipPos, -vsPos.z );
+        for (uint i = range.x; i < range.x + range.y; i++)
+        {
+            int l = clusterLight( i );
+            handlePointLight( diffuseColor, specularColor, wsPos, wsNormal, lights[l].positionRadius.xyz, lights[l].color.rgb, lights[l].positionRadius.w );
+        }
+    }
+    else
     {
-        handlePointLight( fromVtxDiffuseColor, fromVtxSpecularColor, wsPos, wsNormal, lightPositions[i], lightColors[i], lightRadii[i] );
+        // Off screen vertices of visible triangles aren't in any froxel.
+        for (int i = 0; i < numLights; i++)
+        {
+            handlePointLight( diffuseColor, specularColor, wsPos, wsNormal, lights[i].positionRadius.xyz, lights[i].color.rgb, lights[i].positionRadius.w );
+        }
     }
-    fromVtxDiffuseColor *= diffuseScale;
-    fromVtxSpecularColor *= specularScale;
-    gl_Position = projection * view * vec4( wsPos, 1.0 );
+    fromVtxDiffuseColor = diffuseColor * diffuseScale;
+#if !defined NO_SPECULAR
+    fromVtxSpecularColor = specularColor * specularScale;
+#endif
+    gl_Position = clipPos;
 }
 
 //====================================================
@@ -98,9 +129,12 @@ out vec2 fromVtxTexCoords;
 
 void main()
 {
-    fromVtxPos = (model * vec4( aPos, 1.0 )).xyz;
-    fromVtxNormal = normalize( itModel * aNormal );
+    fromVtxPos = (aModel * vec4( aPos.xyz, 1.0 )).xyz;
+    fromVtxNormal = normalize( aItModel * decodeNormal( aNormalTangent ) );
     fromVtxTexCoords = aTexCoords;
+#if defined MATERIAL_ARRAY
+    fromVtxMaterialLayer = decodeMaterialLayer( aPos );
+#endif
     gl_Position = projection * view * vec4( fromVtxPos, 1.0 );
 }
 
@@ -0,0 +1,35 @@
+//====================================================
+// Lesson4: Rasterization Stage
+// Uniform blocks shared by all programs. The layouts
+// must match the std140 structs in uniformblocks.h.
+//====================================================
+
+const int MAX_LIGHTS = 512;
+
+//====================================================
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos;     // xyz
+    int numLights;
+    vec4 clusterScale;      // xy tiles per pixel, zw depth slice scale and bias
+    ivec4 clusterDims;      // tiles x, tiles y, slices, 0 to shade every light
+    vec4 viewportSize;      // xy framebuffer size in pixels
+};
+
+//====================================================
+
+struct PointLight
+{
+    vec4 positionRadius;    // xyz position, w radius
+    vec4 color;             // rgb
+};
+
+layout (std140) uniform LightData
+{
+    PointLight lights[MAX_LIGHTS];
+};
+
+//====================================================
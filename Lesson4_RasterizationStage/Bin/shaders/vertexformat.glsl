@@ -0,0 +1,53 @@
+//====================================================
+// Lesson4: Rasterization Stage
+//
+// Decoding of the packed vertex (see vertexformat.h).
+// Positions come out in quantized units; the
+// instance's model matrix scales them back.
+//====================================================
+
+const float DIRECTION_QUANTIZATION_SCALE = 127.0;
+
+//====================================================
+
+vec3 octahedralDecode( vec2 e )
+{
+    vec3 n = vec3( e, 1.0 - abs( e.x ) - abs( e.y ) );
+    if (n.z < 0.0)
+    {
+        vec2 signs = vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );
+        n.xy = (1.0 - abs( n.yx )) * signs;
+    }
+    return normalize( n );
+}
+
+//====================================================
+
+vec3 decodeNormal( vec4 normalTangent )
+{
+    return octahedralDecode( normalTangent.xy / DIRECTION_QUANTIZATION_SCALE );
+}
+
+//====================================================
+
+vec3 decodeTangent( vec4 normalTangent )
+{
+    return octahedralDecode( normalTangent.zw / DIRECTION_QUANTIZATION_SCALE );
+}
+
+//====================================================
+
+vec3 decodeBitangent( vec4 position, vec3 normal, vec3 tangent )
+{
+    return cross( normal, tangent ) * sign( position.w );
+}
+
+//====================================================
+
+// Layer of the material array the vertex samples, -1 if none.
+float decodeMaterialLayer( vec4 position )
+{
+    return abs( position.w ) - 1.0;
+}
+
+//====================================================
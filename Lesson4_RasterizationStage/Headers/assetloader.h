@@ -0,0 +1,214 @@
+//=============================================================================
+// Asset Loader
+//
+// Loads the startup assets as one job graph instead of one after another.
+// Every model is prepared on its own job: its cache file is mapped, or it
+// is imported and its meshes are cooked in parallel (Model::prepare()).
+// Nothing on a worker may touch GL, so each prepared model posts its
+// upload back to the thread that owns the context, which Run() keeps
+// draining while also pumping the TextureLoader, whose decodes run on the
+// same workers. The uploads start texture loads of their own, and Run()
+// returns once everything has arrived.
+//
+// With more cores more models and meshes cook at once; the context thread
+// only ever copies finished data. Run() prints how long each asset took:
+// preparing on a worker, waiting for the context thread and uploading, and
+// for textures decoding, uploading and request to upload.
+//=============================================================================
+
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <jobsystem.h>
+#include <model.h>
+#include <textureloader.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//=============================================================================
+
+class AssetLoader
+{
+public:
+    // Without a job system everything loads on the calling thread, in Add().
+    explicit AssetLoader( JobSystem* const jobs ):
+        mJobs( jobs ),
+        mStart( std::chrono::steady_clock::now() )
+    {
+    }
+
+    ~AssetLoader()
+    {
+        if (mJobs != nullptr)
+        {
+            // Jobs write into our assets.
+            mJobs->Wait( mCounter );
+        }
+    }
+
+    AssetLoader( const AssetLoader& ) = delete;
+    AssetLoader& operator=( const AssetLoader& ) = delete;
+
+    // Starts preparing a model made without loadNow, Run() uploads it.
+    void Add( const std::shared_ptr<Model>& model )
+    {
+        mAssets.push_back( Asset() );
+        Asset* const asset = &mAssets.back();
+        asset->mName = model->path;
+
+        JobSystem* const jobs = mJobs;
+        auto prepare = [this, asset, model, jobs]()
+        {
+            std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+            model->prepare( jobs );
+            asset->mPrepareMs = MillisecondsSince( start );
+
+            std::chrono::steady_clock::time_point const prepared = std::chrono::steady_clock::now();
+            Post( [asset, model, prepared]()
+            {
+                asset->mWaitMs = MillisecondsSince( prepared );
+                std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+                model->upload();
+                asset->mUploadMs = MillisecondsSince( start );
+                asset->mDetail = std::to_string( model->meshes.size() ) + (model->fromCache ? " meshes from cache" : " meshes imported");
+            } );
+        };
+
+        if (mJobs != nullptr)
+        {
+            mJobs->Submit( prepare, &mCounter );
+        }
+        else
+        {
+            prepare();
+            RunTasks();
+        }
+    }
+
+    // Queues work that needs the GL context, from any thread.
+    void Post( const std::function<void()>& task )
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mTasks.push_back( task );
+    }
+
+    // Runs on the context thread until every asset added so far and every
+    // texture they asked for has been uploaded, then prints the timings.
+    void Run( TextureLoader& textures )
+    {
+        textures.SetTimingCallback( [this]( const std::string& path, double const decodeMs, double const uploadMs, double const latencyMs )
+        {
+            TextureTiming texture;
+            texture.mPath = path;
+            texture.mDecodeMs = decodeMs;
+            texture.mUploadMs = uploadMs;
+            texture.mLatencyMs = latencyMs;
+            mTextures.push_back( texture );
+        } );
+
+        for (;;)
+        {
+            bool const ran = RunTasks();
+            textures.Update();
+
+            // Jobs post their uploads before they count as done.
+            if (mCounter.IsDone() && !HasTasks() && textures.GetNumPending() == 0)
+                break;
+            if (!ran && (mJobs == nullptr || !mJobs->RunOne()))
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        textures.SetTimingCallback( TextureLoader::TimingCallback() );
+        Print();
+    }
+
+private:
+    struct Asset
+    {
+        Asset():
+            mPrepareMs( 0.0 ),
+            mWaitMs( 0.0 ),
+            mUploadMs( 0.0 )
+        {
+        }
+
+        std::string mName;
+        std::string mDetail;
+        double mPrepareMs;              // on a worker
+        double mWaitMs;                 // prepared, until the context thread got to it
+        double mUploadMs;               // on the context thread
+    };
+
+    struct TextureTiming
+    {
+        std::string mPath;
+        double mDecodeMs;
+        double mUploadMs;
+        double mLatencyMs;
+    };
+
+    static double MillisecondsSince( std::chrono::steady_clock::time_point const start )
+    {
+        return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+    }
+
+    bool HasTasks()
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        return !mTasks.empty();
+    }
+
+    // Runs whatever has been posted so far, returns whether there was anything.
+    bool RunTasks()
+    {
+        std::deque<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            tasks.swap( mTasks );
+        }
+        for (auto& task : tasks)
+        {
+            task();
+        }
+        return !tasks.empty();
+    }
+
+    void Print() const
+    {
+        std::cout << "Startup assets on " << (mJobs != nullptr ? mJobs->GetNumWorkers() : 0) << " workers:" << std::endl;
+        for (const auto& asset : mAssets)
+        {
+            std::cout << "  " << asset.mName << ": " << asset.mDetail
+                      << ", prepare " << asset.mPrepareMs << " ms, wait " << asset.mWaitMs << " ms, upload " << asset.mUploadMs << " ms" << std::endl;
+        }
+        for (const auto& texture : mTextures)
+        {
+            std::cout << "  " << texture.mPath << ": decode " << texture.mDecodeMs << " ms, upload " << texture.mUploadMs
+                      << " ms, ready after " << texture.mLatencyMs << " ms" << std::endl;
+        }
+        std::cout << "Startup assets loaded in " << MillisecondsSince( mStart ) << " ms" << std::endl;
+    }
+
+    JobSystem* mJobs;
+    JobCounter mCounter;
+    std::chrono::steady_clock::time_point mStart;
+    std::deque<Asset> mAssets;          // doesn't move them, jobs hold pointers
+    std::vector<TextureTiming> mTextures;
+    std::mutex mMutex;
+    std::deque<std::function<void()>> mTasks;
+};
+
+//=============================================================================
+
+#endif
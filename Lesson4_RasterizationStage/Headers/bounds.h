@@ -0,0 +1,272 @@
+//=============================================================================
+// Bounding Volumes and Frustum Culling
+//=============================================================================
+
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BOUNDS_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+//=============================================================================
+
+struct BoundingBox
+{
+    BoundingBox():
+        mMin( FLT_MAX ),
+        mMax( -FLT_MAX )
+    {
+    }
+
+    bool IsEmpty() const { return mMin.x > mMax.x; }
+    glm::vec3 GetCenter() const { return (mMin + mMax) * 0.5f; }
+    glm::vec3 GetExtents() const { return (mMax - mMin) * 0.5f; }
+
+    void Add( const glm::vec3& point )
+    {
+        mMin = glm::min( mMin, point );
+        mMax = glm::max( mMax, point );
+    }
+
+    void Add( const BoundingBox& box )
+    {
+        if (!box.IsEmpty())
+        {
+            Add( box.mMin );
+            Add( box.mMax );
+        }
+    }
+
+    // Box enclosing this box after transformation (Arvo's method).
+    BoundingBox Transform( const glm::mat4& transform ) const
+    {
+        glm::vec3 const center = glm::vec3( transform * glm::vec4( GetCenter(), 1.0f ) );
+        glm::vec3 const extents = GetExtents();
+        glm::vec3 const newExtents = glm::abs( glm::vec3( transform[0] ) ) * extents.x +
+                                     glm::abs( glm::vec3( transform[1] ) ) * extents.y +
+                                     glm::abs( glm::vec3( transform[2] ) ) * extents.z;
+        BoundingBox result;
+        result.mMin = center - newExtents;
+        result.mMax = center + newExtents;
+        return result;
+    }
+
+    glm::vec3 mMin;
+    glm::vec3 mMax;
+};
+
+//=============================================================================
+
+struct BoundingSphere
+{
+    BoundingSphere():
+        mCenter( 0.0f ),
+        mRadius( 0.0f )
+    {
+    }
+
+    // Radius is scaled by the largest axis scale, so it stays conservative for non uniform scales.
+    BoundingSphere Transform( const glm::mat4& transform ) const
+    {
+        float const scale = glm::sqrt( glm::max( glm::max( glm::dot( glm::vec3( transform[0] ), glm::vec3( transform[0] ) ),
+                                                           glm::dot( glm::vec3( transform[1] ), glm::vec3( transform[1] ) ) ),
+                                                 glm::dot( glm::vec3( transform[2] ), glm::vec3( transform[2] ) ) ) );
+        BoundingSphere result;
+        result.mCenter = glm::vec3( transform * glm::vec4( mCenter, 1.0f ) );
+        result.mRadius = mRadius * scale;
+        return result;
+    }
+
+    glm::vec3 mCenter;
+    float mRadius;
+};
+
+//=============================================================================
+
+// Sphere centered on the box, shrunk to the furthest of the given points.
+inline BoundingSphere MakeBoundingSphere( const BoundingBox& box, const glm::vec3* points, size_t const numPoints, size_t const stride )
+{
+    BoundingSphere sphere;
+    sphere.mCenter = box.GetCenter();
+    float radiusSq = 0.0f;
+    const uint8_t* point = (const uint8_t*)points;
+    for (size_t i = 0; i < numPoints; i++, point += stride)
+    {
+        glm::vec3 const d = *(const glm::vec3*)point - sphere.mCenter;
+        radiusSq = glm::max( radiusSq, glm::dot( d, d ) );
+    }
+    sphere.mRadius = glm::sqrt( radiusSq );
+    return sphere;
+}
+
+//=============================================================================
+
+struct Frustum
+{
+    enum
+    {
+        PLANE_LEFT,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+        NUM_PLANES
+    };
+
+    // Extracts the planes of a view projection matrix (Gribb / Hartmann).
+    // Normals point inwards, a point p is inside a plane when dot( n, p ) + d >= 0.
+    explicit Frustum( const glm::mat4& viewProjection )
+    {
+        glm::vec4 const row0( viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0] );
+        glm::vec4 const row1( viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1] );
+        glm::vec4 const row2( viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2] );
+        glm::vec4 const row3( viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3] );
+        mPlanes[PLANE_LEFT] = row3 + row0;
+        mPlanes[PLANE_RIGHT] = row3 - row0;
+        mPlanes[PLANE_BOTTOM] = row3 + row1;
+        mPlanes[PLANE_TOP] = row3 - row1;
+        mPlanes[PLANE_NEAR] = row3 + row2;
+        mPlanes[PLANE_FAR] = row3 - row2;
+        for (uint32_t i = 0; i < NUM_PLANES; i++)
+        {
+            mPlanes[i] /= glm::length( glm::vec3( mPlanes[i] ) );
+        }
+    }
+
+    bool Intersects( const BoundingSphere& sphere ) const
+    {
+        for (uint32_t i = 0; i < NUM_PLANES; i++)
+        {
+            if (glm::dot( glm::vec3( mPlanes[i] ), sphere.mCenter ) + mPlanes[i].w < -sphere.mRadius)
+                return false;
+        }
+        return true;
+    }
+
+    bool Intersects( const BoundingBox& box ) const
+    {
+        glm::vec3 const center = box.GetCenter();
+        glm::vec3 const extents = box.GetExtents();
+        for (uint32_t i = 0; i < NUM_PLANES; i++)
+        {
+            glm::vec3 const normal( mPlanes[i] );
+            float const radius = glm::dot( extents, glm::abs( normal ) );
+            if (glm::dot( normal, center ) + mPlanes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    glm::vec4 mPlanes[NUM_PLANES];
+};
+
+//=============================================================================
+
+// Structure of arrays sphere list, tested against a frustum four at a time.
+class SphereCuller
+{
+public:
+    void Clear()
+    {
+        mX.clear();
+        mY.clear();
+        mZ.clear();
+        mRadius.clear();
+    }
+
+    uint32_t Add( const BoundingSphere& sphere )
+    {
+        mX.push_back( sphere.mCenter.x );
+        mY.push_back( sphere.mCenter.y );
+        mZ.push_back( sphere.mCenter.z );
+        mRadius.push_back( sphere.mRadius );
+        return (uint32_t)mX.size() - 1;
+    }
+
+    uint32_t Size() const { return (uint32_t)mX.size(); }
+
+    // Writes 1 to visible[i] for every sphere touching the frustum, 0 otherwise.
+    void Cull( const Frustum& frustum, std::vector<uint8_t>& visible )
+    {
+        uint32_t const count = Size();
+        visible.resize( count );
+
+        // Pad to a multiple of four so every SIMD load is a full one, the
+        // results for the padding are dropped.
+        uint32_t const paddedCount = (count + 3) & ~3u;
+        mX.resize( paddedCount, 0.0f );
+        mY.resize( paddedCount, 0.0f );
+        mZ.resize( paddedCount, 0.0f );
+        mRadius.resize( paddedCount, 0.0f );
+
+#if defined(BOUNDS_USE_SSE)
+        __m128 planeX[Frustum::NUM_PLANES];
+        __m128 planeY[Frustum::NUM_PLANES];
+        __m128 planeZ[Frustum::NUM_PLANES];
+        __m128 planeW[Frustum::NUM_PLANES];
+        for (uint32_t p = 0; p < Frustum::NUM_PLANES; p++)
+        {
+            planeX[p] = _mm_set1_ps( frustum.mPlanes[p].x );
+            planeY[p] = _mm_set1_ps( frustum.mPlanes[p].y );
+            planeZ[p] = _mm_set1_ps( frustum.mPlanes[p].z );
+            planeW[p] = _mm_set1_ps( frustum.mPlanes[p].w );
+        }
+
+        for (uint32_t i = 0; i < paddedCount; i += 4)
+        {
+            __m128 const x = _mm_loadu_ps( &mX[i] );
+            __m128 const y = _mm_loadu_ps( &mY[i] );
+            __m128 const z = _mm_loadu_ps( &mZ[i] );
+            __m128 const negRadius = _mm_sub_ps( _mm_setzero_ps(), _mm_loadu_ps( &mRadius[i] ) );
+
+            // A sphere is outside when its distance to any plane is below -radius.
+            __m128 outside = _mm_setzero_ps();
+            for (uint32_t p = 0; p < Frustum::NUM_PLANES; p++)
+            {
+                __m128 dist = _mm_add_ps( _mm_mul_ps( x, planeX[p] ), planeW[p] );
+                dist = _mm_add_ps( dist, _mm_mul_ps( y, planeY[p] ) );
+                dist = _mm_add_ps( dist, _mm_mul_ps( z, planeZ[p] ) );
+                outside = _mm_or_ps( outside, _mm_cmplt_ps( dist, negRadius ) );
+            }
+
+            int const outsideMask = _mm_movemask_ps( outside );
+            for (uint32_t j = 0; j < 4 && i + j < count; j++)
+            {
+                visible[i + j] = (outsideMask & (1 << j)) ? 0 : 1;
+            }
+        }
+#else
+        for (uint32_t i = 0; i < count; i++)
+        {
+            BoundingSphere sphere;
+            sphere.mCenter = glm::vec3( mX[i], mY[i], mZ[i] );
+            sphere.mRadius = mRadius[i];
+            visible[i] = frustum.Intersects( sphere ) ? 1 : 0;
+        }
+#endif
+
+        mX.resize( count );
+        mY.resize( count );
+        mZ.resize( count );
+        mRadius.resize( count );
+    }
+
+private:
+    std::vector<float> mX;
+    std::vector<float> mY;
+    std::vector<float> mZ;
+    std::vector<float> mRadius;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,197 @@
+//=============================================================================
+// Deferred Shading
+//
+// The alternative to forward shading in model.fs. The scene is drawn once
+// into a G-buffer,
+//
+//   albedo     RGBA8       texture colour as sampled, a = specular scale
+//   normal     RGBA16F     octahedral world normal, shininess, diffuse scale
+//   depth      D24S8
+//
+// then every light is drawn as a single instanced quad covering the screen
+// rectangle of its sphere, adding its contribution into an RGBA16F light
+// buffer for just the pixels it reaches. A last full screen pass adds the
+// ambient term, applies gamma and writes the G-buffer depth to the default
+// framebuffer so anything drawn afterwards (occlusion queries) still sees it.
+//
+// Lighting cost then depends on how many pixels each light covers, not on
+// how many triangles or how much overdraw the scene has.
+//=============================================================================
+
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <renderqueue.h>
+#include <shader.h>
+#include <shadervariants.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+//=============================================================================
+
+class DeferredRenderer
+{
+public:
+    DeferredRenderer():
+        mGBuffer( 0 ),
+        mLightBuffer( 0 ),
+        mAlbedoTexture( 0 ),
+        mNormalTexture( 0 ),
+        mDepthTexture( 0 ),
+        mLightTexture( 0 ),
+        mEmptyVertexArray( 0 ),
+        mSize( 0 )
+    {
+    }
+
+    void Init()
+    {
+        // Same vertex shader as forward shading, so the same packets draw into the G-buffer.
+        // The G-buffer only cares whether there is a diffuse map and where it is, the rest is lighting.
+        mGeometryShader.reset( new ShaderVariants( "shaders/model.vs", "shaders/gbuffer.fs" ) );
+        mGeometryShader->Prewarm( SHADER_FEATURE_NO_TEXTURE );
+        mGeometryShader->Prewarm( SHADER_FEATURE_MATERIAL_ARRAY );
+        mLightShader.reset( new Shader( "shaders/deferredlight.vs", "shaders/deferredlight.fs" ) );
+        mResolveShader.reset( new Shader( "shaders/fullscreen.vs", "shaders/deferredresolve.fs" ) );
+
+        // Core profile wants a vertex array bound even for draws that don't read any attributes.
+        glGenVertexArrays( 1, &mEmptyVertexArray );
+        glGenFramebuffers( 1, &mGBuffer );
+        glGenFramebuffers( 1, &mLightBuffer );
+    }
+
+    // The program scene geometry with these forward shading features (see
+    // SelectShaderFeatures) should be drawn with between BeginGeometry() and Light().
+    const Shader* GetGeometryShader( uint32_t const features ) { return mGeometryShader->Get( features & (SHADER_FEATURE_NO_TEXTURE | SHADER_FEATURE_MATERIAL_ARRAY) ); }
+
+    // Binds and clears the G-buffer, (re)creating it if the framebuffer changed size.
+    void BeginGeometry( RenderBackend& backend, glm::ivec2 const size )
+    {
+        if (size != mSize)
+        {
+            // Creating the targets binds textures behind the backend's back.
+            Resize( size );
+            backend.Invalidate();
+        }
+        glBindFramebuffer( GL_FRAMEBUFFER, mGBuffer );
+        glViewport( 0, 0, mSize.x, mSize.y );
+        glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+        glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    }
+
+    // Accumulates the first 'numLights' lights of the LightData block.
+    void Light( RenderBackend& backend, uint32_t const numLights, const glm::mat4& viewProjection )
+    {
+        glBindFramebuffer( GL_FRAMEBUFFER, mLightBuffer );
+        glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+        glClear( GL_COLOR_BUFFER_BIT );
+        if (numLights > 0)
+        {
+            glDisable( GL_DEPTH_TEST );
+            glEnable( GL_BLEND );
+            glBlendFunc( GL_ONE, GL_ONE );
+
+            backend.UseProgram( *mLightShader );
+            mLightShader->setMat4( "inverseViewProjection", glm::inverse( viewProjection ) );
+            BindGBuffer( backend, *mLightShader );
+            backend.BindVertexArray( mEmptyVertexArray );
+            glDrawArraysInstanced( GL_TRIANGLE_STRIP, 0, 4, (GLsizei)numLights );
+
+            glDisable( GL_BLEND );
+            glEnable( GL_DEPTH_TEST );
+        }
+    }
+
+    // Composites into the default framebuffer, depth included.
+    void Resolve( RenderBackend& backend )
+    {
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+        glDepthFunc( GL_ALWAYS );
+
+        backend.UseProgram( *mResolveShader );
+        BindGBuffer( backend, *mResolveShader );
+        mResolveShader->setInt( "lightAccumulation", 3 );
+        backend.BindTexture( 3, mLightTexture );
+        backend.BindVertexArray( mEmptyVertexArray );
+        glDrawArrays( GL_TRIANGLES, 0, 3 );
+
+        glDepthFunc( GL_LESS );
+    }
+
+private:
+    void BindGBuffer( RenderBackend& backend, const Shader& shader )
+    {
+        shader.setInt( "gbufferAlbedo", 0 );
+        shader.setInt( "gbufferNormal", 1 );
+        shader.setInt( "gbufferDepth", 2 );
+        backend.BindTexture( 0, mAlbedoTexture );
+        backend.BindTexture( 1, mNormalTexture );
+        backend.BindTexture( 2, mDepthTexture );
+    }
+
+    static GLuint CreateTarget( glm::ivec2 const size, GLenum const internalFormat, GLenum const format, GLenum const type )
+    {
+        GLuint texture;
+        glGenTextures( 1, &texture );
+        glBindTexture( GL_TEXTURE_2D, texture );
+        glTexImage2D( GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, format, type, nullptr );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        return texture;
+    }
+
+    void Resize( glm::ivec2 const size )
+    {
+        GLuint const textures[] = { mAlbedoTexture, mNormalTexture, mDepthTexture, mLightTexture };
+        glDeleteTextures( 4, textures );
+
+        mSize = glm::max( size, glm::ivec2( 1 ) );
+        mAlbedoTexture = CreateTarget( mSize, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE );
+        mNormalTexture = CreateTarget( mSize, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT );
+        mDepthTexture = CreateTarget( mSize, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8 );
+        mLightTexture = CreateTarget( mSize, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT );
+
+        glBindFramebuffer( GL_FRAMEBUFFER, mGBuffer );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mAlbedoTexture, 0 );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mNormalTexture, 0 );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture, 0 );
+        GLenum const drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers( 2, drawBuffers );
+        if (glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "DeferredRenderer: G-buffer is incomplete" << std::endl;
+        }
+
+        glBindFramebuffer( GL_FRAMEBUFFER, mLightBuffer );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mLightTexture, 0 );
+        if (glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "DeferredRenderer: light buffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    }
+
+    std::unique_ptr<ShaderVariants> mGeometryShader;
+    std::unique_ptr<Shader> mLightShader;
+    std::unique_ptr<Shader> mResolveShader;
+    GLuint mGBuffer;
+    GLuint mLightBuffer;
+    GLuint mAlbedoTexture;
+    GLuint mNormalTexture;
+    GLuint mDepthTexture;
+    GLuint mLightTexture;
+    GLuint mEmptyVertexArray;
+    glm::ivec2 mSize;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,150 @@
+//=============================================================================
+// Depth Pre-pass
+//
+// Lays down the depth of every opaque packet with a position only program
+// (shaders/depth.vs) and no colour writes, so the main pass can run with
+// GL_LEQUAL and depth writes off and shade each pixel once. The pre-pass
+// costs a second trip through the vertex work, so it only pays off when the
+// scene has real overdraw.
+//
+// Overdraw is measured with a GL_SAMPLES_PASSED query around whichever pass
+// lays depth down first (the pre-pass when it runs, the main pass
+// otherwise): fragments passing the depth test per pixel of the target.
+// Results are polled a few frames late so we never wait on the GPU. In
+// auto mode the pre-pass turns on above ENABLE_OVERDRAW and back off below
+// DISABLE_OVERDRAW.
+//=============================================================================
+
+#ifndef DEPTHPREPASS_H
+#define DEPTHPREPASS_H
+
+#include <glad/glad.h>
+
+#include <shader.h>
+
+#include <cstdint>
+#include <memory>
+
+//=============================================================================
+
+class DepthPrepass
+{
+public:
+    enum Mode
+    {
+        MODE_OFF,
+        MODE_ON,
+        MODE_AUTO,
+        NUM_MODES
+    };
+
+    static constexpr float ENABLE_OVERDRAW = 1.6f;
+    static constexpr float DISABLE_OVERDRAW = 1.3f;
+    static uint32_t const NUM_QUERIES = 4;
+
+    DepthPrepass():
+        mMode( MODE_AUTO ),
+        mEnabled( false ),
+        mMeasuring( false ),
+        mNextQuery( 0 ),
+        mOverdraw( 0.0f )
+    {
+        for (uint32_t i = 0; i < NUM_QUERIES; i++)
+        {
+            mQueries[i] = 0;
+            mPixels[i] = 0;
+        }
+    }
+
+    void Init()
+    {
+        mShader.reset( new Shader( "shaders/depth.vs", "shaders/depth.fs" ) );
+        glGenQueries( NUM_QUERIES, mQueries );
+    }
+
+    const std::shared_ptr<Shader>& GetShader() const { return mShader; }
+    Mode GetMode() const { return mMode; }
+    void SetMode( Mode const mode ) { mMode = mode; }
+    float GetOverdraw() const { return mOverdraw; }
+
+    // Whether the pre-pass runs this frame.
+    bool IsEnabled() const { return mEnabled; }
+
+    // Picks up finished measurements and decides on this frame.
+    void BeginFrame()
+    {
+        // Oldest first, stop at the first one still in flight.
+        for (uint32_t i = 0; i < NUM_QUERIES; i++)
+        {
+            uint32_t const slot = (mNextQuery + i) % NUM_QUERIES;
+            if (mPixels[slot] == 0)
+                continue;
+
+            GLuint available = 0;
+            glGetQueryObjectuiv( mQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available );
+            if (!available)
+                break;
+
+            GLuint samples = 0;
+            glGetQueryObjectuiv( mQueries[slot], GL_QUERY_RESULT, &samples );
+            mOverdraw = (float)samples / (float)mPixels[slot];
+            mPixels[slot] = 0;
+        }
+
+        switch (mMode)
+        {
+        case MODE_OFF:
+            mEnabled = false;
+            break;
+        case MODE_ON:
+            mEnabled = true;
+            break;
+        default:
+            if (mOverdraw > ENABLE_OVERDRAW)
+            {
+                mEnabled = true;
+            }
+            else if (mOverdraw < DISABLE_OVERDRAW)
+            {
+                mEnabled = false;
+            }
+            break;
+        }
+    }
+
+    // Brackets the pass that lays depth down first. Skipped if every query
+    // is still waiting on the GPU.
+    void BeginMeasure( uint32_t const pixels )
+    {
+        if (mPixels[mNextQuery] != 0 || pixels == 0)
+            return;
+
+        glBeginQuery( GL_SAMPLES_PASSED, mQueries[mNextQuery] );
+        mPixels[mNextQuery] = pixels;
+        mMeasuring = true;
+    }
+
+    void EndMeasure()
+    {
+        if (!mMeasuring)
+            return;
+
+        glEndQuery( GL_SAMPLES_PASSED );
+        mNextQuery = (mNextQuery + 1) % NUM_QUERIES;
+        mMeasuring = false;
+    }
+
+private:
+    std::shared_ptr<Shader> mShader;
+    Mode mMode;
+    bool mEnabled;
+    bool mMeasuring;
+    uint32_t mNextQuery;
+    GLuint mQueries[NUM_QUERIES];
+    uint32_t mPixels[NUM_QUERIES];      // pixels of the measured target, 0 if the query isn't in flight
+    float mOverdraw;
+};
+
+//=============================================================================
+
+#endif
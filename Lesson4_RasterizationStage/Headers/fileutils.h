@@ -0,0 +1,67 @@
+//=============================================================================
+// File Utilities
+//
+// The few file system operations the caches and the texture registry need
+// that the standard library doesn't do portably. POSIX and Windows are both
+// supported.
+//=============================================================================
+
+#ifndef FILEUTILS_H
+#define FILEUTILS_H
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+//=============================================================================
+
+// Renames 'from' to 'to', replacing 'to' if it exists. Readers of 'to' see
+// either the old file or the new one, never no file at all.
+inline bool RenameOver( const std::string& from, const std::string& to )
+{
+#if defined(_WIN32)
+    return MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+    return std::rename( from.c_str(), to.c_str() ) == 0;
+#endif
+}
+
+// A name to write 'path' under before RenameOver() puts it in place, one
+// no other write of 'path', in this process or another, is using.
+inline std::string GetTemporaryPath( const std::string& path )
+{
+    static std::atomic<uint32_t> counter( 0 );
+    uint64_t const time = (uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    return path + ".tmp." + std::to_string( time ) + "." + std::to_string( counter++ );
+}
+
+// The absolute path of 'path' with '.' and '..' resolved, and on POSIX
+// links too, so one file has one name. 'path' itself if that fails.
+inline std::string CanonicalPath( const std::string& path )
+{
+#if defined(_WIN32)
+    char resolved[_MAX_PATH];
+    return _fullpath( resolved, path.c_str(), _MAX_PATH ) != nullptr ? std::string( resolved ) : path;
+#else
+    char resolved[PATH_MAX];
+    return realpath( path.c_str(), resolved ) != nullptr ? std::string( resolved ) : path;
+#endif
+}
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,365 @@
+//=============================================================================
+// Geometry Arena
+//
+// One big vertex buffer and one big index buffer shared by every mesh of a
+// vertex format, with a single vertex array describing them. Meshes own
+// ranges of the buffers rather than buffer objects of their own, drawn with
+// the base vertex variants of the draw calls, so switching meshes never
+// switches buffers or vertex arrays.
+//
+// Ranges come from a first fit free list per buffer; when one runs out the
+// buffer doubles and the old contents are copied over on the GPU. The index
+// buffer is allocated in bytes so 16 and 32 bit indices can share it.
+//
+// GetStats() tells how full the buffers are and how often they had to grow.
+//
+// Loaders can Reserve() what a whole model needs up front and then write
+// each mesh straight into the buffers through MapVertices / MapIndices,
+// with no staging copy on the CPU.
+//=============================================================================
+
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+
+//=============================================================================
+
+// First fit allocator of [offset, offset + size) ranges.
+class RangeAllocator
+{
+public:
+    static uint32_t const INVALID = ~0u;
+
+    RangeAllocator():
+        mCapacity( 0 ),
+        mUsed( 0 )
+    {
+    }
+
+    uint32_t GetCapacity() const { return mCapacity; }
+    uint32_t GetUsed() const { return mUsed; }
+
+    // Adds [mCapacity, capacity) to the free list.
+    void Grow( uint32_t const capacity )
+    {
+        if (capacity > mCapacity)
+        {
+            uint32_t const oldCapacity = mCapacity;
+            mCapacity = capacity;
+            mUsed += capacity - oldCapacity;
+            Free( oldCapacity, capacity - oldCapacity );
+        }
+    }
+
+    // Returns the offset of the range or INVALID if nothing is big enough.
+    uint32_t Allocate( uint32_t const size, uint32_t const alignment = 1 )
+    {
+        for (auto it = mFree.begin(); it != mFree.end(); ++it)
+        {
+            uint32_t const offset = it->first;
+            uint32_t const aligned = (offset + alignment - 1) / alignment * alignment;
+            uint32_t const padding = aligned - offset;
+            if (it->second < padding + size)
+                continue;
+
+            uint32_t const remaining = it->second - padding - size;
+            mFree.erase( it );
+            if (padding > 0)
+            {
+                mFree[offset] = padding;
+            }
+            if (remaining > 0)
+            {
+                mFree[aligned + size] = remaining;
+            }
+            mUsed += size;
+            return aligned;
+        }
+        return INVALID;
+    }
+
+    // Returns a range, merging it with free neighbours.
+    void Free( uint32_t offset, uint32_t size )
+    {
+        if (size == 0)
+            return;
+
+        mUsed -= size;
+        auto next = mFree.lower_bound( offset );
+        if (next != mFree.begin())
+        {
+            auto prev = std::prev( next );
+            if (prev->first + prev->second == offset)
+            {
+                offset = prev->first;
+                size += prev->second;
+                mFree.erase( prev );
+            }
+        }
+        if (next != mFree.end() && offset + size == next->first)
+        {
+            size += next->second;
+            mFree.erase( next );
+        }
+        mFree[offset] = size;
+    }
+
+private:
+    std::map<uint32_t, uint32_t> mFree;     // offset -> size
+    uint32_t mCapacity;
+    uint32_t mUsed;
+};
+
+//=============================================================================
+
+struct GeometryArenaStats
+{
+    uint32_t mVerticesUsed;
+    uint32_t mVertexCapacity;
+    uint32_t mIndexBytesUsed;
+    uint32_t mIndexCapacity;        // in bytes
+    uint32_t mVertexGrowths;        // times the vertex buffer was reallocated after the first
+    uint32_t mIndexGrowths;
+};
+
+//=============================================================================
+
+struct GeometryRange
+{
+    uint32_t mBaseVertex;
+    uint32_t mVertexCount;
+    uint32_t mIndexOffset;      // in bytes
+    uint32_t mIndexBytes;
+};
+
+//=============================================================================
+
+class GeometryArena
+{
+public:
+    // setupAttributes is called with the vertex array and vertex buffer
+    // bound and describes the vertex format with glVertexAttribPointer.
+    GeometryArena( uint32_t const vertexSize, const std::function<void()>& setupAttributes ):
+        mVertexSize( vertexSize ),
+        mSetupAttributes( setupAttributes ),
+        mVertexArray( 0 ),
+        mVertexBuffer( 0 ),
+        mIndexBuffer( 0 ),
+        mVertexGrowths( 0 ),
+        mIndexGrowths( 0 )
+    {
+    }
+
+    GLuint GetVertexArray() const { return mVertexArray; }
+
+    GeometryArenaStats GetStats() const
+    {
+        GeometryArenaStats stats;
+        stats.mVerticesUsed = mVertices.GetUsed();
+        stats.mVertexCapacity = mVertices.GetCapacity();
+        stats.mIndexBytesUsed = mIndices.GetUsed();
+        stats.mIndexCapacity = mIndices.GetCapacity();
+        stats.mVertexGrowths = mVertexGrowths;
+        stats.mIndexGrowths = mIndexGrowths;
+        return stats;
+    }
+
+    // Reserves space for a mesh, growing the buffers if need be. The
+    // indices are aligned to indexSize.
+    GeometryRange Allocate( uint32_t const vertexCount, uint32_t const indexCount, uint32_t const indexSize )
+    {
+        if (mVertexArray == 0)
+        {
+            Init();
+        }
+
+        GeometryRange range;
+        range.mVertexCount = vertexCount;
+        range.mIndexBytes = indexCount * indexSize;
+        range.mBaseVertex = mVertices.Allocate( vertexCount );
+        if (range.mBaseVertex == RangeAllocator::INVALID)
+        {
+            GrowVertices( vertexCount );
+            range.mBaseVertex = mVertices.Allocate( vertexCount );
+        }
+        range.mIndexOffset = mIndices.Allocate( range.mIndexBytes, indexSize );
+        if (range.mIndexOffset == RangeAllocator::INVALID)
+        {
+            GrowIndices( range.mIndexBytes + indexSize );
+            range.mIndexOffset = mIndices.Allocate( range.mIndexBytes, indexSize );
+        }
+        return range;
+    }
+
+    void Free( const GeometryRange& range )
+    {
+        mVertices.Free( range.mBaseVertex, range.mVertexCount );
+        mIndices.Free( range.mIndexOffset, range.mIndexBytes );
+    }
+
+    // Grows the buffers once so the given amount fits on top of what is
+    // already used, rather than doubling repeatedly while a model loads.
+    void Reserve( uint32_t const vertexCount, uint32_t const indexBytes )
+    {
+        if (mVertexArray == 0)
+        {
+            Init();
+        }
+        if (mVertices.GetUsed() + vertexCount > mVertices.GetCapacity())
+        {
+            GrowVertices( mVertices.GetUsed() + vertexCount - mVertices.GetCapacity() );
+        }
+        if (mIndices.GetUsed() + indexBytes > mIndices.GetCapacity())
+        {
+            GrowIndices( mIndices.GetUsed() + indexBytes - mIndices.GetCapacity() );
+        }
+    }
+
+    // Copies a mesh's vertices or indices into its range. Goes through the copy
+    // targets so the element array binding of whatever vertex array is bound is left alone.
+    void UploadVertices( const GeometryRange& range, const void* vertices )
+    {
+        glBindBuffer( GL_COPY_WRITE_BUFFER, mVertexBuffer );
+        glBufferSubData( GL_COPY_WRITE_BUFFER, (GLintptr)range.mBaseVertex * mVertexSize, (GLsizeiptr)range.mVertexCount * mVertexSize, vertices );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+    }
+
+    void UploadIndices( const GeometryRange& range, const void* indices )
+    {
+        glBindBuffer( GL_COPY_WRITE_BUFFER, mIndexBuffer );
+        glBufferSubData( GL_COPY_WRITE_BUFFER, (GLintptr)range.mIndexOffset, (GLsizeiptr)range.mIndexBytes, indices );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+    }
+
+    // Maps a range's vertices for writing, discarding whatever was there.
+    // Write them all, then UnmapVertices() before anything draws. Returns
+    // nullptr if the driver wouldn't map, use UploadVertices then. Unmapping
+    // returns false if the contents were lost while mapped, upload them
+    // again in that case too.
+    void* MapVertices( const GeometryRange& range )
+    {
+        return Map( mVertexBuffer, (GLintptr)range.mBaseVertex * mVertexSize, (GLsizeiptr)range.mVertexCount * mVertexSize );
+    }
+
+    bool UnmapVertices()
+    {
+        return Unmap( mVertexBuffer );
+    }
+
+    void* MapIndices( const GeometryRange& range )
+    {
+        return Map( mIndexBuffer, (GLintptr)range.mIndexOffset, (GLsizeiptr)range.mIndexBytes );
+    }
+
+    bool UnmapIndices()
+    {
+        return Unmap( mIndexBuffer );
+    }
+
+private:
+    static uint32_t const INITIAL_VERTICES = 1 << 18;
+    static uint32_t const INITIAL_INDEX_BYTES = 1 << 22;
+
+    void Init()
+    {
+        glGenVertexArrays( 1, &mVertexArray );
+        mVertexBuffer = CreateBuffer( INITIAL_VERTICES * mVertexSize );
+        mIndexBuffer = CreateBuffer( INITIAL_INDEX_BYTES );
+        mVertices.Grow( INITIAL_VERTICES );
+        mIndices.Grow( INITIAL_INDEX_BYTES );
+        BindVertexArray();
+    }
+
+    static GLuint CreateBuffer( uint32_t const size )
+    {
+        GLuint buffer;
+        glGenBuffers( 1, &buffer );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, buffer );
+        glBufferData( GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+        return buffer;
+    }
+
+    static void* Map( GLuint const buffer, GLintptr const offset, GLsizeiptr const size )
+    {
+        if (size == 0)
+            return nullptr;
+        glBindBuffer( GL_COPY_WRITE_BUFFER, buffer );
+        void* data = glMapBufferRange( GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+        return data;
+    }
+
+    static bool Unmap( GLuint const buffer )
+    {
+        glBindBuffer( GL_COPY_WRITE_BUFFER, buffer );
+        bool const intact = glUnmapBuffer( GL_COPY_WRITE_BUFFER ) != GL_FALSE;
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+        return intact;
+    }
+
+    // Points the vertex array at the current buffers.
+    void BindVertexArray()
+    {
+        glBindVertexArray( mVertexArray );
+        glBindBuffer( GL_ARRAY_BUFFER, mVertexBuffer );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer );
+        mSetupAttributes();
+        glBindVertexArray( 0 );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+
+    // Makes a bigger buffer holding the old one's contents.
+    static GLuint GrowBuffer( GLuint const buffer, uint32_t const oldSize, uint32_t const newSize )
+    {
+        GLuint const newBuffer = CreateBuffer( newSize );
+        glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, newBuffer );
+        glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+        glDeleteBuffers( 1, &buffer );
+        return newBuffer;
+    }
+
+    void GrowVertices( uint32_t const needed )
+    {
+        uint32_t const oldCapacity = mVertices.GetCapacity();
+        uint32_t const newCapacity = std::max( oldCapacity * 2, oldCapacity + needed );
+        mVertexGrowths++;
+        mVertexBuffer = GrowBuffer( mVertexBuffer, oldCapacity * mVertexSize, newCapacity * mVertexSize );
+        mVertices.Grow( newCapacity );
+        BindVertexArray();
+    }
+
+    void GrowIndices( uint32_t const needed )
+    {
+        uint32_t const oldCapacity = mIndices.GetCapacity();
+        uint32_t const newCapacity = std::max( oldCapacity * 2, oldCapacity + needed );
+        mIndexGrowths++;
+        mIndexBuffer = GrowBuffer( mIndexBuffer, oldCapacity, newCapacity );
+        mIndices.Grow( newCapacity );
+        BindVertexArray();
+    }
+
+    uint32_t mVertexSize;
+    std::function<void()> mSetupAttributes;
+    GLuint mVertexArray;
+    GLuint mVertexBuffer;
+    GLuint mIndexBuffer;
+    RangeAllocator mVertices;
+    RangeAllocator mIndices;
+    uint32_t mVertexGrowths;
+    uint32_t mIndexGrowths;
+};
+
+//=============================================================================
+
+#endif
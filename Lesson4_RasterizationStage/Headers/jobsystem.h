@@ -0,0 +1,204 @@
+//=============================================================================
+// Job System
+//
+// A fixed pool of worker threads pulling jobs off one shared queue. Jobs
+// can be tracked with a JobCounter; waiting on a counter runs its queued
+// jobs on the waiting thread instead of sleeping, so it is safe to wait
+// from inside a job. Only the counter's own jobs: a frame waiting on its
+// culling must not end up decoding a texture meanwhile.
+//
+// ParallelFor() jobs go to the front of the queue, the caller is waiting
+// for them, while long background loads queue at the back.
+//=============================================================================
+
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//=============================================================================
+
+struct JobCounter
+{
+    JobCounter():
+        mPending( 0 )
+    {
+    }
+
+    bool IsDone() const { return mPending.load() == 0; }
+
+    std::atomic<uint32_t> mPending;
+};
+
+//=============================================================================
+
+class JobSystem
+{
+public:
+    // By default one worker per core, leaving one for the calling thread.
+    explicit JobSystem( uint32_t numWorkers = 0 ):
+        mQuit( false )
+    {
+        if (numWorkers == 0)
+        {
+            uint32_t const numCores = std::thread::hardware_concurrency();
+            numWorkers = numCores > 1 ? numCores - 1 : 1;
+        }
+        for (uint32_t i = 0; i < numWorkers; i++)
+        {
+            mWorkers.push_back( std::thread( [this]() { WorkerLoop(); } ) );
+        }
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            mQuit = true;
+        }
+        mWakeUp.notify_all();
+        for (auto& worker : mWorkers)
+        {
+            worker.join();
+        }
+    }
+
+    uint32_t GetNumWorkers() const { return (uint32_t)mWorkers.size(); }
+
+    void Submit( const std::function<void()>& job, JobCounter* counter = nullptr )
+    {
+        Push( job, counter, false );
+    }
+
+    // Runs the counter's queued jobs on this thread until everything it tracks has finished.
+    void Wait( const JobCounter& counter )
+    {
+        while (!counter.IsDone())
+        {
+            if (!RunOne( &counter ))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Calls func( i ) for i in [0, count) spread over the workers and the calling thread.
+    void ParallelFor( uint32_t const count, const std::function<void( uint32_t )>& func )
+    {
+        std::atomic<uint32_t> next( 0 );
+        auto worker = [&]()
+        {
+            for (uint32_t i = next++; i < count; i = next++)
+            {
+                func( i );
+            }
+        };
+
+        JobCounter counter;
+        uint32_t const numJobs = count < GetNumWorkers() ? count : GetNumWorkers();
+        for (uint32_t i = 0; i < numJobs; i++)
+        {
+            Push( worker, &counter, true );
+        }
+        worker();
+        Wait( counter );
+    }
+
+    // Runs one queued job on this thread if there is one, any job at all,
+    // for threads that have their own work to wait on between jobs.
+    bool RunOne() { return RunOne( nullptr ); }
+
+private:
+    struct Job
+    {
+        Job( const std::function<void()>& func, JobCounter* counter ):
+            mFunc( func ),
+            mCounter( counter )
+        {
+        }
+
+        std::function<void()> mFunc;
+        JobCounter* mCounter;
+    };
+
+    void Push( const std::function<void()>& job, JobCounter* counter, bool const urgent )
+    {
+        if (counter != nullptr)
+        {
+            counter->mPending++;
+        }
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            if (urgent)
+            {
+                mJobs.push_front( Job( job, counter ) );
+            }
+            else
+            {
+                mJobs.push_back( Job( job, counter ) );
+            }
+        }
+        mWakeUp.notify_one();
+    }
+
+    // Runs the first queued job tracked by 'counter', or any job if it is null.
+    bool RunOne( const JobCounter* counter )
+    {
+        std::unique_lock<std::mutex> lock( mMutex );
+        auto it = mJobs.begin();
+        while (it != mJobs.end() && counter != nullptr && it->mCounter != counter)
+        {
+            ++it;
+        }
+        if (it == mJobs.end())
+            return false;
+        Job job = *it;
+        mJobs.erase( it );
+        lock.unlock();
+
+        Execute( job );
+        return true;
+    }
+
+    void Execute( Job& job )
+    {
+        job.mFunc();
+        if (job.mCounter != nullptr)
+        {
+            job.mCounter->mPending--;
+        }
+    }
+
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock( mMutex );
+            mWakeUp.wait( lock, [this]() { return mQuit || !mJobs.empty(); } );
+            if (mQuit && mJobs.empty())
+                return;
+            Job job = mJobs.front();
+            mJobs.pop_front();
+            lock.unlock();
+
+            Execute( job );
+        }
+    }
+
+    std::vector<std::thread> mWorkers;
+    std::deque<Job> mJobs;
+    std::mutex mMutex;
+    std::condition_variable mWakeUp;
+    bool mQuit;
+};
+
+//=============================================================================
+
+#endif
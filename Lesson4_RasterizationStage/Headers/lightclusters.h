@@ -0,0 +1,251 @@
+//=============================================================================
+// Light Clusters
+//
+// Clustered forward lighting. The view frustum is cut into a grid of
+// froxels, TILES_X x TILES_Y screen tiles by SLICES depth slices spaced
+// exponentially between the near and far planes. Every frame each light's
+// sphere is assigned, on the CPU, to the froxels it overlaps, and the
+// result goes to the GPU as two texture buffers:
+//
+//   cluster grid     RG32UI, per froxel the offset and count of its lights
+//   light indices    R16UI, the lights of every froxel back to back
+//
+// A fragment works out its froxel from gl_FragCoord and its view depth
+// (shaders/clusters.glsl) and only shades the lights listed there. The
+// constants needed for that lookup ride along in the FrameData block.
+//=============================================================================
+
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.h>
+#include <uniformblocks.h>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+//=============================================================================
+
+class LightClusters
+{
+public:
+    static uint32_t const TILES_X = 16;
+    static uint32_t const TILES_Y = 9;
+    static uint32_t const SLICES = 24;
+    static uint32_t const NUM_CLUSTERS = TILES_X * TILES_Y * SLICES;
+
+    LightClusters():
+        mGridBuffer( 0 ),
+        mIndexBuffer( 0 ),
+        mGridTexture( 0 ),
+        mIndexTexture( 0 ),
+        mMaxIndices( 0 ),
+        mNumIndices( 0 ),
+        mMaxClusterLights( 0 )
+    {
+    }
+
+    // Creates the buffers and binds them to their shared texture units,
+    // where they stay for good.
+    void Init()
+    {
+        GLint maxTexels = 65536;
+        glGetIntegerv( GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels );
+        mMaxIndices = (uint32_t)maxTexels;
+
+        glGenBuffers( 1, &mGridBuffer );
+        glGenBuffers( 1, &mIndexBuffer );
+        glBindBuffer( GL_TEXTURE_BUFFER, mGridBuffer );
+        glBufferData( GL_TEXTURE_BUFFER, NUM_CLUSTERS * 2 * sizeof( uint32_t ), nullptr, GL_STREAM_DRAW );
+        glBindBuffer( GL_TEXTURE_BUFFER, mIndexBuffer );
+        glBufferData( GL_TEXTURE_BUFFER, sizeof( uint16_t ), nullptr, GL_STREAM_DRAW );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+
+        glGenTextures( 1, &mGridTexture );
+        glGenTextures( 1, &mIndexTexture );
+        glActiveTexture( GL_TEXTURE0 + SHARED_TEXTURE_FIRST_UNIT + SHARED_TEXTURE_CLUSTER_GRID );
+        glBindTexture( GL_TEXTURE_BUFFER, mGridTexture );
+        glTexBuffer( GL_TEXTURE_BUFFER, GL_RG32UI, mGridBuffer );
+        glActiveTexture( GL_TEXTURE0 + SHARED_TEXTURE_FIRST_UNIT + SHARED_TEXTURE_CLUSTER_LIGHTS );
+        glBindTexture( GL_TEXTURE_BUFFER, mIndexTexture );
+        glTexBuffer( GL_TEXTURE_BUFFER, GL_R16UI, mIndexBuffer );
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    // Rebuilds the froxel light lists for this frame and fills in the
+    // cluster constants of 'frame'. 'lights' are in world space; anything
+    // past MAX_LIGHTS is ignored, as it is by UniformBlocks.
+    void Update( FrameBlock& frame, const std::vector<PointLightBlock>& lights, const glm::mat4& view, const glm::mat4& projection,
+                 glm::ivec2 const framebufferSize, float const nearPlane, float const farPlane, bool const enabled )
+    {
+        glm::vec2 const size = glm::max( glm::vec2( framebufferSize ), glm::vec2( 1.0f ) );
+        glm::vec2 const tileSize( std::ceil( size.x / TILES_X ), std::ceil( size.y / TILES_Y ) );
+        float const logDepthRange = std::log( farPlane / nearPlane );
+        float const sliceScale = SLICES / logDepthRange;
+        float const sliceBias = -SLICES * std::log( nearPlane ) / logDepthRange;
+
+        frame.mClusterScale = glm::vec4( 1.0f / tileSize.x, 1.0f / tileSize.y, sliceScale, sliceBias );
+        frame.mClusterDims = glm::ivec4( TILES_X, TILES_Y, SLICES, enabled ? 1 : 0 );
+        frame.mViewportSize = glm::vec4( size, 0.0f, 0.0f );
+
+        mNumIndices = 0;
+        mMaxClusterLights = 0;
+        if (!enabled)
+            return;
+
+        // Gather one tile rectangle per light and slice it touches.
+        mRecords.clear();
+        uint32_t const numLights = glm::min( (uint32_t)lights.size(), MAX_LIGHTS );
+        for (uint32_t i = 0; i < numLights; i++)
+        {
+            glm::vec3 const center = glm::vec3( view * glm::vec4( glm::vec3( lights[i].mPositionRadius ), 1.0f ) );
+            float const radius = lights[i].mPositionRadius.w;
+            float const depth = -center.z;
+            if (depth + radius < nearPlane || depth - radius > farPlane)
+                continue;
+
+            float const zMin = glm::max( depth - radius, nearPlane );
+            float const zMax = glm::min( depth + radius, farPlane );
+            uint32_t const firstSlice = Slice( zMin, sliceScale, sliceBias );
+            uint32_t const lastSlice = Slice( zMax, sliceScale, sliceBias );
+            for (uint32_t slice = firstSlice; slice <= lastSlice; slice++)
+            {
+                // The part of the sphere inside this slice is narrower than the sphere
+                // unless the slice holds its centre.
+                float const sliceNear = glm::max( SliceDepth( slice, nearPlane, farPlane ), zMin );
+                float const sliceFar = glm::min( SliceDepth( slice + 1, nearPlane, farPlane ), zMax );
+                float const offset = depth < sliceNear ? sliceNear - depth : (depth > sliceFar ? depth - sliceFar : 0.0f);
+                float const sliceRadius = std::sqrt( glm::max( radius * radius - offset * offset, 0.0f ) );
+
+                // Screen rectangle of the box around that part of the sphere.
+                glm::vec2 lo( size );
+                glm::vec2 hi( 0.0f );
+                for (uint32_t corner = 0; corner < 8; corner++)
+                {
+                    glm::vec4 const p( center.x + ((corner & 1) ? sliceRadius : -sliceRadius),
+                                       center.y + ((corner & 2) ? sliceRadius : -sliceRadius),
+                                       (corner & 4) ? -sliceFar : -sliceNear, 1.0f );
+                    glm::vec4 const clip = projection * p;
+                    glm::vec2 const pixel = (glm::vec2( clip ) / clip.w * 0.5f + 0.5f) * size;
+                    lo = glm::min( lo, pixel );
+                    hi = glm::max( hi, pixel );
+                }
+                if (hi.x < 0.0f || hi.y < 0.0f || lo.x >= size.x || lo.y >= size.y)
+                    continue;
+
+                Record record;
+                record.mLight = (uint16_t)i;
+                record.mSlice = (uint16_t)slice;
+                record.mX0 = (uint8_t)glm::clamp( (int)(lo.x / tileSize.x), 0, (int)TILES_X - 1 );
+                record.mX1 = (uint8_t)glm::clamp( (int)(hi.x / tileSize.x), 0, (int)TILES_X - 1 );
+                record.mY0 = (uint8_t)glm::clamp( (int)(lo.y / tileSize.y), 0, (int)TILES_Y - 1 );
+                record.mY1 = (uint8_t)glm::clamp( (int)(hi.y / tileSize.y), 0, (int)TILES_Y - 1 );
+                mRecords.push_back( record );
+            }
+        }
+
+        // Count, lay the lists out back to back, then fill them in light order.
+        mCounts.assign( NUM_CLUSTERS, 0 );
+        for (const Record& record : mRecords)
+        {
+            for (uint32_t y = record.mY0; y <= record.mY1; y++)
+            {
+                for (uint32_t x = record.mX0; x <= record.mX1; x++)
+                {
+                    mCounts[ClusterIndex( x, y, record.mSlice )]++;
+                }
+            }
+        }
+
+        mGrid.resize( NUM_CLUSTERS * 2 );
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < NUM_CLUSTERS; i++)
+        {
+            // Lists that would run past what a buffer texture can address lose their tail.
+            uint32_t const count = glm::min( mCounts[i], mMaxIndices - offset );
+            mGrid[i * 2 + 0] = offset;
+            mGrid[i * 2 + 1] = count;
+            mCounts[i] = offset;    // now the write cursor
+            offset += count;
+            mMaxClusterLights = glm::max( mMaxClusterLights, count );
+        }
+        mNumIndices = offset;
+
+        mIndices.resize( glm::max( mNumIndices, 1u ) );
+        for (const Record& record : mRecords)
+        {
+            for (uint32_t y = record.mY0; y <= record.mY1; y++)
+            {
+                for (uint32_t x = record.mX0; x <= record.mX1; x++)
+                {
+                    uint32_t const cluster = ClusterIndex( x, y, record.mSlice );
+                    if (mCounts[cluster] < mGrid[cluster * 2] + mGrid[cluster * 2 + 1])
+                    {
+                        mIndices[mCounts[cluster]++] = record.mLight;
+                    }
+                }
+            }
+        }
+
+        // Orphan both so we never wait on the GPU reading last frame's lists.
+        glBindBuffer( GL_TEXTURE_BUFFER, mGridBuffer );
+        glBufferData( GL_TEXTURE_BUFFER, mGrid.size() * sizeof( uint32_t ), nullptr, GL_STREAM_DRAW );
+        glBufferSubData( GL_TEXTURE_BUFFER, 0, mGrid.size() * sizeof( uint32_t ), &mGrid[0] );
+        glBindBuffer( GL_TEXTURE_BUFFER, mIndexBuffer );
+        glBufferData( GL_TEXTURE_BUFFER, mIndices.size() * sizeof( uint16_t ), nullptr, GL_STREAM_DRAW );
+        glBufferSubData( GL_TEXTURE_BUFFER, 0, mIndices.size() * sizeof( uint16_t ), &mIndices[0] );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+    }
+
+    uint32_t GetNumIndices() const { return mNumIndices; }
+    uint32_t GetMaxClusterLights() const { return mMaxClusterLights; }
+
+private:
+    // One light's tiles within one slice.
+    struct Record
+    {
+        uint16_t mLight;
+        uint16_t mSlice;
+        uint8_t mX0;
+        uint8_t mX1;
+        uint8_t mY0;
+        uint8_t mY1;
+    };
+
+    static uint32_t ClusterIndex( uint32_t const x, uint32_t const y, uint32_t const slice )
+    {
+        return (slice * TILES_Y + y) * TILES_X + x;
+    }
+
+    // Same mapping as clusters.glsl.
+    static uint32_t Slice( float const depth, float const scale, float const bias )
+    {
+        return (uint32_t)glm::clamp( (int)std::floor( std::log( depth ) * scale + bias ), 0, (int)SLICES - 1 );
+    }
+
+    // View depth where 'slice' begins.
+    static float SliceDepth( uint32_t const slice, float const nearPlane, float const farPlane )
+    {
+        return nearPlane * std::pow( farPlane / nearPlane, (float)slice / (float)SLICES );
+    }
+
+    GLuint mGridBuffer;
+    GLuint mIndexBuffer;
+    GLuint mGridTexture;
+    GLuint mIndexTexture;
+    uint32_t mMaxIndices;
+    uint32_t mNumIndices;
+    uint32_t mMaxClusterLights;
+    std::vector<Record> mRecords;
+    std::vector<uint32_t> mCounts;
+    std::vector<uint32_t> mGrid;
+    std::vector<uint16_t> mIndices;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,154 @@
+//=============================================================================
+// Material Packer
+//
+// Gathers the diffuse maps of a model into one GL_TEXTURE_2D_ARRAY, one
+// layer per map, so every mesh of the model binds the same texture and
+// only differs in which layer it samples. The layer travels with the
+// mesh's vertices (see PackVertex), so draws of different meshes need no
+// per draw state to tell them apart.
+//
+// Layers all share the array's size and format: the largest map decides
+// the size (up to MAX_LAYER_SIZE) and smaller ones are resized up to it
+// with stb_image_resize. The format is BC3 if any map has alpha, BC1
+// otherwise, or RGBA8 where the driver can't sample those. Maps that
+// already fit come straight from their texture cache file.
+//
+// An array holds at most MAX_LAYERS maps, the rest stay plain textures.
+// Arrays are fully resident, they aren't streamed.
+//=============================================================================
+
+#ifndef MATERIALPACKER_H
+#define MATERIALPACKER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <texturecache.h>
+#include <textureloader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//=============================================================================
+
+class MaterialPacker
+{
+public:
+    static uint32_t const MAX_LAYER_SIZE = 2048;
+    // The fewest layers GL_MAX_ARRAY_TEXTURE_LAYERS allows on a GL 3.3 driver. A
+    // fixed limit hands out the same layers on loader threads without a context.
+    static uint32_t const MAX_LAYERS = 256;
+
+    MaterialPacker():
+        mTexture( 0 )
+    {
+    }
+
+    // The array, which has no storage until Build().
+    GLuint GetTexture()
+    {
+        if (mTexture == 0)
+        {
+            glGenTextures( 1, &mTexture );
+        }
+        return mTexture;
+    }
+
+    uint32_t GetNumLayers() const { return (uint32_t)mPaths.size(); }
+
+    // Returns the layer the image at 'path' goes into, or -1 if the array is
+    // full and it has to be a texture of its own.
+    int Add( const std::string& path )
+    {
+        auto it = std::find( mPaths.begin(), mPaths.end(), path );
+        if (it != mPaths.end())
+            return (int)(it - mPaths.begin());
+        if (mPaths.size() >= MAX_LAYERS)
+            return -1;
+
+        mPaths.push_back( path );
+        return (int)mPaths.size() - 1;
+    }
+
+    // Allocates the array for every layer added so far and queues their
+    // loads on 'loader'. Maps that can't be read leave their layer black.
+    void Build( TextureLoader& loader )
+    {
+        if (mPaths.empty())
+            return;
+
+        // Size and format from the image headers alone.
+        uint32_t width = 1;
+        uint32_t height = 1;
+        bool alpha = false;
+        for (const auto& path : mPaths)
+        {
+            int w, h, components;
+            if (!stbi_info( path.c_str(), &w, &h, &components ))
+            {
+                std::cout << "Texture failed to load at path: " << path << std::endl;
+                continue;
+            }
+            width = std::max( width, std::min( (uint32_t)w, MAX_LAYER_SIZE ) );
+            height = std::max( height, std::min( (uint32_t)h, MAX_LAYER_SIZE ) );
+            alpha = alpha || components == 2 || components == 4;
+        }
+
+        uint32_t const format = !TextureCache::IsSupported() ? TextureCache::FORMAT_RGBA8 : (alpha ? TextureCache::FORMAT_BC3 : TextureCache::FORMAT_BC1);
+        TextureCache::Header header;
+        memset( &header, 0, sizeof( header ) );
+        TextureCache::SetLayout( width, height, format, true, header );
+        Allocate( header );
+
+        for (uint32_t layer = 0; layer < mPaths.size(); layer++)
+        {
+            loader.LoadLayer( mTexture, mPaths[layer], header, layer );
+        }
+    }
+
+private:
+    void Allocate( const TextureCache::Header& header )
+    {
+        GLenum const internalFormat = TextureCache::GetInternalFormat( header.mFormat );
+        GLsizei const layers = (GLsizei)mPaths.size();
+        glBindTexture( GL_TEXTURE_2D_ARRAY, GetTexture() );
+        if (GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_storage)
+        {
+            glTexStorage3D( GL_TEXTURE_2D_ARRAY, (GLsizei)header.mLevels, internalFormat, (GLsizei)header.mWidth, (GLsizei)header.mHeight, layers );
+        }
+        else
+        {
+            for (uint32_t level = 0; level < header.mLevels; level++)
+            {
+                GLsizei const width = (GLsizei)TextureCache::GetLevelWidth( header, level );
+                GLsizei const height = (GLsizei)TextureCache::GetLevelHeight( header, level );
+                if (TextureCache::IsCompressed( header.mFormat ))
+                {
+                    glCompressedTexImage3D( GL_TEXTURE_2D_ARRAY, (GLint)level, internalFormat, width, height, layers, 0,
+                                            (GLsizei)TextureCache::GetLevelSize( header, level ) * layers, nullptr );
+                }
+                else
+                {
+                    glTexImage3D( GL_TEXTURE_2D_ARRAY, (GLint)level, internalFormat, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+                }
+            }
+            glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)header.mLevels - 1 );
+        }
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+    }
+
+    GLuint mTexture;
+    std::vector<std::string> mPaths;    // one per layer
+};
+
+//=============================================================================
+
+#endif
@@ -6,8 +6,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <bounds.h>
+#include <geometryarena.h>
 #include <shader.h>
+#include <textureregistry.h>
+#include <vertexformat.h>
 
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -28,43 +33,176 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// per-instance data streamed into the instance buffer every frame
+struct InstanceData {
+    // model matrix
+    glm::mat4 Model;
+    // inverse transpose of the model matrix (for normals)
+    glm::mat3 ItModel;
+};
+
+// one level of detail: a range of the mesh's index buffer drawn in place of the full mesh
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // simplification error, relative to the size of the mesh
+    float error;
+};
+
+// the geometry arena all meshes live in. vertices are stored packed (see vertexformat.h) and the
+// layout is described once, in the arena's one VAO, so drawing a different mesh binds nothing. it is
+// never destroyed since meshes held by globals give their ranges back after main() returns.
+inline GeometryArena &MeshArena()
+{
+    static GeometryArena *arena = new GeometryArena(sizeof(PackedVertex), SetupPackedVertexAttributes);
+    return *arena;
+}
+
 struct Texture {
     unsigned int id;
     string type;
     string path;
+    GLenum target = GL_TEXTURE_2D;  // GL_TEXTURE_2D_ARRAY for a model's material array (see materialpacker.h)
+    int layer = -1;                 // the layer of the array, -1 for plain textures
+    TextureHandle handle;           // keeps id alive, empty for arrays (the model owns those)
 };
 
 class Mesh {
 public:
     /*  Mesh Data  */
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
+    vector<Vertex> vertices;        // full precision copy, the GPU gets PackedVertex. empty unless kept (see Model::keepGeometry)
+    vector<unsigned int> indices;	// all levels of detail, one after the other. empty unless kept
     vector<Texture> textures;
-    unsigned int VAO;
+    vector<MeshLod> lods;           // lods[0] is the full mesh, coarser levels follow
+    vector<UniformName> samplerNames;	// sampler uniform each texture binds to (texture_diffuseN etc.)
+    BoundingBox aabb;               // model space bounds, filled in by Model::upload
+    BoundingSphere boundingSphere;
+    float uvDensity;                // texture coordinate units per model space unit, see Model::measureUvDensity
+    int materialLayer;              // layer of the material array its textures are in, -1 if they aren't
+    GeometryRange range;            // where the vertices and indices live in MeshArena()
+    unsigned int VAO;               // the arena's, shared by all meshes
+    GLenum indexType;               // GL_UNSIGNED_SHORT when there are few enough vertices, else GL_UNSIGNED_INT
+    unsigned int indexSize;
 
     /*  Functions  */
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, takes geometry packed by packGeometry, the way a model cache file holds it (see modelcache.h).
+    // the data is written into the shared buffers as it is and not kept.
+    Mesh(const PackedVertex *packedVertices, unsigned int vertexCount, const void *packedIndices, unsigned int indexCount,
+         unsigned int indexSize, vector<Texture> textures, vector<MeshLod> lods)
+    {
+        this->textures = std::move(textures);
+        this->lods = std::move(lods);
+        this->uvDensity = 0.0f;
+        this->materialLayer = findMaterialLayer(this->textures);
+        if(this->lods.empty())
+        {
+            MeshLod lod = { 0, indexCount, 0.0f };
+            this->lods.push_back(lod);
+        }
+        setupSamplerNames();
+        uploadPacked(packedVertices, vertexCount, packedIndices, indexCount, indexSize);
+    }
+
+    // a mesh owns its range of the arena and gives it back when it goes, so it can be moved but not copied
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+    Mesh(Mesh &&other) noexcept :
+        vertices(std::move(other.vertices)), indices(std::move(other.indices)), textures(std::move(other.textures)), lods(std::move(other.lods)),
+        samplerNames(std::move(other.samplerNames)), aabb(other.aabb), boundingSphere(other.boundingSphere), uvDensity(other.uvDensity),
+        materialLayer(other.materialLayer), range(other.range), VAO(other.VAO), indexType(other.indexType), indexSize(other.indexSize)
+    {
+        other.range = GeometryRange();
+    }
+
+    ~Mesh()
+    {
+        MeshArena().Free(range);
+    }
+
+    // the layer is packed into every vertex, so all of a mesh's array textures share one
+    static int findMaterialLayer(const vector<Texture> &textures)
+    {
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            if(textures[i].layer >= 0)
+                return textures[i].layer;
+        }
+        return -1;
+    }
+
+    // packs vertices for the constructor that takes them packed, narrowing the indices to 16 bits when they
+    // fit. returns the size of an index.
+    static unsigned int packGeometry(const vector<Vertex> &vertices, const vector<unsigned int> &indices, const BoundingBox &quantizationBox,
+                                     int materialLayer, vector<PackedVertex> &packedVertices, vector<unsigned char> &packedIndices)
+    {
+        packedVertices.resize(vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); i++)
+        {
+            const Vertex &v = vertices[i];
+            packedVertices[i] = PackVertex(v.Position, v.Normal, v.TexCoords, v.Tangent, v.Bitangent, quantizationBox, materialLayer < 0 ? 0 : (uint32_t)materialLayer);
+        }
+
+        if(vertices.size() >= 65536)
+        {
+            packedIndices.resize(indices.size() * sizeof(unsigned int));
+            if(!indices.empty())
+                memcpy(&packedIndices[0], &indices[0], packedIndices.size());
+            return sizeof(unsigned int);
+        }
+        packedIndices.resize(indices.size() * sizeof(unsigned short));
+        unsigned short *narrow = (unsigned short*)packedIndices.data();
+        for(unsigned int i = 0; i < indices.size(); i++)
+            narrow[i] = (unsigned short)indices[i];
+        return sizeof(unsigned short);
+    }
+
+    // the given level of detail, or the coarsest one there is
+    const MeshLod &getLod(unsigned int lod) const
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        return lods[lod < lods.size() ? lod : lods.size() - 1];
+    }
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+    // byte offset of a level's first index in the arena's index buffer
+    const void *getIndexOffset(const MeshLod &lod) const
+    {
+        return (const void*)((size_t)range.mIndexOffset + (size_t)lod.firstIndex * indexSize);
     }
 
-    // render the mesh
-    void Draw(Shader shader) 
+    // hooks the per-instance attributes of this mesh's VAO up to an instance buffer holding InstanceData structs,
+    // starting at instance 'firstInstance'. GL 3.3 has no base instance for draws, so pointing the attributes at a
+    // different offset is how one buffer holds the instances of several draws. expects the VAO to be bound.
+    void setupInstancing(unsigned int instanceVBO, unsigned int firstInstance = 0) const
+    {
+        size_t const base = firstInstance * sizeof(InstanceData);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // instance model matrix (a mat4 takes up 4 attribute locations, one per column)
+        for(unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(5 + i);
+            glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, Model) + sizeof(glm::vec4) * i));
+            glVertexAttribDivisor(5 + i, 1);
+        }
+        // instance inverse transpose model matrix (a mat3 takes up 3 attribute locations)
+        for(unsigned int i = 0; i < 3; i++)
+        {
+            glEnableVertexAttribArray(9 + i);
+            glVertexAttribPointer(9 + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, ItModel) + sizeof(glm::vec3) * i));
+            glVertexAttribDivisor(9 + i, 1);
+        }
+    }
+
+private:
+    /*  Functions    */
+    // names the sampler of each texture, following the texture_diffuseN, texture_specularN, ... convention
+    void setupSamplerNames()
     {
-        // bind appropriate textures
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        samplerNames.clear();
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -76,64 +214,35 @@ public:
 				number = std::to_string(normalNr++); // transfer unsigned int to stream
              else if(name == "texture_height")
 			    number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-													 // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplerNames.push_back(UniformName(name + number));
         }
-        
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    /*  Render data  */
-    unsigned int VBO, EBO;
-
-    /*  Functions    */
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // copies already packed vertices and indices into the shared geometry arena, writing them straight into
+    // mapped buffer memory and only going through glBufferSubData if mapping fails or loses the data
+    void uploadPacked(const PackedVertex *packedVertices, unsigned int vertexCount, const void *packedIndices, unsigned int indexCount, unsigned int size)
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-        glBindVertexArray(0);
+        indexSize = size;
+        indexType = size == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+        GeometryArena &arena = MeshArena();
+        range = arena.Allocate(vertexCount, indexCount, indexSize);
+        VAO = arena.GetVertexArray();
+        if(vertexCount == 0 || indexCount == 0)
+            return;
+
+        void *vertices = arena.MapVertices(range);
+        if(vertices != NULL)
+            memcpy(vertices, packedVertices, range.mVertexCount * sizeof(PackedVertex));
+        if(vertices == NULL || !arena.UnmapVertices())
+            arena.UploadVertices(range, packedVertices);
+
+        void *indices = arena.MapIndices(range);
+        if(indices != NULL)
+            memcpy(indices, packedIndices, range.mIndexBytes);
+        if(indices == NULL || !arena.UnmapIndices())
+            arena.UploadIndices(range, packedIndices);
     }
+
 };
 #endif
@@ -0,0 +1,356 @@
+//=============================================================================
+// Mesh Optimization
+//
+// Post import clean up of indexed triangle lists, run in this order:
+//
+//  - WeldVertices: merges bitwise identical vertices, loaders like the OBJ
+//    importer emit one vertex per face corner;
+//  - OptimizeVertexCache: Tipsify (Sander, Nehab, Barczak 2007), reorders
+//    triangles for the post transform vertex cache and returns the points
+//    where the simulated cache went cold;
+//  - OptimizeOverdraw: sorts the clusters between those points so that the
+//    ones facing away from the mesh centre come first, which draws the
+//    outside before the inside from most viewpoints;
+//  - OptimizeVertexFetch: reorders vertices by first use so fetches walk
+//    memory forwards, dropping unused ones.
+//
+// AnalyzeVertexCache reports ACMR (transformed vertices per triangle) and
+// ATVR (transformed vertices per unique vertex) for a FIFO cache.
+// No GL in here.
+//=============================================================================
+
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+//=============================================================================
+
+struct VertexCacheStats
+{
+    float mAcmr;
+    float mAtvr;
+};
+
+//=============================================================================
+
+// Simulates a FIFO post transform cache of 'cacheSize' entries.
+inline VertexCacheStats AnalyzeVertexCache( const std::vector<uint32_t>& indices, size_t const vertexCount, uint32_t const cacheSize = 16 )
+{
+    std::vector<uint32_t> insertedAt( vertexCount, 0 );
+    std::vector<uint8_t> used( vertexCount, 0 );
+    uint32_t transformed = 0;
+    uint32_t unique = 0;
+    for (uint32_t index : indices)
+    {
+        // A vertex is still cached if fewer than cacheSize misses happened since it went in.
+        if (insertedAt[index] == 0 || transformed + 1 - insertedAt[index] > cacheSize)
+        {
+            transformed++;
+            insertedAt[index] = transformed;
+        }
+        if (!used[index])
+        {
+            used[index] = 1;
+            unique++;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.mAcmr = indices.empty() ? 0.0f : (float)transformed / (float)(indices.size() / 3);
+    stats.mAtvr = unique == 0 ? 0.0f : (float)transformed / (float)unique;
+    return stats;
+}
+
+//=============================================================================
+
+// Merges vertices whose bytes are identical. Returns the new vertex count.
+template<typename VertexType>
+size_t WeldVertices( std::vector<VertexType>& vertices, std::vector<uint32_t>& indices )
+{
+    struct BytesHash
+    {
+        size_t operator()( const VertexType* v ) const
+        {
+            // FNV-1a over the raw bytes.
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>( v );
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < sizeof( VertexType ); i++)
+            {
+                hash = (hash ^ bytes[i]) * 16777619u;
+            }
+            return hash;
+        }
+    };
+    struct BytesEqual
+    {
+        bool operator()( const VertexType* a, const VertexType* b ) const { return memcmp( a, b, sizeof( VertexType ) ) == 0; }
+    };
+
+    std::unordered_map<const VertexType*, uint32_t, BytesHash, BytesEqual> unique;
+    unique.reserve( vertices.size() );
+    std::vector<uint32_t> remap( vertices.size() );
+    std::vector<VertexType> welded;
+    welded.reserve( vertices.size() );
+    for (uint32_t i = 0; i < vertices.size(); i++)
+    {
+        auto it = unique.find( &vertices[i] );
+        if (it == unique.end())
+        {
+            // Keys point into the source array, which stays put until we're done.
+            it = unique.insert( std::make_pair( &vertices[i], (uint32_t)welded.size() ) ).first;
+            welded.push_back( vertices[i] );
+        }
+        remap[i] = it->second;
+    }
+    for (uint32_t& index : indices)
+    {
+        index = remap[index];
+    }
+    vertices.swap( welded );
+    return vertices.size();
+}
+
+//=============================================================================
+
+// Tipsify. Rewrites 'indices' in cache friendly order and, if 'clusters' is
+// given, fills it with the first triangle of every run that started on a
+// cold cache (always including triangle 0).
+inline void OptimizeVertexCache( std::vector<uint32_t>& indices, size_t const vertexCount, std::vector<uint32_t>* clusters = nullptr,
+                                 uint32_t const cacheSize = 16 )
+{
+    size_t const triangleCount = indices.size() / 3;
+    if (clusters != nullptr)
+    {
+        clusters->clear();
+    }
+    if (triangleCount == 0)
+        return;
+
+    // Vertex -> triangles adjacency, compressed.
+    std::vector<uint32_t> live( vertexCount, 0 );
+    for (uint32_t index : indices)
+    {
+        live[index]++;
+    }
+    std::vector<uint32_t> offsets( vertexCount + 1, 0 );
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        offsets[v + 1] = offsets[v] + live[v];
+    }
+    std::vector<uint32_t> adjacency( indices.size() );
+    std::vector<uint32_t> fill( offsets.begin(), offsets.end() - 1 );
+    for (uint32_t i = 0; i < indices.size(); i++)
+    {
+        adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<uint32_t> cacheTime( vertexCount, 0 );
+    std::vector<uint8_t> emitted( triangleCount, 0 );
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve( indices.size() );
+
+    uint32_t timestamp = cacheSize + 1;
+    uint32_t cursor = 0;
+    int64_t fanning = -1;
+    bool cold = true;
+
+    // Start on the first referenced vertex.
+    while (cursor < vertexCount && live[cursor] == 0)
+    {
+        cursor++;
+    }
+    fanning = cursor < vertexCount ? (int64_t)cursor : -1;
+
+    while (fanning >= 0)
+    {
+        if (cold && clusters != nullptr)
+        {
+            clusters->push_back( (uint32_t)(result.size() / 3) );
+        }
+        cold = false;
+
+        // Emit every remaining triangle around the fanning vertex.
+        candidates.clear();
+        uint32_t const f = (uint32_t)fanning;
+        for (uint32_t a = offsets[f]; a < offsets[f + 1]; a++)
+        {
+            uint32_t const t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t const v = indices[t * 3 + c];
+                result.push_back( v );
+                deadEnd.push_back( v );
+                candidates.push_back( v );
+                live[v]--;
+                if (timestamp - cacheTime[v] > cacheSize)
+                {
+                    cacheTime[v] = timestamp++;
+                }
+            }
+        }
+
+        // Next fanning vertex: the one that will still be in the cache
+        // after its remaining triangles are emitted, and oldest such.
+        int64_t best = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+            int64_t priority = 0;
+            if (timestamp - cacheTime[v] + 2 * live[v] <= cacheSize)
+            {
+                priority = timestamp - cacheTime[v];
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = v;
+            }
+        }
+
+        // Dead end: back up through recently used vertices, then scan.
+        if (best < 0)
+        {
+            while (!deadEnd.empty() && best < 0)
+            {
+                uint32_t const v = deadEnd.back();
+                deadEnd.pop_back();
+                if (live[v] > 0)
+                {
+                    best = v;
+                }
+            }
+            while (best < 0 && cursor < vertexCount)
+            {
+                if (live[cursor] > 0)
+                {
+                    best = cursor;
+                }
+                else
+                {
+                    cursor++;
+                }
+            }
+            // Whatever comes next probably isn't in the cache any more.
+            if (best >= 0 && timestamp - cacheTime[best] > cacheSize)
+            {
+                cold = true;
+            }
+        }
+        fanning = best;
+    }
+
+    indices.swap( result );
+}
+
+//=============================================================================
+
+// Reorders the clusters from OptimizeVertexCache so those whose surface
+// faces away from the mesh centre come first. Positions are read through
+// 'stride' from 'positions'.
+inline void OptimizeOverdraw( std::vector<uint32_t>& indices, const std::vector<uint32_t>& clusters, const uint8_t* positions, size_t const stride )
+{
+    if (clusters.size() < 2)
+        return;
+
+    auto position = [&]( uint32_t const v )
+    {
+        glm::vec3 p;
+        memcpy( &p, positions + v * stride, sizeof( p ) );
+        return p;
+    };
+
+    size_t const triangleCount = indices.size() / 3;
+    struct Cluster
+    {
+        uint32_t mFirst;
+        uint32_t mEnd;
+        glm::vec3 mCentroid;
+        glm::vec3 mNormal;      // area weighted
+        float mScore;
+    };
+    std::vector<Cluster> sorted( clusters.size() );
+
+    // Area weighted centroids of each cluster and of the whole mesh.
+    glm::vec3 meshCentroid( 0.0f );
+    float meshArea = 0.0f;
+    for (uint32_t c = 0; c < clusters.size(); c++)
+    {
+        Cluster& cluster = sorted[c];
+        cluster.mFirst = clusters[c];
+        cluster.mEnd = c + 1 < clusters.size() ? clusters[c + 1] : (uint32_t)triangleCount;
+        cluster.mCentroid = glm::vec3( 0.0f );
+        cluster.mNormal = glm::vec3( 0.0f );
+        float area = 0.0f;
+        for (uint32_t t = cluster.mFirst; t < cluster.mEnd; t++)
+        {
+            glm::vec3 const p0 = position( indices[t * 3 + 0] );
+            glm::vec3 const p1 = position( indices[t * 3 + 1] );
+            glm::vec3 const p2 = position( indices[t * 3 + 2] );
+            glm::vec3 const normal = glm::cross( p1 - p0, p2 - p0 );
+            float const triangleArea = glm::length( normal );
+            cluster.mCentroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            cluster.mNormal += normal;
+            area += triangleArea;
+        }
+        meshCentroid += cluster.mCentroid;
+        meshArea += area;
+        cluster.mCentroid = area > 0.0f ? cluster.mCentroid / area : position( indices[cluster.mFirst * 3] );
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : glm::vec3( 0.0f );
+
+    for (auto& cluster : sorted)
+    {
+        float const length = glm::length( cluster.mNormal );
+        cluster.mScore = length > 0.0f ? glm::dot( cluster.mCentroid - meshCentroid, cluster.mNormal / length ) : 0.0f;
+    }
+    std::stable_sort( sorted.begin(), sorted.end(), []( const Cluster& a, const Cluster& b ) { return a.mScore > b.mScore; } );
+
+    std::vector<uint32_t> result;
+    result.reserve( indices.size() );
+    for (const auto& cluster : sorted)
+    {
+        result.insert( result.end(), indices.begin() + cluster.mFirst * 3, indices.begin() + cluster.mEnd * 3 );
+    }
+    indices.swap( result );
+}
+
+//=============================================================================
+
+// Renumbers vertices in the order the index buffer first uses them and
+// drops any it never uses. Returns the new vertex count.
+template<typename VertexType>
+size_t OptimizeVertexFetch( std::vector<VertexType>& vertices, std::vector<uint32_t>& indices )
+{
+    std::vector<uint32_t> remap( vertices.size(), ~0u );
+    std::vector<VertexType> ordered;
+    ordered.reserve( vertices.size() );
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            remap[index] = (uint32_t)ordered.size();
+            ordered.push_back( vertices[index] );
+        }
+        index = remap[index];
+    }
+    vertices.swap( ordered );
+    return vertices.size();
+}
+
+//=============================================================================
+
+#endif
@@ -5,94 +5,442 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/DefaultIOSystem.h>
 
+#include <jobsystem.h>
+#include <materialpacker.h>
 #include <mesh.h>
+#include <modelcache.h>
+#include <meshoptimize.h>
 #include <shader.h>
+#include <simplify.h>
+#include <softwareocclusion.h>
+#include <textureloader.h>
+#include <textureregistry.h>
+// textureloader.h has declared the stb libraries already, this is where their implementations go
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb_image_resize.h>
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
 
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <map>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma = false);
+
+// the loader all model textures go through. they decode in the background while the models load;
+// call Finish() on it before drawing with them.
+inline TextureLoader &ModelTextureLoader()
+{
+    static TextureLoader loader;
+    return loader;
+}
+
+// every model texture that isn't packed (see Model::packMaterials) is shared through this registry. it is
+// never destroyed since meshes may let go of their handles after main() returns; call Shutdown() on it
+// before the GL context goes.
+inline TextureRegistry &ModelTextureRegistry()
+{
+    static TextureRegistry *registry = new TextureRegistry(ModelTextureLoader());
+    return *registry;
+}
+
+// remembers every file the importer opens, which is what a model cache file depends on
+class SourceRecordingIOSystem : public Assimp::DefaultIOSystem
+{
+public:
+    vector<string> sources;
+
+    Assimp::IOStream *Open(const char *file, const char *mode = "rb") override
+    {
+        Assimp::IOStream *stream = Assimp::DefaultIOSystem::Open(file, mode);
+        if(stream != NULL && std::find(sources.begin(), sources.end(), file) == sources.end())
+            sources.push_back(file);
+        return stream;
+    }
+};
+
+// how a Model is loaded, each option named at the call site rather than passed as a row of bools
+struct ModelOptions
+{
+    bool gamma = false;             // kept as gammaCorrection
+    bool keepGeometry = false;      // keep CPU copies of mesh vertices and indices after upload
+    bool packMaterials = false;     // put the diffuse maps in a texture array shared by all meshes
+    bool loadNow = true;            // load in the constructor, otherwise prepare() and upload() do it
+};
 
 class Model 
 {
 public:
     /*  Model Data */
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh> meshes;
+    string path;
     string directory;
     bool gammaCorrection;
+    BoundingBox aabb;               // model space bounds of all meshes
+    BoundingSphere boundingSphere;
+    glm::mat4 quantizationTransform;    // maps the packed vertex positions of every mesh back into model space
+    OccluderMesh occluder;          // coarse stand-in for all meshes, rasterized by the software occlusion culler
+    unsigned int lodCount;          // levels of detail of the most detailed mesh
+    bool keepGeometry;              // keep CPU copies of mesh vertices and indices after upload
+    bool packMaterials;             // diffuse maps go into one texture array shared by all meshes
+    MaterialPacker materials;       // that array, empty unless packMaterials is set
+    bool fromCache;                 // prepare() found an up to date cache file, nothing was imported
+
+    // levels of detail generated per mesh: each has about half the triangles of the one before
+    static const unsigned int MAX_LODS = 4;
+    // simplification stops once it would move the surface by more than this fraction of the mesh's size
+    static constexpr float MAX_LOD_ERROR = 0.05f;
+    // occluders are simplified much further than anything that gets drawn
+    static const unsigned int OCCLUDER_REDUCTION = 32;
 
     /*  Functions   */
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. mesh geometry only stays in CPU memory if keepGeometry
+    // is set; bounds and the occluder are kept regardless, culling needs nothing else. packMaterials puts
+    // the diffuse maps in a texture array so meshes with different maps can still be drawn together.
+    // without loadNow nothing is loaded until prepare() and upload() are called (see assetloader.h).
+    Model(string const &path, const ModelOptions &options = ModelOptions()) :
+        path(path), directory(path.substr(0, path.find_last_of('/'))), gammaCorrection(options.gamma), quantizationTransform(1.0f), lodCount(1),
+        keepGeometry(options.keepGeometry), packMaterials(options.packMaterials), fromCache(false)
+    {
+        if(options.loadNow)
+        {
+            prepare();
+            upload();
+        }
+    }
+
+    // the part of loading that doesn't need GL, so it can run on any thread: maps the model's cache file if it
+    // has an up to date one (see modelcache.h), otherwise imports the model with ASSIMP and cooks one. the
+    // meshes of an imported model are cooked in parallel on 'jobs' if it's given.
+    void prepare(JobSystem *jobs = NULL)
     {
-        loadModel(path);
+        // cache files only have the packed vertices, keeping the full precision ones means importing
+        fromCache = !keepGeometry && cache.Open(path, cacheFlags());
+        if(!fromCache)
+            importModel(jobs);
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    // the rest of loading, on the thread with the GL context: copies the packed vertices and indices from the
+    // cooked model straight into the geometry arena and starts loading the textures.
+    void upload()
     {
+        if(!cache.IsOpen())
+            return;
+
+        aabb = cache.GetBounds();
+        quantizationTransform = QuantizationTransform(aabb);
+        occluder.mPositions.assign(cache.GetOccluderPositions(), cache.GetOccluderPositions() + cache.GetNumOccluderPositions());
+        occluder.mIndices.assign(cache.GetOccluderIndices(), cache.GetOccluderIndices() + cache.GetNumOccluderIndices());
+
+        // make room in the geometry arena for the whole model at once
+        uint32_t vertexCount = 0;
+        uint32_t indexBytes = 0;
+        for(unsigned int i = 0; i < cache.GetNumMeshes(); i++)
+        {
+            vertexCount += cache.GetMesh(i).mVertexCount;
+            indexBytes += cache.GetMesh(i).mIndexCount * cache.GetMesh(i).mIndexSize;
+        }
+        MeshArena().Reserve(vertexCount, indexBytes);
+        meshes.reserve(cache.GetNumMeshes());
+
+        for(unsigned int i = 0; i < cache.GetNumMeshes(); i++)
+        {
+            const ModelCache::MeshRecord &record = cache.GetMesh(i);
+            const ModelCache::TextureRecord *textureRecords = cache.GetTextures(record);
+            vector<Texture> textures;
+            for(unsigned int j = 0; j < record.mNumTextures; j++)
+            {
+                string const type = cache.GetString(textureRecords[j].mType, textureRecords[j].mTypeLength);
+                unsigned int index = 0;
+                for(unsigned int k = 0; k < j; k++)
+                    index += textures[k].type == type ? 1 : 0;
+                textures.push_back(loadTexture(cache.GetString(textureRecords[j].mPath, textureRecords[j].mPathLength), type, index));
+            }
+
+            const MeshLod *lods = cache.GetLods(record);
+            Mesh mesh(cache.GetVertices(record), record.mVertexCount, cache.GetIndices(record), record.mIndexCount, record.mIndexSize,
+                      std::move(textures), vector<MeshLod>(lods, lods + record.mNumLods));
+            mesh.aabb = record.mBounds;
+            mesh.boundingSphere = record.mSphere;
+            mesh.uvDensity = record.mUvDensity;
+            if(i < keptVertices.size())
+            {
+                mesh.vertices = std::move(keptVertices[i]);
+                mesh.indices = std::move(keptIndices[i]);
+            }
+            meshes.push_back(std::move(mesh));
+        }
+        cache.Close();
+        vector<vector<Vertex>>().swap(keptVertices);
+        vector<vector<unsigned int>>().swap(keptIndices);
+
+        // every diffuse map has its layer now, so the array can be sized and filled
+        materials.Build(ModelTextureLoader());
+
+        // the model's bounding sphere encloses those of all its meshes
+        boundingSphere.mCenter = aabb.GetCenter();
+        boundingSphere.mRadius = 0.0f;
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            boundingSphere.mRadius = glm::max(boundingSphere.mRadius, glm::length(meshes[i].boundingSphere.mCenter - boundingSphere.mCenter) + meshes[i].boundingSphere.mRadius);
+
+        lodCount = 1;
         for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            lodCount = glm::max(lodCount, (unsigned int)meshes[i].lods.size());
     }
-    
+
 private:
+    // one mesh as importModel cooks it, on its way into the cache image
+    struct CookedMesh
+    {
+        vector<PackedVertex> packedVertices;
+        vector<unsigned char> packedIndices;
+        unsigned int indexCount;
+        unsigned int indexSize;
+        vector<pair<string, string>> textures;  // type and path relative to the model
+        vector<MeshLod> lods;
+        BoundingBox aabb;
+        BoundingSphere boundingSphere;
+        float uvDensity;
+        OccluderMesh occluder;
+        vector<Vertex> vertices;                // full precision, only for keepGeometry
+        vector<unsigned int> indices;
+    };
+
+    /*  Loading Data */
+    ModelCache cache;               // the cooked model, between prepare() and upload()
+    vector<vector<Vertex>> keptVertices;        // full precision geometry per mesh, for keepGeometry
+    vector<vector<unsigned int>> keptIndices;
+
     /*  Functions   */
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    // cache files depend on what the model was loaded with, not just on its sources
+    unsigned int cacheFlags() const
     {
-        // read file via ASSIMP
+        return packMaterials ? 1 : 0;
+    }
+
+    // imports the model with ASSIMP and cooks it into 'cache', writing the cache file on the way.
+    bool importModel(JobSystem *jobs)
+    {
+        // read file via ASSIMP, which owns the IO system from here on
         Assimp::Importer importer;
+        SourceRecordingIOSystem *io = new SourceRecordingIOSystem();
+        importer.SetIOHandler(io);
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return false;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // all meshes quantize their positions over the bounds of the whole model, so one transform
+        // (folded into the instance matrix) decodes them all
+        aabb = BoundingBox();
+        for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+        {
+            const aiMesh *mesh = scene->mMeshes[i];
+            for(unsigned int j = 0; j < mesh->mNumVertices; j++)
+                aabb.Add(glm::vec3(mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z));
+        }
+
+        // the meshes in the order the node hierarchy lists them
+        vector<const aiMesh*> sceneMeshes;
+        collectMeshes(scene->mRootNode, scene, sceneMeshes);
+
+        // material layers are handed out in mesh order before anything runs in parallel, so they come out the
+        // same as when upload() asks for them again
+        vector<CookedMesh> cooked(sceneMeshes.size());
+        vector<int> materialLayers(sceneMeshes.size(), -1);
+        for(unsigned int i = 0; i < sceneMeshes.size(); i++)
+        {
+            materialTextures(scene->mMaterials[sceneMeshes[i]->mMaterialIndex], cooked[i].textures);
+            for(unsigned int j = 0; packMaterials && j < cooked[i].textures.size(); j++)
+            {
+                if(cooked[i].textures[j].first == "texture_diffuse")
+                {
+                    materialLayers[i] = materials.Add(this->directory + '/' + cooked[i].textures[j].second);
+                    break;
+                }
+            }
+        }
+
+        // the meshes don't depend on each other
+        auto cookMesh = [&](uint32_t i) { processMesh(sceneMeshes[i], materialLayers[i], cooked[i]); };
+        if(jobs != NULL)
+            jobs->ParallelFor((uint32_t)cooked.size(), cookMesh);
+        else
+        {
+            for(uint32_t i = 0; i < cooked.size(); i++)
+                cookMesh(i);
+        }
+
+        ModelCacheWriter writer;
+        OccluderMesh modelOccluder;
+        for(unsigned int i = 0; i < cooked.size(); i++)
+        {
+            CookedMesh &mesh = cooked[i];
+            writer.AddMesh(mesh.packedVertices.data(), (uint32_t)mesh.packedVertices.size(), mesh.packedIndices.data(), mesh.indexCount, mesh.indexSize,
+                           mesh.textures, mesh.lods, mesh.aabb, mesh.boundingSphere, mesh.uvDensity);
+            uint32_t const base = (uint32_t)modelOccluder.mPositions.size();
+            modelOccluder.mPositions.insert(modelOccluder.mPositions.end(), mesh.occluder.mPositions.begin(), mesh.occluder.mPositions.end());
+            for(unsigned int j = 0; j < mesh.occluder.mIndices.size(); j++)
+                modelOccluder.mIndices.push_back(base + mesh.occluder.mIndices[j]);
+            if(keepGeometry)
+            {
+                keptVertices.push_back(std::move(mesh.vertices));
+                keptIndices.push_back(std::move(mesh.indices));
+            }
+        }
+
+        // the cache file stays valid as long as nothing the importer read changes
+        for(unsigned int i = 0; i < io->sources.size(); i++)
+            writer.AddSource(io->sources[i]);
+        writer.SetBounds(aabb);
+        writer.SetOccluder(modelOccluder.mPositions, modelOccluder.mIndices);
+        // the packed geometry is copied once, into the image, and from there straight into mapped buffers
+        vector<unsigned char> image;
+        writer.Serialize(cacheFlags(), image);
+        vector<CookedMesh>().swap(cooked);
+        if(!ModelCacheWriter::Save(path, image))
+            cout << "Model " << path << ": couldn't write " << ModelCache::GetPath(path) << endl;
+
+        // and upload() reads the model back the same way it would the file
+        return cache.Open(std::move(image), cacheFlags());
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // welds the identical vertices the importer hands out per face corner, orders the triangles for the
+    // post transform cache and then for overdraw, and finally orders the vertices by first use.
+    static void optimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices, const char *name)
     {
-        // process each mesh located at the current node
-        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        size_t const importedVertices = vertices.size();
+        VertexCacheStats const before = AnalyzeVertexCache(indices, vertices.size());
+
+        WeldVertices(vertices, indices);
+        vector<unsigned int> clusters;
+        OptimizeVertexCache(indices, vertices.size(), &clusters);
+        if(!vertices.empty())
+            OptimizeOverdraw(indices, clusters, (const uint8_t*)&vertices[0].Position, sizeof(Vertex));
+        OptimizeVertexFetch(vertices, indices);
+
+        // meshes are optimized in parallel, the line goes out in one piece
+        VertexCacheStats const after = AnalyzeVertexCache(indices, vertices.size());
+        ostringstream line;
+        line << "Mesh " << name << ": " << importedVertices << " -> " << vertices.size() << " vertices"
+             << ", ACMR " << before.mAcmr << " -> " << after.mAcmr
+             << ", ATVR " << before.mAtvr << " -> " << after.mAtvr << "\n";
+        cout << line.str() << flush;
+    }
+
+    // how much texture a unit of the mesh's surface covers: the square root of the ratio of texture coordinate
+    // area to model space area, over all triangles. the texture streamer turns it into a mip level.
+    static float measureUvDensity(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        double surfaceArea = 0.0;
+        double uvArea = 0.0;
+        for(size_t i = 0; i + 2 < indices.size(); i += 3)
         {
-            // the node object only contains indices to index the actual objects in the scene. 
-            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            const Vertex &a = vertices[indices[i]];
+            const Vertex &b = vertices[indices[i + 1]];
+            const Vertex &c = vertices[indices[i + 2]];
+            surfaceArea += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+            glm::vec2 const e1 = b.TexCoords - a.TexCoords;
+            glm::vec2 const e2 = c.TexCoords - a.TexCoords;
+            uvArea += std::abs(e1.x * e2.y - e1.y * e2.x);
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        return surfaceArea > 0.0 ? (float)std::sqrt(uvArea / surfaceArea) : 0.0f;
+    }
+
+    // simplifies the mesh into coarser levels of detail, appending their indices after the full mesh's.
+    // the simplest version made along the way becomes the mesh's part of the model's occluder, pulled in
+    // by as much as simplifying may have moved the surface so it stays inside the mesh.
+    static void buildLods(const vector<Vertex> &vertices, vector<unsigned int> &indices, vector<MeshLod> &lods, OccluderMesh &meshOccluder)
+    {
+        MeshLod full = { 0, (unsigned int)indices.size(), 0.0f };
+        lods.push_back(full);
+        if(indices.empty())
+            return;
+
+        // normals and texture coordinates sit next to each other in a Vertex, a seam is where either differs
+        SimplifyVertexData data;
+        data.mData = (const uint8_t*)&vertices[0];
+        data.mStride = sizeof(Vertex);
+        data.mNumVertices = vertices.size();
+        data.mPositionOffset = offsetof(Vertex, Position);
+        data.mAttributeOffset = offsetof(Vertex, Normal);
+        data.mAttributeSize = offsetof(Vertex, Tangent) - offsetof(Vertex, Normal);
+
+        vector<size_t> targets;
+        for(unsigned int i = 1; i < MAX_LODS; i++)
+            targets.push_back(indices.size() >> i);
+        targets.push_back(indices.size() / OCCLUDER_REDUCTION);
+
+        MeshSimplifier simplifier;
+        vector<SimplifyLevel> levels = simplifier.Simplify(data, indices, targets, MAX_LOD_ERROR);
+        for(unsigned int i = 0; i + 1 < levels.size(); i++)
         {
-            processNode(node->mChildren[i], scene);
+            // a level that barely got simpler isn't worth switching to
+            if(levels[i].mIndices.size() > lods.back().indexCount * 3 / 4)
+                continue;
+            OptimizeVertexCache(levels[i].mIndices, vertices.size());
+            MeshLod lod = { (unsigned int)indices.size(), (unsigned int)levels[i].mIndices.size(), levels[i].mError };
+            indices.insert(indices.end(), levels[i].mIndices.begin(), levels[i].mIndices.end());
+            lods.push_back(lod);
         }
 
+        // only copy the vertices the occluder actually uses
+        const vector<uint32_t> &occluderIndices = levels.back().mIndices;
+        vector<unsigned int> remap(vertices.size(), ~0u);
+        for(unsigned int i = 0; i < occluderIndices.size(); i++)
+        {
+            unsigned int const v = occluderIndices[i];
+            if(remap[v] == ~0u)
+            {
+                remap[v] = (unsigned int)meshOccluder.mPositions.size();
+                meshOccluder.mPositions.push_back(vertices[v].Position);
+            }
+            meshOccluder.mIndices.push_back(remap[v]);
+        }
+
+        // errors are relative to the extent of the mesh
+        BoundingBox extent;
+        for(unsigned int i = 0; i < vertices.size(); i++)
+            extent.Add(vertices[i].Position);
+        InsetOccluder(meshOccluder, levels.back().mError * glm::length(extent.mMax - extent.mMin));
+    }
+
+    // gathers the meshes of a node and then those of its children, recursively.
+    static void collectMeshes(const aiNode *node, const aiScene *scene, vector<const aiMesh*> &sceneMeshes)
+    {
+        // the node object only contains indices to index the actual objects in the scene. 
+        // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+            collectMeshes(node->mChildren[i], scene, sceneMeshes);
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // cooks one mesh: welds and optimizes it, simplifies it into levels of detail and packs it. nothing here
+    // touches GL or the model, so meshes can be cooked side by side.
+    void processMesh(const aiMesh *mesh, int materialLayer, CookedMesh &cooked) const
     {
         // data to fill
         vector<Vertex> vertices;
         vector<unsigned int> indices;
-        vector<Texture> textures;
+        BoundingBox aabb;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
 
         // Walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -104,6 +452,7 @@ private:
             vector.y = mesh->mVertices[i].y;
             vector.z = mesh->mVertices[i].z;
             vertex.Position = vector;
+            aabb.Add(vector);
             // normals
             vector.x = mesh->mNormals[i].x;
             vector.y = mesh->mNormals[i].y;
@@ -141,8 +490,33 @@ private:
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
-        // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];    
+        float const uvDensity = measureUvDensity(vertices, indices);
+
+        // share vertices between faces and put everything in GPU friendly order
+        optimizeMesh(vertices, indices, mesh->mName.C_Str());
+
+        // simplified versions for when the mesh is small on screen
+        buildLods(vertices, indices, cooked.lods, cooked.occluder);
+
+        // bounds are worked out before the vertices are packed
+        cooked.aabb = aabb;
+        if(!vertices.empty())
+            cooked.boundingSphere = MakeBoundingSphere(aabb, &vertices[0].Position, vertices.size(), sizeof(Vertex));
+        cooked.uvDensity = uvDensity;
+
+        // pack the geometry for the GPU, the cache file gets the very same bytes
+        cooked.indexSize = Mesh::packGeometry(vertices, indices, this->aabb, materialLayer, cooked.packedVertices, cooked.packedIndices);
+        cooked.indexCount = (unsigned int)indices.size();
+        if(keepGeometry)
+        {
+            cooked.vertices = std::move(vertices);
+            cooked.indices = std::move(indices);
+        }
+    }
+
+    // the textures of a material, as (type, path relative to the model) pairs.
+    static void materialTextures(const aiMaterial *material, vector<pair<string, string>> &textures)
+    {
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
         // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
         // Same applies to other texture as the following list summarizes:
@@ -151,94 +525,59 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        materialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        materialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-        
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        materialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // appends all material textures of a given type.
+    static void materialTextures(const aiMaterial *material, aiTextureType type, const string &typeName, vector<pair<string, string>> &textures)
     {
-        vector<Texture> textures;
-        for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        for(unsigned int i = 0; i < material->GetTextureCount(type); i++)
         {
             aiString str;
-            mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            material->GetTexture(type, i, &str);
+            textures.push_back(make_pair(typeName, string(str.C_Str())));
         }
-        return textures;
+    }
+
+    // the index'th texture of its type in a material, at path relative to the model. textures already loaded,
+    // by this model or any other, come back from the registry.
+    Texture loadTexture(const string &path, const string &typeName, unsigned int index)
+    {
+        Texture texture;
+        // only the first diffuse map is ever sampled, the rest stay plain textures, as do maps the array has no room for
+        int const layer = packMaterials && typeName == "texture_diffuse" && index == 0 ? materials.Add(this->directory + '/' + path) : -1;
+        if(layer >= 0)
+        {
+            texture.id = materials.GetTexture();
+            texture.target = GL_TEXTURE_2D_ARRAY;
+            texture.layer = layer;
+        }
+        else
+        {
+            texture.handle = TextureFromFile(path.c_str(), this->directory, typeName == "texture_diffuse");
+            texture.id = texture.handle.Get();
+        }
+        texture.type = typeName;
+        texture.path = path;
+        return texture;
     }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    // shared with whoever loaded the same image before. a new texture has its storage allocated now, the
+    // pixels arrive once ModelTextureLoader() has decoded and uploaded them. gamma marks colour maps, their
+    // mips are filtered in linear space.
+    return ModelTextureRegistry().Acquire(filename, gamma);
 }
 #endif
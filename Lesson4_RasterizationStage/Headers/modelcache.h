@@ -0,0 +1,541 @@
+//=============================================================================
+// Model Cache
+//
+// Cooked copies of model files, written the first time a model is loaded
+// and kept next to it as <model>.mesh, so later runs skip the importer
+// and everything Model does after it (welding, cache optimization, level
+// of detail simplification). A cache file holds exactly what ends up on
+// the GPU: every mesh's vertices already packed (see vertexformat.h) and
+// its indices already narrowed, back to back, along with the mesh table,
+// levels of detail, texture references, bounds and the occluder.
+//
+// Reading one maps it (mmap, or MapViewOfFile on Windows) and hands out
+// pointers into it; there is nothing to parse, the blobs go straight into
+// glBufferSubData. A model that has just been cooked is read the same way,
+// from memory.
+//
+// A cache file records the size and modification time of every file the
+// importer opened (the model and its material library) and is only used
+// while they all still match, and while the model is loaded with the same
+// flags. VERSION goes up whenever cooking changes what it produces.
+//=============================================================================
+
+#ifndef MODELCACHE_H
+#define MODELCACHE_H
+
+#include <bounds.h>
+#include <fileutils.h>
+#include <mesh.h>
+#include <vertexformat.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//=============================================================================
+
+namespace ModelCacheFormat
+{
+    static uint32_t const MAGIC = 0x4C444D47;  // "GMDL"
+    static uint32_t const VERSION = 3;
+
+    // Followed by the sections below, in this order, each an array of the
+    // given counts: sources, meshes, textures, levels of detail, occluder
+    // positions and indices, then strings, vertex data and index data.
+    struct Header
+    {
+        uint32_t mMagic;
+        uint32_t mVersion;
+        uint32_t mFlags;                // as passed to Open() and Serialize()
+        uint32_t mNumSources;
+        uint32_t mNumMeshes;
+        uint32_t mNumTextures;
+        uint32_t mNumLods;
+        uint32_t mNumOccluderPositions;
+        uint32_t mNumOccluderIndices;
+        uint32_t mStringBytes;          // padded to 4
+        uint32_t mVertexBytes;
+        uint32_t mIndexBytes;
+        BoundingBox mBounds;            // of all meshes
+    };
+
+    struct Source
+    {
+        uint64_t mSize;
+        uint64_t mTime;
+        uint32_t mName;                 // into the strings
+        uint32_t mNameLength;
+    };
+
+    struct Mesh
+    {
+        uint32_t mVertexCount;
+        uint32_t mVertexOffset;         // bytes into the vertex data
+        uint32_t mIndexCount;
+        uint32_t mIndexOffset;          // bytes into the index data, a multiple of 4
+        uint32_t mIndexSize;            // 2 or 4
+        uint32_t mFirstTexture;
+        uint32_t mNumTextures;
+        uint32_t mFirstLod;
+        uint32_t mNumLods;
+        float mUvDensity;
+        BoundingBox mBounds;
+        BoundingSphere mSphere;
+    };
+
+    struct Texture
+    {
+        uint32_t mType;                 // into the strings, texture_diffuse etc.
+        uint32_t mTypeLength;
+        uint32_t mPath;                 // relative to the model, as the material has it
+        uint32_t mPathLength;
+    };
+
+    static_assert( sizeof( Header ) % 8 == 0, "sources that follow the header hold 64 bit values" );
+    static_assert( sizeof( Source ) == 24, "Source should have no padding" );
+    static_assert( std::is_trivially_copyable<BoundingBox>::value && std::is_trivially_copyable<BoundingSphere>::value &&
+                   std::is_trivially_copyable<MeshLod>::value, "sections are copied as they are" );
+
+    inline bool StatFile( const std::string& path, uint64_t& size, uint64_t& time )
+    {
+        struct stat info;
+        if (stat( path.c_str(), &info ) != 0)
+            return false;
+        size = (uint64_t)info.st_size;
+        time = (uint64_t)info.st_mtime;
+        return true;
+    }
+}
+
+//=============================================================================
+
+// A cache file mapped into memory.
+class ModelCache
+{
+public:
+    typedef ModelCacheFormat::Mesh MeshRecord;
+    typedef ModelCacheFormat::Texture TextureRecord;
+
+    static std::string GetPath( const std::string& source ) { return source + ".mesh"; }
+
+    ModelCache():
+        mData( nullptr ),
+        mSize( 0 ),
+        mHeader()
+    {
+    }
+
+    ~ModelCache() { Close(); }
+
+    ModelCache( const ModelCache& ) = delete;
+    ModelCache& operator=( const ModelCache& ) = delete;
+
+    // Maps the cache file of 'source' if there is an up to date one cooked with 'flags'.
+    bool Open( const std::string& source, uint32_t const flags )
+    {
+        Close();
+        Map( GetPath( source ) );
+        if (mData == nullptr || !Validate( flags ))
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    // Takes a model ModelCacheWriter::Serialize() just laid out, for when
+    // there's no file to map (yet).
+    bool Open( std::vector<unsigned char> image, uint32_t const flags )
+    {
+        Close();
+        mImage = std::move( image );
+        mData = mImage.data();
+        mSize = mImage.size();
+        if (mSize < sizeof( Header ) || !Validate( flags ))
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    bool IsOpen() const { return mData != nullptr; }
+
+    void Close()
+    {
+        if (mData != nullptr && mImage.empty())
+        {
+#if defined(_WIN32)
+            UnmapViewOfFile( mData );
+#else
+            munmap( (void*)mData, mSize );
+#endif
+        }
+        std::vector<unsigned char>().swap( mImage );
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    const BoundingBox& GetBounds() const { return mHeader.mBounds; }
+    uint32_t GetNumMeshes() const { return mHeader.mNumMeshes; }
+    const MeshRecord& GetMesh( uint32_t const index ) const { return mMeshes[index]; }
+
+    const PackedVertex* GetVertices( const MeshRecord& mesh ) const { return (const PackedVertex*)(mVertexData + mesh.mVertexOffset); }
+    const void* GetIndices( const MeshRecord& mesh ) const { return mIndexData + mesh.mIndexOffset; }
+    const MeshLod* GetLods( const MeshRecord& mesh ) const { return mLods + mesh.mFirstLod; }
+    const TextureRecord* GetTextures( const MeshRecord& mesh ) const { return mTextures + mesh.mFirstTexture; }
+    std::string GetString( uint32_t const offset, uint32_t const length ) const { return std::string( mStrings + offset, length ); }
+
+    uint32_t GetNumOccluderPositions() const { return mHeader.mNumOccluderPositions; }
+    const glm::vec3* GetOccluderPositions() const { return mOccluderPositions; }
+    uint32_t GetNumOccluderIndices() const { return mHeader.mNumOccluderIndices; }
+    const uint32_t* GetOccluderIndices() const { return mOccluderIndices; }
+
+private:
+    typedef ModelCacheFormat::Header Header;
+    typedef ModelCacheFormat::Source Source;
+
+    // Sets mData and mSize to the file's contents mapped read only, if it
+    // can be and is big enough to hold a header.
+    void Map( const std::string& path )
+    {
+#if defined(_WIN32)
+        HANDLE const file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER size;
+        if (GetFileSizeEx( file, &size ) && (uint64_t)size.QuadPart >= sizeof( Header ) && (uint64_t)size.QuadPart <= SIZE_MAX)
+        {
+            HANDLE const mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+            if (mapping != nullptr)
+            {
+                // The view keeps the mapping alive by itself.
+                void* const data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+                if (data != nullptr)
+                {
+                    mData = (const unsigned char*)data;
+                    mSize = (size_t)size.QuadPart;
+                }
+                CloseHandle( mapping );
+            }
+        }
+        CloseHandle( file );
+#else
+        int const file = open( path.c_str(), O_RDONLY );
+        if (file < 0)
+            return;
+
+        struct stat info;
+        if (fstat( file, &info ) == 0 && (size_t)info.st_size >= sizeof( Header ))
+        {
+            void* const data = mmap( nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0 );
+            if (data != MAP_FAILED)
+            {
+                mData = (const unsigned char*)data;
+                mSize = (size_t)info.st_size;
+            }
+        }
+        close( file );
+#endif
+    }
+
+    // Finds the sections and checks they are where the header says, that
+    // every index stays inside its vertices and that the sources haven't
+    // changed.
+    bool Validate( uint32_t const flags )
+    {
+        memcpy( &mHeader, mData, sizeof( mHeader ) );
+        if (mHeader.mMagic != ModelCacheFormat::MAGIC || mHeader.mVersion != ModelCacheFormat::VERSION || mHeader.mFlags != flags)
+            return false;
+
+        size_t offset = sizeof( Header );
+        const Source* const sources = (const Source*)Section( offset, mHeader.mNumSources, sizeof( Source ) );
+        mMeshes = (const MeshRecord*)Section( offset, mHeader.mNumMeshes, sizeof( MeshRecord ) );
+        mTextures = (const TextureRecord*)Section( offset, mHeader.mNumTextures, sizeof( TextureRecord ) );
+        mLods = (const MeshLod*)Section( offset, mHeader.mNumLods, sizeof( MeshLod ) );
+        mOccluderPositions = (const glm::vec3*)Section( offset, mHeader.mNumOccluderPositions, sizeof( glm::vec3 ) );
+        mOccluderIndices = (const uint32_t*)Section( offset, mHeader.mNumOccluderIndices, sizeof( uint32_t ) );
+        mStrings = (const char*)Section( offset, mHeader.mStringBytes, 1 );
+        mVertexData = Section( offset, mHeader.mVertexBytes, 1 );
+        mIndexData = Section( offset, mHeader.mIndexBytes, 1 );
+        if (offset != mSize)
+            return false;
+
+        for (uint32_t i = 0; i < mHeader.mNumMeshes; i++)
+        {
+            const MeshRecord& mesh = mMeshes[i];
+            if ((uint64_t)mesh.mVertexOffset + (uint64_t)mesh.mVertexCount * sizeof( PackedVertex ) > mHeader.mVertexBytes ||
+                (uint64_t)mesh.mIndexOffset + (uint64_t)mesh.mIndexCount * mesh.mIndexSize > mHeader.mIndexBytes ||
+                (uint64_t)mesh.mFirstTexture + mesh.mNumTextures > mHeader.mNumTextures ||
+                (uint64_t)mesh.mFirstLod + mesh.mNumLods > mHeader.mNumLods || mesh.mNumLods == 0 ||
+                (mesh.mIndexSize != 2 && mesh.mIndexSize != 4) ||
+                !IndicesInRange( mIndexData + mesh.mIndexOffset, mesh.mIndexCount, mesh.mIndexSize, mesh.mVertexCount ))
+                return false;
+
+            // Levels of detail are drawn straight from the mesh's range of the index buffer.
+            for (uint32_t j = 0; j < mesh.mNumLods; j++)
+            {
+                const MeshLod& lod = mLods[mesh.mFirstLod + j];
+                if ((uint64_t)lod.firstIndex + lod.indexCount > mesh.mIndexCount)
+                    return false;
+            }
+        }
+        if (!IndicesInRange( (const unsigned char*)mOccluderIndices, mHeader.mNumOccluderIndices, sizeof( uint32_t ), mHeader.mNumOccluderPositions ))
+            return false;
+        for (uint32_t i = 0; i < mHeader.mNumTextures; i++)
+        {
+            if ((uint64_t)mTextures[i].mType + mTextures[i].mTypeLength > mHeader.mStringBytes ||
+                (uint64_t)mTextures[i].mPath + mTextures[i].mPathLength > mHeader.mStringBytes)
+                return false;
+        }
+
+        for (uint32_t i = 0; i < mHeader.mNumSources; i++)
+        {
+            uint64_t size, time;
+            if ((uint64_t)sources[i].mName + sources[i].mNameLength > mHeader.mStringBytes ||
+                !ModelCacheFormat::StatFile( GetString( sources[i].mName, sources[i].mNameLength ), size, time ) ||
+                size != sources[i].mSize || time != sources[i].mTime)
+                return false;
+        }
+        return true;
+    }
+
+    // Whether all 'count' indices of 'size' bytes at 'indices' are below 'limit'.
+    static bool IndicesInRange( const unsigned char* const indices, uint32_t const count, uint32_t const size, uint32_t const limit )
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t index;
+            if (size == 2)
+            {
+                uint16_t narrow;
+                memcpy( &narrow, indices + (size_t)i * 2, sizeof( narrow ) );
+                index = narrow;
+            }
+            else
+            {
+                memcpy( &index, indices + (size_t)i * 4, sizeof( index ) );
+            }
+            if (index >= limit)
+                return false;
+        }
+        return true;
+    }
+
+    // Where a section starts; moves 'offset' past it, or past the end of the file if it doesn't fit.
+    const unsigned char* Section( size_t& offset, uint32_t const count, size_t const size )
+    {
+        const unsigned char* const section = mData + std::min( offset, mSize );
+        offset = offset + (size_t)count * size > mSize ? mSize + 1 : offset + (size_t)count * size;
+        return section;
+    }
+
+    const unsigned char* mData;         // mapped, or mImage's
+    size_t mSize;
+    std::vector<unsigned char> mImage;
+    Header mHeader;
+    const MeshRecord* mMeshes;
+    const TextureRecord* mTextures;
+    const MeshLod* mLods;
+    const glm::vec3* mOccluderPositions;
+    const uint32_t* mOccluderIndices;
+    const char* mStrings;
+    const unsigned char* mVertexData;
+    const unsigned char* mIndexData;
+};
+
+//=============================================================================
+
+// Collects a model as it is cooked and writes its cache file.
+class ModelCacheWriter
+{
+public:
+    ModelCacheWriter():
+        mHeader(),
+        mVertexBytes( 0 ),
+        mIndexBytes( 0 )
+    {
+    }
+
+    // A file the model was loaded from, to be checked when the cache is read.
+    void AddSource( const std::string& path )
+    {
+        ModelCacheFormat::Source source;
+        if (!ModelCacheFormat::StatFile( path, source.mSize, source.mTime ))
+            return;
+        source.mNameLength = (uint32_t)path.size();
+        source.mName = AddString( path );
+        mSources.push_back( source );
+    }
+
+    // 'indices' are indexCount values of indexSize bytes. The textures are
+    // (type, path) pairs. Vertices and indices aren't copied until
+    // Serialize(), they have to stay where they are until then.
+    void AddMesh( const PackedVertex* vertices, uint32_t const vertexCount, const void* indices, uint32_t const indexCount, uint32_t const indexSize,
+                  const std::vector<std::pair<std::string, std::string>>& textures, const std::vector<MeshLod>& lods,
+                  const BoundingBox& bounds, const BoundingSphere& sphere, float const uvDensity )
+    {
+        ModelCacheFormat::Mesh mesh = {};
+        mesh.mVertexCount = vertexCount;
+        mesh.mVertexOffset = mVertexBytes;
+        mesh.mIndexCount = indexCount;
+        mesh.mIndexOffset = mIndexBytes;
+        mesh.mIndexSize = indexSize;
+        mesh.mFirstTexture = (uint32_t)mTextures.size();
+        mesh.mNumTextures = (uint32_t)textures.size();
+        mesh.mFirstLod = (uint32_t)mLods.size();
+        mesh.mNumLods = (uint32_t)lods.size();
+        mesh.mUvDensity = uvDensity;
+        mesh.mBounds = bounds;
+        mesh.mSphere = sphere;
+        mMeshes.push_back( mesh );
+
+        Blob const vertexBlob = { vertices, vertexCount * (uint32_t)sizeof( PackedVertex ) };
+        Blob const indexBlob = { indices, indexCount * indexSize };
+        mVertexBlobs.push_back( vertexBlob );
+        mIndexBlobs.push_back( indexBlob );
+        mVertexBytes += vertexBlob.mSize;
+        mIndexBytes += (indexBlob.mSize + 3) & ~3u;
+        mLods.insert( mLods.end(), lods.begin(), lods.end() );
+        for (const auto& texture : textures)
+        {
+            ModelCacheFormat::Texture record;
+            record.mTypeLength = (uint32_t)texture.first.size();
+            record.mType = AddString( texture.first );
+            record.mPathLength = (uint32_t)texture.second.size();
+            record.mPath = AddString( texture.second );
+            mTextures.push_back( record );
+        }
+    }
+
+    void SetBounds( const BoundingBox& bounds ) { mHeader.mBounds = bounds; }
+
+    void SetOccluder( const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices )
+    {
+        mOccluderPositions = positions;
+        mOccluderIndices = indices;
+    }
+
+    // Lays out everything added so far the way a cache file holds it.
+    void Serialize( uint32_t const flags, std::vector<unsigned char>& image )
+    {
+        mStrings.resize( (mStrings.size() + 3) & ~(size_t)3 );
+        mHeader.mMagic = ModelCacheFormat::MAGIC;
+        mHeader.mVersion = ModelCacheFormat::VERSION;
+        mHeader.mFlags = flags;
+        mHeader.mNumSources = (uint32_t)mSources.size();
+        mHeader.mNumMeshes = (uint32_t)mMeshes.size();
+        mHeader.mNumTextures = (uint32_t)mTextures.size();
+        mHeader.mNumLods = (uint32_t)mLods.size();
+        mHeader.mNumOccluderPositions = (uint32_t)mOccluderPositions.size();
+        mHeader.mNumOccluderIndices = (uint32_t)mOccluderIndices.size();
+        mHeader.mStringBytes = (uint32_t)mStrings.size();
+        mHeader.mVertexBytes = mVertexBytes;
+        mHeader.mIndexBytes = mIndexBytes;
+
+        image.clear();
+        image.reserve( sizeof( mHeader ) + mSources.size() * sizeof( ModelCacheFormat::Source ) + mMeshes.size() * sizeof( ModelCacheFormat::Mesh ) +
+                       mTextures.size() * sizeof( ModelCacheFormat::Texture ) + mLods.size() * sizeof( MeshLod ) +
+                       mOccluderPositions.size() * sizeof( glm::vec3 ) + mOccluderIndices.size() * sizeof( uint32_t ) +
+                       mStrings.size() + mVertexBytes + mIndexBytes );
+        AppendSection( image, &mHeader, 1 );
+        AppendSection( image, mSources );
+        AppendSection( image, mMeshes );
+        AppendSection( image, mTextures );
+        AppendSection( image, mLods );
+        AppendSection( image, mOccluderPositions );
+        AppendSection( image, mOccluderIndices );
+        AppendSection( image, mStrings );
+        for (const auto& blob : mVertexBlobs)
+        {
+            AppendSection( image, (const unsigned char*)blob.mData, blob.mSize );
+        }
+        for (const auto& blob : mIndexBlobs)
+        {
+            AppendSection( image, (const unsigned char*)blob.mData, blob.mSize );
+            image.resize( image.size() + (((blob.mSize + 3) & ~3u) - blob.mSize), 0 );
+        }
+    }
+
+    // Writes a serialized model as the cache file of 'source'. Failing only
+    // means cooking again next time.
+    static bool Save( const std::string& source, const std::vector<unsigned char>& image )
+    {
+        // Written under another name first so nobody maps half a file, one
+        // of its own since two loads may be cooking the same model.
+        std::string const path = ModelCache::GetPath( source );
+        std::string const temporary = GetTemporaryPath( path );
+        {
+            std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+            file.write( (const char*)image.data(), (std::streamsize)image.size() );
+            if (!file)
+            {
+                file.close();
+                std::remove( temporary.c_str() );
+                return false;
+            }
+        }
+        if (RenameOver( temporary, path ))
+            return true;
+        std::remove( temporary.c_str() );
+        return false;
+    }
+
+private:
+    // Geometry the caller owns, see AddMesh().
+    struct Blob
+    {
+        const void* mData;
+        uint32_t mSize;
+    };
+
+    uint32_t AddString( const std::string& value )
+    {
+        uint32_t const offset = (uint32_t)mStrings.size();
+        mStrings.insert( mStrings.end(), value.begin(), value.end() );
+        return offset;
+    }
+
+    template <typename T>
+    static void AppendSection( std::vector<unsigned char>& image, const T* section, size_t const count )
+    {
+        image.insert( image.end(), (const unsigned char*)section, (const unsigned char*)(section + count) );
+    }
+
+    template <typename T>
+    static void AppendSection( std::vector<unsigned char>& image, const std::vector<T>& section )
+    {
+        AppendSection( image, section.data(), section.size() );
+    }
+
+    ModelCacheFormat::Header mHeader;
+    std::vector<ModelCacheFormat::Source> mSources;
+    std::vector<ModelCacheFormat::Mesh> mMeshes;
+    std::vector<ModelCacheFormat::Texture> mTextures;
+    std::vector<MeshLod> mLods;
+    std::vector<glm::vec3> mOccluderPositions;
+    std::vector<uint32_t> mOccluderIndices;
+    std::vector<char> mStrings;
+    std::vector<Blob> mVertexBlobs;
+    std::vector<Blob> mIndexBlobs;
+    uint32_t mVertexBytes;
+    uint32_t mIndexBytes;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,233 @@
+//=============================================================================
+// Occlusion Query Culling
+//
+// Hardware occlusion culling with GL_ANY_SAMPLES_PASSED queries against each
+// object's bounding box, using last frame's results in the spirit of CHC++:
+//
+//  - an object's visibility is whatever its most recent finished query said,
+//    results are only ever polled, so we never wait on the GPU;
+//  - objects believed visible are drawn and only re-queried every few
+//    frames (staggered so they don't all come due at once);
+//  - objects believed hidden are skipped and queried every frame until a
+//    query says otherwise;
+//  - queries are issued after the main pass so they test against this
+//    frame's depth buffer;
+//  - objects nobody has asked about for a while (destroyed, or out of the
+//    frustum) are forgotten along with their query, and start over as new
+//    if they come back.
+//=============================================================================
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <bounds.h>
+#include <renderqueue.h>
+#include <shader.h>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+//=============================================================================
+
+struct OcclusionStats
+{
+    uint32_t mQueriesIssued;
+    uint32_t mResultsReceived;
+    uint32_t mOccluded;
+    uint32_t mLatencyFrames;    // summed over the results received
+};
+
+//=============================================================================
+
+class OcclusionCuller
+{
+public:
+    static uint32_t const VISIBLE_QUERY_INTERVAL = 4;  // frames a visible object goes without a query
+    static uint32_t const FORGET_INTERVAL = 60;         // frames an object goes untested before it is forgotten
+
+    OcclusionCuller():
+        mVertexArray( 0 ),
+        mVertexBuffer( 0 ),
+        mIndexBuffer( 0 ),
+        mFrame( 0 )
+    {
+        mStats = OcclusionStats();
+    }
+
+    void Init()
+    {
+        mShader.reset( new Shader( "shaders/bbox.vs", "shaders/bbox.fs" ) );
+
+        // Unit cube, scaled onto each box in the vertex shader.
+        static const float vertices[] =
+        {
+            0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f,
+        };
+        static const uint8_t indices[] =
+        {
+            0, 2, 1,  0, 3, 2,  4, 5, 6,  4, 6, 7,  0, 1, 5,  0, 5, 4,
+            3, 6, 2,  3, 7, 6,  0, 4, 7,  0, 7, 3,  1, 2, 6,  1, 6, 5,
+        };
+
+        glGenVertexArrays( 1, &mVertexArray );
+        glGenBuffers( 1, &mVertexBuffer );
+        glGenBuffers( 1, &mIndexBuffer );
+        glBindVertexArray( mVertexArray );
+        glBindBuffer( GL_ARRAY_BUFFER, mVertexBuffer );
+        glBufferData( GL_ARRAY_BUFFER, sizeof( vertices ), vertices, GL_STATIC_DRAW );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer );
+        glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( indices ), indices, GL_STATIC_DRAW );
+        glEnableVertexAttribArray( 0 );
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof( float ), (void*)0 );
+        glBindVertexArray( 0 );
+    }
+
+    const OcclusionStats& GetStats() const { return mStats; }
+
+    // Collects finished queries without blocking. Call once per frame before IsVisible.
+    void BeginFrame( uint32_t const frame )
+    {
+        mFrame = frame;
+        mStats = OcclusionStats();
+        mPendingQueries.clear();
+
+        for (auto it = mEntries.begin(); it != mEntries.end();)
+        {
+            Entry& entry = it->second;
+            if (mFrame - entry.mTestFrame > FORGET_INTERVAL)
+            {
+                glDeleteQueries( 1, &entry.mQuery );
+                it = mEntries.erase( it );
+                continue;
+            }
+            ++it;
+            if (!entry.mQueryPending)
+                continue;
+
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv( entry.mQuery, GL_QUERY_RESULT_AVAILABLE, &available );
+            if (available == GL_FALSE)
+                continue;
+
+            GLuint anySamplesPassed = GL_FALSE;
+            glGetQueryObjectuiv( entry.mQuery, GL_QUERY_RESULT, &anySamplesPassed );
+            entry.mQueryPending = false;
+            entry.mVisible = anySamplesPassed != GL_FALSE;
+            mStats.mResultsReceived++;
+            mStats.mLatencyFrames += mFrame - entry.mQueryFrame;
+        }
+    }
+
+    // Returns whether 'object' should be drawn this frame and schedules a query for it if one is due.
+    bool IsVisible( const void* const object, const BoundingBox& box, const glm::vec3& cameraPos, float const nearDist )
+    {
+        Entry& entry = mEntries[object];
+        if (entry.mQuery == 0)
+        {
+            // Never seen before: draw it and find out.
+            glGenQueries( 1, &entry.mQuery );
+            entry.mVisible = true;
+            entry.mQueryPending = false;
+            entry.mQueryFrame = mFrame - (uint32_t)(mEntries.size() % VISIBLE_QUERY_INTERVAL);
+        }
+        entry.mTestFrame = mFrame;
+
+        // A box around the camera would be clipped away and read as occluded.
+        glm::vec3 const margin( nearDist * 2.0f );
+        if (glm::all( glm::greaterThanEqual( cameraPos, box.mMin - margin ) ) &&
+            glm::all( glm::lessThanEqual( cameraPos, box.mMax + margin ) ))
+        {
+            entry.mVisible = true;
+            return true;
+        }
+
+        bool const queryDue = !entry.mQueryPending &&
+                              (!entry.mVisible || mFrame - entry.mQueryFrame >= VISIBLE_QUERY_INTERVAL);
+        if (queryDue)
+        {
+            PendingQuery query;
+            query.mEntry = &entry;
+            query.mBox = box;
+            mPendingQueries.push_back( query );
+        }
+
+        if (!entry.mVisible)
+        {
+            mStats.mOccluded++;
+        }
+        return entry.mVisible;
+    }
+
+    // Draws the scheduled boxes inside queries, after the scene so they test against its depth.
+    void IssueQueries( RenderBackend& backend )
+    {
+        if (mPendingQueries.empty())
+            return;
+
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        glDepthMask( GL_FALSE );
+        glDepthFunc( GL_LEQUAL );
+
+        backend.UseProgram( *mShader );
+        backend.BindVertexArray( mVertexArray );
+        for (const auto& query : mPendingQueries)
+        {
+            mShader->setVec3( "boxMin", query.mBox.mMin );
+            mShader->setVec3( "boxMax", query.mBox.mMax );
+            glBeginQuery( GL_ANY_SAMPLES_PASSED, query.mEntry->mQuery );
+            glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0 );
+            glEndQuery( GL_ANY_SAMPLES_PASSED );
+            query.mEntry->mQueryPending = true;
+            query.mEntry->mQueryFrame = mFrame;
+            mStats.mQueriesIssued++;
+        }
+
+        glDepthFunc( GL_LESS );
+        glDepthMask( GL_TRUE );
+        glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+    }
+
+private:
+    struct Entry
+    {
+        Entry():
+            mQuery( 0 ),
+            mQueryFrame( 0 ),
+            mTestFrame( 0 ),
+            mVisible( true ),
+            mQueryPending( false )
+        {
+        }
+
+        GLuint mQuery;
+        uint32_t mQueryFrame;   // frame the last query was issued
+        uint32_t mTestFrame;    // frame IsVisible was last asked about the object
+        bool mVisible;          // result of the last finished query
+        bool mQueryPending;
+    };
+
+    struct PendingQuery
+    {
+        Entry* mEntry;
+        BoundingBox mBox;
+    };
+
+    std::unique_ptr<Shader> mShader;
+    GLuint mVertexArray;
+    GLuint mVertexBuffer;
+    GLuint mIndexBuffer;
+    uint32_t mFrame;
+    std::unordered_map<const void*, Entry> mEntries;
+    std::vector<PendingQuery> mPendingQueries;
+    OcclusionStats mStats;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,383 @@
+//=============================================================================
+// Render Queue
+//
+// Objects submit draw packets tagged with a 64 bit sort key instead of
+// talking to the GL directly. Once everything has been submitted the queue
+// is sorted and handed to the backend, which walks it in key order and only
+// touches GL state that actually changes between packets.
+//
+// Instance data for the whole frame lives in one stream buffer owned by the
+// backend; packets say where their instances start. With ARB_base_instance
+// that goes straight into the draw, otherwise the instance attributes of the
+// vertex array are re-pointed when it changes.
+//
+// All meshes share the geometry arena's vertex array, so neighbouring
+// single instance packets that only differ in mesh are merged into one
+// glMultiDrawElementsBaseVertex.
+//
+// Depth only packets (the depth pre-pass) skip material constants and
+// textures, so they sort and merge on program and vertex array alone.
+//
+// Sort key layout (most significant bits first):
+//   [63..52] program       12 bits
+//   [51..36] texture set   16 bits
+//   [35..24] vertex array  12 bits
+//   [23.. 0] depth         24 bits, front to back
+//=============================================================================
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <mesh.h>
+#include <shader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+//=============================================================================
+
+struct Material
+{
+    float mShininess;
+    float mDiffuseScale;
+    float mSpecularScale;
+};
+
+//=============================================================================
+
+struct DrawPacket
+{
+    uint64_t mKey;
+    const Shader* mShader;
+    const Mesh* mMesh;
+    Material mMaterial;
+    uint32_t mLod;
+    uint32_t mFirstInstance;    // into the instances given to RenderBackend::UploadInstances
+    GLsizei mInstanceCount;
+    bool mDepthOnly;            // no material or textures, see MakeDepthKey
+};
+
+//=============================================================================
+
+// Per frame counters. "Submitted" state changes reached the GL, "elided" ones
+// were skipped because the state was already bound.
+struct RenderStats
+{
+    uint32_t mPackets;
+    uint32_t mDrawCalls;
+    uint32_t mProgramChanges;
+    uint32_t mProgramChangesElided;
+    uint32_t mTextureChanges;
+    uint32_t mTextureChangesElided;
+    uint32_t mVertexArrayChanges;
+    uint32_t mVertexArrayChangesElided;
+    uint32_t mInstanceRebinds;
+    uint32_t mMultiDraws;
+};
+
+//=============================================================================
+
+// Tracks what is bound on the GL and skips redundant binds. Anything that
+// binds state behind its back must call Invalidate().
+class RenderBackend
+{
+public:
+    static uint32_t const MAX_TEXTURE_UNITS = 16;
+
+    RenderBackend():
+        mInstanceBuffer( 0 )
+    {
+        Invalidate();
+        ResetStats();
+    }
+
+    void Init()
+    {
+        glGenBuffers( 1, &mInstanceBuffer );
+    }
+
+    // Replaces the instance stream for this frame's packets.
+    void UploadInstances( const std::vector<InstanceData>& instances )
+    {
+        if (instances.empty())
+            return;
+
+        // Orphan last frame's storage so the driver doesn't have to wait for the GPU to finish reading it.
+        size_t const size = instances.size() * sizeof( InstanceData );
+        glBindBuffer( GL_ARRAY_BUFFER, mInstanceBuffer );
+        glBufferData( GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW );
+        glBufferSubData( GL_ARRAY_BUFFER, 0, size, &instances[0] );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+
+    void Invalidate()
+    {
+        mProgram = ~0u;
+        mVertexArray = ~0u;
+        mActiveUnit = ~0u;
+        for (uint32_t i = 0; i < MAX_TEXTURE_UNITS; i++)
+        {
+            mTextures[i] = ~0u;
+        }
+    }
+
+    void ResetStats()
+    {
+        mStats = RenderStats();
+    }
+
+    const RenderStats& GetStats() const { return mStats; }
+
+    // Finishes the shader first if its link is still outstanding (see Shader::finish).
+    void UseProgram( const Shader& shader )
+    {
+        shader.finish();
+        GLuint const program = shader.ID;
+        if (program == mProgram)
+        {
+            mStats.mProgramChangesElided++;
+            return;
+        }
+        glUseProgram( program );
+        mProgram = program;
+        mStats.mProgramChanges++;
+    }
+
+    // Texture names are unique across targets, so the cache needn't track which one a unit has.
+    void BindTexture( uint32_t const unit, GLuint const texture, GLenum const target = GL_TEXTURE_2D )
+    {
+        if (unit < MAX_TEXTURE_UNITS && mTextures[unit] == texture)
+        {
+            mStats.mTextureChangesElided++;
+            return;
+        }
+        if (unit != mActiveUnit)
+        {
+            glActiveTexture( GL_TEXTURE0 + unit );
+            mActiveUnit = unit;
+        }
+        glBindTexture( target, texture );
+        if (unit < MAX_TEXTURE_UNITS)
+        {
+            mTextures[unit] = texture;
+        }
+        mStats.mTextureChanges++;
+    }
+
+    void BindVertexArray( GLuint const vertexArray )
+    {
+        if (vertexArray == mVertexArray)
+        {
+            mStats.mVertexArrayChangesElided++;
+            return;
+        }
+        glBindVertexArray( vertexArray );
+        mVertexArray = vertexArray;
+        mStats.mVertexArrayChanges++;
+    }
+
+    // Whether b can go into the same draw call as a.
+    static bool CanMerge( const DrawPacket& a, const DrawPacket& b )
+    {
+        if (a.mInstanceCount != 1 || b.mInstanceCount != 1 ||
+            a.mFirstInstance != b.mFirstInstance ||
+            a.mShader != b.mShader ||
+            a.mMesh->VAO != b.mMesh->VAO ||
+            a.mMesh->indexType != b.mMesh->indexType ||
+            a.mDepthOnly != b.mDepthOnly)
+            return false;
+        if (a.mDepthOnly)
+            return true;
+        return a.mMesh->textures.size() == b.mMesh->textures.size() &&
+               std::equal( a.mMesh->textures.begin(), a.mMesh->textures.end(), b.mMesh->textures.begin(),
+                           []( const Texture& x, const Texture& y ) { return x.id == y.id; } ) &&
+               a.mMaterial.mShininess == b.mMaterial.mShininess &&
+               a.mMaterial.mDiffuseScale == b.mMaterial.mDiffuseScale &&
+               a.mMaterial.mSpecularScale == b.mMaterial.mSpecularScale;
+    }
+
+    // Draws 'count' packets that CanMerge with the first one.
+    void Execute( const DrawPacket* packets, uint32_t const count )
+    {
+        const DrawPacket& packet = packets[0];
+        const Shader& shader = *packet.mShader;
+        const Mesh& mesh = *packet.mMesh;
+
+        UseProgram( shader );
+
+        if (!packet.mDepthOnly)
+        {
+            // Material constants go through the shader's shadow copy, so repeats are free.
+            shader.setFloat( "shininess", packet.mMaterial.mShininess );
+            shader.setFloat( "diffuseScale", packet.mMaterial.mDiffuseScale );
+            shader.setFloat( "specularScale", packet.mMaterial.mSpecularScale );
+
+            for (uint32_t i = 0; i < mesh.textures.size(); i++)
+            {
+                shader.setInt( mesh.samplerNames[i], (int)i );
+                BindTexture( i, mesh.textures[i].id, mesh.textures[i].target );
+            }
+        }
+
+        BindVertexArray( mesh.VAO );
+        mStats.mPackets += count;
+        mStats.mDrawCalls++;
+
+        if (count > 1)
+        {
+            // Multi draws have no instancing, every mesh reads the instance the attributes point at.
+            BindInstances( mesh, packet.mFirstInstance );
+            mCounts.clear();
+            mOffsets.clear();
+            mBaseVertices.clear();
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const Mesh& m = *packets[i].mMesh;
+                const MeshLod& lod = m.getLod( packets[i].mLod );
+                mCounts.push_back( (GLsizei)lod.indexCount );
+                mOffsets.push_back( m.getIndexOffset( lod ) );
+                mBaseVertices.push_back( (GLint)m.range.mBaseVertex );
+            }
+            glMultiDrawElementsBaseVertex( GL_TRIANGLES, &mCounts[0], mesh.indexType, &mOffsets[0], (GLsizei)count, &mBaseVertices[0] );
+            mStats.mMultiDraws++;
+            return;
+        }
+
+        const MeshLod& lod = mesh.getLod( packet.mLod );
+        if (GLAD_GL_ARB_base_instance)
+        {
+            BindInstances( mesh, 0 );
+            glDrawElementsInstancedBaseVertexBaseInstance( GL_TRIANGLES, (GLsizei)lod.indexCount, mesh.indexType, mesh.getIndexOffset( lod ),
+                                                           packet.mInstanceCount, (GLint)mesh.range.mBaseVertex, packet.mFirstInstance );
+        }
+        else
+        {
+            BindInstances( mesh, packet.mFirstInstance );
+            glDrawElementsInstancedBaseVertex( GL_TRIANGLES, (GLsizei)lod.indexCount, mesh.indexType, mesh.getIndexOffset( lod ),
+                                               packet.mInstanceCount, (GLint)mesh.range.mBaseVertex );
+        }
+    }
+
+private:
+    // Points the instance attributes of the mesh's vertex array at
+    // firstInstance. Vertex array state outlives the frame, so with base
+    // instance support this happens once.
+    void BindInstances( const Mesh& mesh, uint32_t const firstInstance )
+    {
+        auto it = mInstanceBases.find( mesh.VAO );
+        if (it != mInstanceBases.end() && it->second == firstInstance)
+            return;
+
+        mesh.setupInstancing( mInstanceBuffer, firstInstance );
+        mInstanceBases[mesh.VAO] = firstInstance;
+        mStats.mInstanceRebinds++;
+    }
+
+    GLuint mInstanceBuffer;
+    std::unordered_map<GLuint, uint32_t> mInstanceBases;   // vertex array -> first instance its attributes point at
+    GLuint mProgram;
+    GLuint mVertexArray;
+    uint32_t mActiveUnit;
+    GLuint mTextures[MAX_TEXTURE_UNITS];
+    RenderStats mStats;
+    std::vector<GLsizei> mCounts;
+    std::vector<const void*> mOffsets;
+    std::vector<GLint> mBaseVertices;
+};
+
+//=============================================================================
+
+class RenderQueue
+{
+public:
+    static uint32_t const PROGRAM_BITS = 12;
+    static uint32_t const TEXTURE_SET_BITS = 16;
+    static uint32_t const VERTEX_ARRAY_BITS = 12;
+    static uint32_t const DEPTH_BITS = 24;
+
+    // Builds a sort key. depth is the view space distance, farDepth the
+    // distance it is normalized against (anything further sorts last).
+    uint64_t MakeKey( const Shader& shader, const Mesh& mesh, float const depth, float const farDepth )
+    {
+        uint64_t const program = shader.ID & ((1u << PROGRAM_BITS) - 1);
+        uint64_t const textureSet = GetTextureSet( mesh ) & ((1u << TEXTURE_SET_BITS) - 1);
+        uint64_t const vertexArray = mesh.VAO & ((1u << VERTEX_ARRAY_BITS) - 1);
+        float const normalizedDepth = glm::clamp( depth / farDepth, 0.0f, 1.0f );
+        uint64_t const quantizedDepth = (uint64_t)(normalizedDepth * (float)((1u << DEPTH_BITS) - 1));
+
+        return (program << (TEXTURE_SET_BITS + VERTEX_ARRAY_BITS + DEPTH_BITS)) |
+               (textureSet << (VERTEX_ARRAY_BITS + DEPTH_BITS)) |
+               (vertexArray << DEPTH_BITS) |
+               quantizedDepth;
+    }
+
+    // Key for a depth only packet, textures don't matter.
+    uint64_t MakeDepthKey( const Shader& shader, const Mesh& mesh, float const depth, float const farDepth )
+    {
+        uint64_t const program = shader.ID & ((1u << PROGRAM_BITS) - 1);
+        uint64_t const vertexArray = mesh.VAO & ((1u << VERTEX_ARRAY_BITS) - 1);
+        float const normalizedDepth = glm::clamp( depth / farDepth, 0.0f, 1.0f );
+        uint64_t const quantizedDepth = (uint64_t)(normalizedDepth * (float)((1u << DEPTH_BITS) - 1));
+
+        return (program << (TEXTURE_SET_BITS + VERTEX_ARRAY_BITS + DEPTH_BITS)) |
+               (vertexArray << DEPTH_BITS) |
+               quantizedDepth;
+    }
+
+    void Submit( const DrawPacket& packet )
+    {
+        mPackets.push_back( packet );
+    }
+
+    // Sorts and executes everything submitted this frame, then empties the queue.
+    void Flush( RenderBackend& backend )
+    {
+        std::sort( mPackets.begin(), mPackets.end(), []( const DrawPacket& a, const DrawPacket& b ) { return a.mKey < b.mKey; } );
+        for (uint32_t first = 0; first < mPackets.size();)
+        {
+            uint32_t last = first + 1;
+            while (last < mPackets.size() && RenderBackend::CanMerge( mPackets[first], mPackets[last] ))
+            {
+                last++;
+            }
+            backend.Execute( &mPackets[first], last - first );
+            first = last;
+        }
+        mPackets.clear();
+
+        // Texture names get deleted and handed out again, so set ids only hold for the packets they sorted.
+        mTextureSets.clear();
+    }
+
+private:
+    // Meshes that bind the same textures share a texture set id until the next Flush(), so they sort next
+    // to each other.
+    uint32_t GetTextureSet( const Mesh& mesh )
+    {
+        mTextureSetKey.clear();
+        for (const auto& texture : mesh.textures)
+        {
+            mTextureSetKey.push_back( texture.id );
+        }
+        auto it = mTextureSets.find( mTextureSetKey );
+        if (it == mTextureSets.end())
+        {
+            it = mTextureSets.insert( std::make_pair( mTextureSetKey, (uint32_t)mTextureSets.size() ) ).first;
+        }
+        return it->second;
+    }
+
+    std::vector<DrawPacket> mPackets;
+    std::map<std::vector<GLuint>, uint32_t> mTextureSets;
+    std::vector<GLuint> mTextureSetKey;
+};
+
+//=============================================================================
+
+#endif
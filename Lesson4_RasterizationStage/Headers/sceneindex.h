@@ -0,0 +1,104 @@
+//=============================================================================
+// Scene Index
+//
+// Dynamic AABB tree over everything that can be culled, built on Bullet's
+// btDbvt. Moving objects refit their leaf every frame; a leaf is only
+// reinserted once its box leaves the margin it was fattened by, so the tree
+// stays cheap to maintain. Frustum queries walk the tree and accept whole
+// subtrees once they are fully inside, so the cost follows the number of
+// visible objects rather than the total.
+//=============================================================================
+
+#ifndef SCENEINDEX_H
+#define SCENEINDEX_H
+
+#include <bounds.h>
+
+#include <BulletCollision/BroadphaseCollision/btDbvt.h>
+
+#include <cstdint>
+#include <vector>
+
+//=============================================================================
+
+class SceneIndex
+{
+public:
+    typedef btDbvtNode* Leaf;
+
+    SceneIndex():
+        mNumLeaves( 0 )
+    {
+    }
+
+    uint32_t GetNumLeaves() const { return mNumLeaves; }
+
+    Leaf Insert( const BoundingBox& box, void* data )
+    {
+        mNumLeaves++;
+        return mTree.insert( ToVolume( box ), data );
+    }
+
+    // Refits a leaf. Small moves stay inside the fattened volume and don't touch the tree.
+    void Update( Leaf const leaf, const BoundingBox& box, float const margin = 0.25f )
+    {
+        btDbvtVolume volume = ToVolume( box );
+        mTree.update( leaf, volume, btScalar( margin ) );
+    }
+
+    void Remove( Leaf const leaf )
+    {
+        mTree.remove( leaf );
+        mNumLeaves--;
+    }
+
+    // Rebalances a little every frame to undo the damage done by reinsertion.
+    void Optimize( int const passes = 1 )
+    {
+        mTree.optimizeIncremental( passes );
+    }
+
+    // Appends the data pointer of every leaf touching the frustum to 'results'.
+    void Cull( const Frustum& frustum, std::vector<void*>& results ) const
+    {
+        btVector3 normals[Frustum::NUM_PLANES];
+        btScalar offsets[Frustum::NUM_PLANES];
+        for (uint32_t i = 0; i < Frustum::NUM_PLANES; i++)
+        {
+            normals[i] = btVector3( frustum.mPlanes[i].x, frustum.mPlanes[i].y, frustum.mPlanes[i].z );
+            offsets[i] = frustum.mPlanes[i].w;
+        }
+
+        Collector collector( results );
+        btDbvt::collideKDOP( mTree.m_root, normals, offsets, Frustum::NUM_PLANES, collector );
+    }
+
+private:
+    struct Collector : public btDbvt::ICollide
+    {
+        explicit Collector( std::vector<void*>& results ):
+            mResults( results )
+        {
+        }
+
+        virtual void Process( const btDbvtNode* leaf ) override
+        {
+            mResults.push_back( leaf->data );
+        }
+
+        std::vector<void*>& mResults;
+    };
+
+    static btDbvtVolume ToVolume( const BoundingBox& box )
+    {
+        return btDbvtVolume::FromMM( btVector3( box.mMin.x, box.mMin.y, box.mMin.z ),
+                                     btVector3( box.mMax.x, box.mMax.y, box.mMax.z ) );
+    }
+
+    btDbvt mTree;
+    uint32_t mNumLeaves;
+};
+
+//=============================================================================
+
+#endif
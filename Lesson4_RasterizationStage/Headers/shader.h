@@ -4,18 +4,61 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <fileutils.h>
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// FNV-1a hash of a uniform name. constexpr so names written as literals are hashed at compile time.
+constexpr unsigned int HashUniformName(const char* name, unsigned int hash = 2166136261u)
+{
+    return *name == 0 ? hash : HashUniformName(name + 1, (hash ^ (unsigned int)(unsigned char)*name) * 16777619u);
+}
+
+// uniform blocks shared by every program. Each is bound to the binding point of its index after linking,
+// so a buffer bound there once feeds all programs.
+enum UniformBlock
+{
+    UNIFORM_BLOCK_FRAME,
+    UNIFORM_BLOCK_LIGHTS,
+    NUM_UNIFORM_BLOCKS
+};
+static const char* const UniformBlockNames[NUM_UNIFORM_BLOCKS] = { "FrameData", "LightData" };
+
+// textures shared by every program. They live on fixed units above the ones meshes use and each program's
+// samplers are pointed at them after linking, so they're bound once and never touched by the draws.
+enum SharedTexture
+{
+    SHARED_TEXTURE_CLUSTER_GRID,
+    SHARED_TEXTURE_CLUSTER_LIGHTS,
+    NUM_SHARED_TEXTURES
+};
+static const char* const SharedTextureNames[NUM_SHARED_TEXTURES] = { "clusterGrid", "clusterLightIndices" };
+static const unsigned int SHARED_TEXTURE_FIRST_UNIT = 14;
+
+// identifies a uniform by the hash of its name. Implicitly constructible from a literal so that
+// shader.setFloat("shininess", ...) never builds a std::string or touches the GL on lookup.
+struct UniformName
+{
+    unsigned int hash;
+    constexpr UniformName(const char* name) : hash(HashUniformName(name)) {}
+    UniformName(const std::string &name) : hash(HashUniformName(name.c_str())) {}
+};
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly. 'defines' (lines of "#define NAME") is pasted into both
+    // stages right after their #version line, which is how permutations are built (see shadervariants.h).
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines = std::string())
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -40,107 +83,483 @@ public:
             // convert stream into string
             vertexCode = vShaderStream.str();
             fragmentCode = fShaderStream.str();			
+            // paste in any #include "file" (relative to the including shader)
+            vertexCode = resolveIncludes(vertexCode, vertexPath);
+            fragmentCode = resolveIncludes(fragmentCode, fragmentPath);
+            vertexCode = injectDefines(vertexCode, defines);
+            fragmentCode = injectDefines(fragmentCode, defines);
         }
         catch (std::ifstream::failure e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
+        // 2. start building the program. A binary from an earlier run is used when there is one, otherwise the
+        // sources are compiled and linked; either way nothing here waits on the driver, see finish()
+        vertexSource = vertexCode;
+        fragmentSource = fragmentCode;
+        cacheKey = hashProgramSource(vertexCode, fragmentCode);
+        finished = false;
         ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        fromBinary = loadProgramBinary();
+        if (!fromBinary)
+            compile();
+    }
+    // waits for the program to link (if it hasn't yet), reports errors, stores a binary for next time and
+    // sets up uniforms. Called by use(), by the setters, and by the render backend before drawing.
+    // ------------------------------------------------------------------------
+    void finish() const
+    {
+        if (finished)
+            return;
+        finished = true;
+        if (fromBinary)
+        {
+            GLint linked = GL_FALSE;
+            glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+            if (!linked)
+            {
+                // the driver changed under the cache (or the file is bad), build from source after all. A
+                // program whose binary failed to load can still be linked from shaders as usual.
+                std::cout << "SHADER::PROGRAM_BINARY_REJECTED, compiling from source" << std::endl;
+                compile();
+                fromBinary = false;
+            }
+        }
+        if (!fromBinary)
+        {
+            bool const vertexOk = checkCompileErrors(vertexShader, "VERTEX");
+            bool const fragmentOk = checkCompileErrors(fragmentShader, "FRAGMENT");
+            bool const programOk = checkCompileErrors(ID, "PROGRAM");
+            // delete the shaders as they're linked into our program now and no longer necessery
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            if (vertexOk && fragmentOk && programOk)
+                saveProgramBinary();
+        }
+        vertexSource.clear();
+        fragmentSource.clear();
+        // look up every active uniform once, so the setters never have to ask the GL
+        reflectUniforms();
+        // hook the shared uniform blocks up to their binding points
+        for (unsigned int i = 0; i < NUM_UNIFORM_BLOCKS; i++)
+        {
+            GLuint const blockIndex = glGetUniformBlockIndex(ID, UniformBlockNames[i]);
+            if (blockIndex != GL_INVALID_INDEX)
+                glUniformBlockBinding(ID, blockIndex, i);
+        }
+        // and the shared texture samplers up to their units
+        GLint previousProgram = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glUseProgram(ID);
+        for (unsigned int i = 0; i < NUM_SHARED_TEXTURES; i++)
+            setInt(SharedTextureNames[i], (int)(SHARED_TEXTURE_FIRST_UNIT + i));
+        glUseProgram((GLuint)previousProgram);
+    }
+    // true if finish() wouldn't have to wait. Only known with KHR_parallel_shader_compile, without it a
+    // program that hasn't been finished is assumed to still be busy.
+    // ------------------------------------------------------------------------
+    bool isReady() const
+    {
+        if (finished || fromBinary)
+            return true;
+        if (!parallelCompile())
+            return false;
+        GLint done = GL_FALSE;
+        glGetProgramiv(ID, COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    // looks for KHR_parallel_shader_compile (or the ARB version), which glad doesn't know about, and lets the
+    // driver compile on as many threads as it likes. Call once after the GL is loaded.
+    // ------------------------------------------------------------------------
+    static void enableParallelCompile(GLADloadproc load)
+    {
+        typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions; i++)
+        {
+            const char* name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+            bool const khr = std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0;
+            bool const arb = std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0;
+            if (!khr && !arb)
+                continue;
+            MaxShaderCompilerThreadsProc maxThreads = (MaxShaderCompilerThreadsProc)load(khr ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB");
+            if (maxThreads != NULL)
+            {
+                maxThreads(0xFFFFFFFFu);
+                parallelCompile() = true;
+                return;
+            }
+        }
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() const
     { 
+        finish();
         glUseProgram(ID); 
     }
     // utility uniform functions
+    // values are compared against a CPU side copy of the uniform and only uploaded when they changed.
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(UniformName name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        int const v = (int)value;
+        if (const Uniform* u = changed(name, &v, sizeof(v)))
+            glUniform1i(u->location, v); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(UniformName name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        if (const Uniform* u = changed(name, &value, sizeof(value)))
+            glUniform1i(u->location, value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(UniformName name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        if (const Uniform* u = changed(name, &value, sizeof(value)))
+            glUniform1f(u->location, value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(UniformName name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        if (const Uniform* u = changed(name, &value[0], sizeof(value)))
+            glUniform2fv(u->location, 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(UniformName name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        setVec2(name, glm::vec2(x, y)); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(UniformName name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        if (const Uniform* u = changed(name, &value[0], sizeof(value)))
+            glUniform3fv(u->location, 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(UniformName name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        setVec3(name, glm::vec3(x, y, z)); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(UniformName name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        if (const Uniform* u = changed(name, &value[0], sizeof(value)))
+            glUniform4fv(u->location, 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(UniformName name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        setVec4(name, glm::vec4(x, y, z, w)); 
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(UniformName name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        if (const Uniform* u = changed(name, &mat[0][0], sizeof(mat)))
+            glUniformMatrix2fv(u->location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(UniformName name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        if (const Uniform* u = changed(name, &mat[0][0], sizeof(mat)))
+            glUniformMatrix3fv(u->location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(UniformName name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-        GLenum const err = glGetError();
-        assert( err == GL_NO_ERROR );
+        if (const Uniform* u = changed(name, &mat[0][0], sizeof(mat)))
+            glUniformMatrix4fv(u->location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // an active uniform of the program, found by reflection after linking.
+    struct Uniform
+    {
+        unsigned int hash;      // HashUniformName of the uniform's name
+        GLint location;
+        unsigned int offset;    // where the shadow copy of the value lives in 'shadow'
+        unsigned int size;      // size of the shadow copy in bytes
+        bool valid;             // false until the first upload, the GL's value is unknown until then
+    };
+    mutable std::vector<Uniform> uniforms;      // sorted by hash
+    mutable std::vector<unsigned char> shadow;  // last value uploaded to each uniform
+
+    // program building state, see finish()
+    mutable std::string vertexSource;           // kept until finished in case a cached binary is rejected
+    mutable std::string fragmentSource;
+    mutable unsigned int vertexShader;
+    mutable unsigned int fragmentShader;
+    mutable bool finished;
+    mutable bool fromBinary;
+    unsigned long long cacheKey;
+
+    // not in glad, see enableParallelCompile()
+    static const GLenum COMPLETION_STATUS_KHR = 0x91B1;
+
+    static bool &parallelCompile()
+    {
+        static bool enabled = false;
+        return enabled;
+    }
+
+    // compiles both stages and starts the link without asking for any results
+    void compile() const
+    {
+        const char* vShaderCode = vertexSource.c_str();
+        const char * fShaderCode = fragmentSource.c_str();
+        // vertex shader
+        vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertexShader, 1, &vShaderCode, NULL);
+        glCompileShader(vertexShader);
+        // fragment Shader
+        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragmentShader, 1, &fShaderCode, NULL);
+        glCompileShader(fragmentShader);
+        // shader Program
+        glAttachShader(ID, vertexShader);
+        glAttachShader(ID, fragmentShader);
+        if (programBinariesSupported())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+    }
+
+    // program binary cache
+    // ------------------------------------------------------------------------
+    // binaries live in shadercache/<key>.bin next to the executable's working directory. The key hashes the
+    // final sources (includes and defines resolved) with the GL vendor, renderer and version, since a binary
+    // is only good for the driver that made it. The file header repeats the key and the size so a truncated
+    // or colliding file is caught before the GL sees it; the GL gets the last word through the link status.
+    struct ProgramBinaryHeader
+    {
+        unsigned int magic;
+        unsigned int version;
+        unsigned long long key;
+        unsigned int format;
+        unsigned int size;
+    };
+    static const unsigned int PROGRAM_BINARY_MAGIC = 0x42504c47; // "GLPB"
+    static const unsigned int PROGRAM_BINARY_VERSION = 1;
+
+    static bool programBinariesSupported()
+    {
+        if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+            return false;
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+    }
+
+    static unsigned long long hashBytes(const char* data, size_t size, unsigned long long hash)
+    {
+        // 64 bit FNV-1a
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    static unsigned long long hashProgramSource(const std::string &vertexCode, const std::string &fragmentCode)
+    {
+        unsigned long long hash = 14695981039346656037ull;
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (GLenum name : strings)
+        {
+            const char* value = (const char*)glGetString(name);
+            if (value != NULL)
+                hash = hashBytes(value, std::strlen(value) + 1, hash);
+        }
+        hash = hashBytes(vertexCode.c_str(), vertexCode.size() + 1, hash);
+        return hashBytes(fragmentCode.c_str(), fragmentCode.size() + 1, hash);
+    }
+
+    std::string programBinaryPath() const
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "shadercache/%016llx.bin", cacheKey);
+        return name;
+    }
+
+    bool loadProgramBinary()
+    {
+        if (!programBinariesSupported())
+            return false;
+        std::ifstream file(programBinaryPath().c_str(), std::ios::binary);
+        if (!file)
+            return false;
+        ProgramBinaryHeader header;
+        if (!file.read((char*)&header, sizeof(header)) ||
+            header.magic != PROGRAM_BINARY_MAGIC || header.version != PROGRAM_BINARY_VERSION || header.key != cacheKey || header.size == 0)
+            return false;
+        std::vector<char> binary(header.size);
+        if (!file.read(&binary[0], header.size))
+            return false;
+        glProgramBinary(ID, header.format, &binary[0], (GLsizei)header.size);
+        return true;
+    }
+
+    void saveProgramBinary() const
+    {
+        if (!programBinariesSupported())
+            return;
+        GLint size = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &size);
+        if (size <= 0)
+            return;
+        std::vector<char> binary(size);
+        GLenum format = 0;
+        glGetProgramBinary(ID, size, NULL, &format, &binary[0]);
+        ProgramBinaryHeader header = { PROGRAM_BINARY_MAGIC, PROGRAM_BINARY_VERSION, cacheKey, format, (unsigned int)size };
+        // written under a name of its own first, so a crash or another process saving the same program
+        // never leaves half a binary behind
+        std::string const path = programBinaryPath();
+        std::string const temporary = GetTemporaryPath(path);
+        {
+            std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+            if (!file)
+                return; // no shadercache directory, run without the cache
+            file.write((const char*)&header, sizeof(header));
+            file.write(&binary[0], size);
+            if (!file)
+            {
+                file.close();
+                std::remove(temporary.c_str());
+                return;
+            }
+        }
+        if (!RenameOver(temporary, path))
+            std::remove(temporary.c_str());
+    }
+
+    // returns the uniform if 'value' differs from its shadow copy (updating the copy), NULL if there's nothing
+    // to upload or the program has no such active uniform
+    const Uniform* changed(UniformName name, const void* value, unsigned int size) const
+    {
+        finish();
+        auto u = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash, [](const Uniform &u, unsigned int hash) { return u.hash < hash; });
+        if (u == uniforms.end() || u->hash != name.hash)
+            return NULL;
+        size = std::min(size, u->size);
+        if (u->valid && std::memcmp(&shadow[u->offset], value, size) == 0)
+            return NULL;
+        std::memcpy(&shadow[u->offset], value, size);
+        u->valid = true;
+        return &*u;
+    }
+
+    // size in bytes of a single element of a uniform type
+    static unsigned int uniformTypeSize(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_FLOAT_VEC2: return 2 * sizeof(float);
+        case GL_FLOAT_VEC3: return 3 * sizeof(float);
+        case GL_FLOAT_VEC4: return 4 * sizeof(float);
+        case GL_FLOAT_MAT2: return 4 * sizeof(float);
+        case GL_FLOAT_MAT3: return 9 * sizeof(float);
+        case GL_FLOAT_MAT4: return 16 * sizeof(float);
+        default:            return 4; // float, int, bool and samplers
+        }
+    }
+
+    // builds the uniform table from the program's active uniforms. Arrays get one entry per element
+    // ("name[i]"), with the bare name aliasing element 0.
+    void reflectUniforms() const
+    {
+        uniforms.clear();
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        unsigned int shadowSize = 0;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            GLint arraySize = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, sizeof(name), NULL, &arraySize, &type, name);
+            // uniforms inside uniform blocks have no location and are set through their buffer
+            GLint const location = glGetUniformLocation(ID, name);
+            if (location < 0)
+                continue;
+
+            // array names are reported as "name[0]"
+            std::string baseName = name;
+            std::string::size_type const bracket = baseName.find('[');
+            if (bracket != std::string::npos)
+                baseName.resize(bracket);
+
+            unsigned int const size = uniformTypeSize(type);
+            for (GLint j = 0; j < arraySize; j++)
+            {
+                Uniform u;
+                u.location = location + j; // array elements have consecutive locations
+                u.offset = shadowSize;
+                u.size = size;
+                u.valid = false;
+                shadowSize += size;
+                if (arraySize > 1)
+                {
+                    u.hash = HashUniformName((baseName + "[" + std::to_string(j) + "]").c_str());
+                    uniforms.push_back(u);
+                }
+                if (j == 0)
+                {
+                    u.hash = HashUniformName(baseName.c_str());
+                    uniforms.push_back(u);
+                }
+            }
+        }
+        std::sort(uniforms.begin(), uniforms.end(), [](const Uniform &a, const Uniform &b) { return a.hash < b.hash; });
+        for (size_t i = 1; i < uniforms.size(); i++)
+        {
+            if (uniforms[i].hash == uniforms[i - 1].hash && uniforms[i].location != uniforms[i - 1].location)
+                std::cout << "ERROR::SHADER::UNIFORM_NAME_HASH_COLLISION" << std::endl;
+        }
+        shadow.assign(shadowSize, 0);
+    }
+
+    // replaces lines of the form #include "file" with the contents of file, which is looked up next to 'path'.
+    // ------------------------------------------------------------------------
+    static std::string resolveIncludes(const std::string &source, const std::string &path)
+    {
+        std::string const directory = path.substr(0, path.find_last_of('/') + 1);
+        std::stringstream in(source);
+        std::stringstream out;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::string::size_type const directive = line.find("#include");
+            std::string::size_type const open = line.find('"');
+            std::string::size_type const close = line.rfind('"');
+            if (directive == std::string::npos || open == std::string::npos || close <= open)
+            {
+                out << line << '\n';
+                continue;
+            }
+            std::string const includePath = directory + line.substr(open + 1, close - open - 1);
+            std::ifstream includeFile;
+            includeFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+            includeFile.open(includePath.c_str());
+            std::stringstream includeStream;
+            includeStream << includeFile.rdbuf();
+            out << resolveIncludes(includeStream.str(), includePath) << '\n';
+        }
+        return out.str();
+    }
+
+    // inserts 'defines' after the #version line, which has to stay first. Without one they go at the top.
+    // ------------------------------------------------------------------------
+    static std::string injectDefines(const std::string &source, const std::string &defines)
+    {
+        if (defines.empty())
+            return source;
+        std::string::size_type const version = source.find("#version");
+        if (version == std::string::npos)
+            return defines + source;
+        std::string::size_type const lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return source + "\n" + defines;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -151,6 +570,7 @@ private:
             {
                 glGetShaderInfoLog(shader, 1024, NULL, infoLog);
                 std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                return false;
             }
         }
         else
@@ -160,8 +580,10 @@ private:
             {
                 glGetProgramInfoLog(shader, 1024, NULL, infoLog);
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                return false;
             }
         }
+        return true;
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+//=============================================================================
+// Shader Variants
+//
+// One vertex / fragment shader pair compiled into as many programs as
+// there are feature combinations in use. Each feature is a bit; a variant
+// is built the first time its mask is asked for, with a "#define NAME" per
+// set bit injected after the #version line, and cached by the mask from
+// then on.
+//
+// Features only ever remove work, or say where the data is, so callers
+// pick the cheapest variant that still gives the same picture (see
+// SelectShaderFeatures in main.cpp).
+//
+// Building a Shader doesn't wait for the driver, so Prewarm() can start
+// every variant at load time and let them compile (in parallel where the
+// driver supports it, or straight from the program binary cache) while
+// the rest of the game loads.
+//=============================================================================
+
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include <shader.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+//=============================================================================
+
+enum ShaderFeature
+{
+    SHADER_FEATURE_VERTEX_LIGHTING = 1 << 0,    // light per vertex instead of per fragment
+    SHADER_FEATURE_NO_SPECULAR = 1 << 1,        // material has no specular (specularScale 0)
+    SHADER_FEATURE_NO_TEXTURE = 1 << 2,         // mesh has no diffuse map, albedo is white
+    SHADER_FEATURE_MATERIAL_ARRAY = 1 << 3,     // diffuse map is a layer of the model's material array
+};
+
+static uint32_t const NUM_SHADER_FEATURES = 4;
+static const char* const ShaderFeatureNames[NUM_SHADER_FEATURES] = { "VERTEX_LIGHTING", "NO_SPECULAR", "NO_TEXTURE", "MATERIAL_ARRAY" };
+
+//=============================================================================
+
+class ShaderVariants
+{
+public:
+    ShaderVariants( const std::string& vertexPath, const std::string& fragmentPath ):
+        mVertexPath( vertexPath ),
+        mFragmentPath( fragmentPath )
+    {
+    }
+
+    // The program for this feature mask, compiled now if it's the first time.
+    const Shader* Get( uint32_t const features )
+    {
+        auto it = mVariants.find( features );
+        if (it == mVariants.end())
+        {
+            std::string const defines = MakeDefines( features );
+            it = mVariants.insert( std::make_pair( features, std::unique_ptr<Shader>( new Shader( mVertexPath.c_str(), mFragmentPath.c_str(), defines ) ) ) ).first;
+        }
+        return it->second.get();
+    }
+
+    // Starts building every combination of the features in 'features'.
+    void Prewarm( uint32_t const features )
+    {
+        // Walk the subsets of the mask, the empty one included.
+        uint32_t subset = features;
+        while (true)
+        {
+            Get( subset );
+            if (subset == 0)
+                break;
+            subset = (subset - 1) & features;
+        }
+    }
+
+    uint32_t GetNumVariants() const { return (uint32_t)mVariants.size(); }
+
+    // Variants whose link may still be running.
+    uint32_t GetNumPending() const
+    {
+        uint32_t pending = 0;
+        for (const auto& variant : mVariants)
+        {
+            pending += variant.second->isReady() ? 0 : 1;
+        }
+        return pending;
+    }
+
+    static std::string MakeDefines( uint32_t const features )
+    {
+        std::string defines;
+        for (uint32_t i = 0; i < NUM_SHADER_FEATURES; i++)
+        {
+            if (features & (1u << i))
+            {
+                defines += std::string( "#define " ) + ShaderFeatureNames[i] + "\n";
+            }
+        }
+        return defines;
+    }
+
+private:
+    std::string mVertexPath;
+    std::string mFragmentPath;
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> mVariants;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,540 @@
+//=============================================================================
+// Mesh Simplification
+//
+// Quadric error metric edge collapse (Garland / Heckbert) producing a chain
+// of levels of detail in one run. Collapses are half edge collapses onto an
+// existing vertex, so no new vertices are made and every level indexes the
+// original vertex array.
+//
+// Topology is worked out on positions, not vertex indices, so meshes where
+// every face corner is its own vertex still simplify. Vertices that share a
+// position but differ in normal or UV sit on a seam; seam vertices are never
+// collapsed away (other vertices may collapse onto them), and vertices on
+// open borders or non manifold edges are locked, which keeps UV and normal
+// seams and silhouettes intact.
+//
+// Collapses are ordered by the area weighted mean squared distance to the
+// planes gathered in each quadric. The error reported for a level is the
+// furthest any triangle has moved off the planes of the triangles it
+// replaced, added up over every collapse that moved it.
+//
+// No GL in here, it only works on CPU side vertex and index data.
+//=============================================================================
+
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+//=============================================================================
+
+struct SimplifyLevel
+{
+    std::vector<uint32_t> mIndices;
+    float mError;   // furthest the surface has moved so far, relative to the mesh extent
+};
+
+//=============================================================================
+
+// Interleaved vertex data: position is three floats at positionOffset, the
+// attributeSize bytes at attributeOffset decide whether two vertices at the
+// same position are the same vertex or the two sides of a seam.
+struct SimplifyVertexData
+{
+    const uint8_t* mData;
+    size_t mStride;
+    size_t mNumVertices;
+    size_t mPositionOffset;
+    size_t mAttributeOffset;
+    size_t mAttributeSize;
+};
+
+//=============================================================================
+
+class MeshSimplifier
+{
+public:
+    // Collapses edges cheapest first, taking a snapshot every time the index
+    // count drops to the next of targetIndexCounts (which must be
+    // descending). Stops early once the error would exceed maxError
+    // (relative to the mesh extent); remaining levels then repeat the last.
+    std::vector<SimplifyLevel> Simplify( const SimplifyVertexData& vertices, const std::vector<uint32_t>& indices,
+                                         const std::vector<size_t>& targetIndexCounts, float const maxError )
+    {
+        Setup( vertices, indices );
+
+        std::vector<SimplifyLevel> levels;
+        size_t target = 0;
+        float error = 0.0f;
+        double const maxDistance = (double)maxError * glm::sqrt( mExtentSq );
+        double const maxCost = maxDistance * maxDistance;
+
+        while (target < targetIndexCounts.size())
+        {
+            // Snapshot every level we've reached.
+            while (target < targetIndexCounts.size() && mLiveTriangles * 3 <= targetIndexCounts[target])
+            {
+                levels.push_back( Snapshot( error ) );
+                target++;
+            }
+            if (target == targetIndexCounts.size() || mHeap.empty())
+                break;
+
+            Collapse const collapse = mHeap.top();
+            mHeap.pop();
+            if (collapse.mCost > maxCost)
+                break;
+            if (!IsCurrent( collapse ) || !CanCollapse( collapse.mFrom, collapse.mTo ))
+                continue;
+
+            // The quadric cost is an average, the surface may still have
+            // moved further than that somewhere.
+            double const distance = CollapseDistance( collapse.mFrom, collapse.mTo );
+            if (distance > maxDistance)
+                continue;
+
+            DoCollapse( collapse.mFrom, collapse.mTo );
+            error = glm::max( error, (float)(distance / glm::sqrt( mExtentSq )) );
+        }
+
+        while (levels.size() < targetIndexCounts.size())
+        {
+            levels.push_back( Snapshot( error ) );
+        }
+        return levels;
+    }
+
+private:
+    // Symmetric 4x4 error quadric, upper triangle, and the total weight of
+    // the planes summed into it.
+    struct Quadric
+    {
+        Quadric() : mWeight( 0.0 ) { memset( m, 0, sizeof( m ) ); }
+
+        static Quadric FromPlane( glm::dvec3 const& n, double const d, double const weight )
+        {
+            Quadric q;
+            q.m[0] = n.x * n.x; q.m[1] = n.x * n.y; q.m[2] = n.x * n.z; q.m[3] = n.x * d;
+            q.m[4] = n.y * n.y; q.m[5] = n.y * n.z; q.m[6] = n.y * d;
+            q.m[7] = n.z * n.z; q.m[8] = n.z * d;
+            q.m[9] = d * d;
+            for (double& v : q.m)
+            {
+                v *= weight;
+            }
+            q.mWeight = weight;
+            return q;
+        }
+
+        void operator+=( const Quadric& q )
+        {
+            for (uint32_t i = 0; i < 10; i++)
+            {
+                m[i] += q.m[i];
+            }
+            mWeight += q.mWeight;
+        }
+
+        double Evaluate( glm::dvec3 const& p ) const
+        {
+            return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x +
+                   m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y +
+                   m[7] * p.z * p.z + 2.0 * m[8] * p.z +
+                   m[9];
+        }
+
+        // Weighted mean squared distance from p to the planes.
+        double MeanSquaredDistance( glm::dvec3 const& p ) const
+        {
+            return mWeight > 0.0 ? glm::max( Evaluate( p ), 0.0 ) / mWeight : 0.0;
+        }
+
+        double m[10];
+        double mWeight;
+    };
+
+    struct Triangle
+    {
+        uint32_t mVertex[3];    // vertex indices, the output
+        double mDistance;       // furthest collapses have moved it off the original surface
+        bool mAlive;
+    };
+
+    struct Collapse
+    {
+        double mCost;
+        uint32_t mFrom;         // position class that goes away
+        uint32_t mTo;           // position class it is merged into
+        uint32_t mFromVersion;
+        uint32_t mToVersion;
+
+        bool operator<( const Collapse& c ) const { return mCost > c.mCost; }  // min heap
+    };
+
+    glm::vec3 Position( const SimplifyVertexData& vertices, uint32_t const v ) const
+    {
+        glm::vec3 p;
+        memcpy( &p, vertices.mData + v * vertices.mStride + vertices.mPositionOffset, sizeof( p ) );
+        return p;
+    }
+
+    uint32_t ClassOf( uint32_t const triangle, uint32_t const corner ) const
+    {
+        return mClass[mTriangles[triangle].mVertex[corner]];
+    }
+
+    void Setup( const SimplifyVertexData& vertices, const std::vector<uint32_t>& indices )
+    {
+        // Group vertices by exact position.
+        struct PositionHash
+        {
+            size_t operator()( const glm::vec3& p ) const
+            {
+                uint32_t bits[3];
+                memcpy( bits, &p, sizeof( bits ) );
+                return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+            }
+        };
+        std::unordered_map<glm::vec3, uint32_t, PositionHash> classOfPosition;
+        classOfPosition.reserve( vertices.mNumVertices );
+        mClass.resize( vertices.mNumVertices );
+        mPositions.clear();
+        mSeam.clear();
+        std::vector<uint32_t> firstVertex;
+        glm::vec3 minPos( FLT_MAX );
+        glm::vec3 maxPos( -FLT_MAX );
+        for (uint32_t v = 0; v < vertices.mNumVertices; v++)
+        {
+            glm::vec3 const p = Position( vertices, v );
+            auto it = classOfPosition.find( p );
+            if (it == classOfPosition.end())
+            {
+                it = classOfPosition.insert( std::make_pair( p, (uint32_t)mPositions.size() ) ).first;
+                mPositions.push_back( glm::dvec3( p ) );
+                mSeam.push_back( false );
+                firstVertex.push_back( v );
+                minPos = glm::min( minPos, p );
+                maxPos = glm::max( maxPos, p );
+            }
+            mClass[v] = it->second;
+
+            // Same position, different attributes: a seam runs through here.
+            const uint8_t* a = vertices.mData + firstVertex[it->second] * vertices.mStride + vertices.mAttributeOffset;
+            const uint8_t* b = vertices.mData + v * vertices.mStride + vertices.mAttributeOffset;
+            if (memcmp( a, b, vertices.mAttributeSize ) != 0)
+            {
+                mSeam[it->second] = true;
+            }
+        }
+        uint32_t const numClasses = (uint32_t)mPositions.size();
+        glm::vec3 const extent = maxPos - minPos;
+        mExtentSq = glm::max( (double)glm::dot( extent, extent ), 1e-12 );
+
+        // Triangles, dropping any that are already degenerate.
+        mTriangles.clear();
+        mClassTriangles.assign( numClasses, std::vector<uint32_t>() );
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            Triangle tri;
+            tri.mVertex[0] = indices[i + 0];
+            tri.mVertex[1] = indices[i + 1];
+            tri.mVertex[2] = indices[i + 2];
+            tri.mDistance = 0.0;
+            tri.mAlive = true;
+            uint32_t const a = mClass[tri.mVertex[0]];
+            uint32_t const b = mClass[tri.mVertex[1]];
+            uint32_t const c = mClass[tri.mVertex[2]];
+            if (a == b || b == c || a == c)
+                continue;
+            uint32_t const t = (uint32_t)mTriangles.size();
+            mTriangles.push_back( tri );
+            mClassTriangles[a].push_back( t );
+            mClassTriangles[b].push_back( t );
+            mClassTriangles[c].push_back( t );
+        }
+        mLiveTriangles = mTriangles.size();
+
+        // Lock classes on open borders and non manifold edges.
+        std::unordered_map<uint64_t, uint32_t> edgeCount;
+        edgeCount.reserve( mTriangles.size() * 3 );
+        for (uint32_t t = 0; t < mTriangles.size(); t++)
+        {
+            for (uint32_t e = 0; e < 3; e++)
+            {
+                edgeCount[EdgeKey( ClassOf( t, e ), ClassOf( t, (e + 1) % 3 ) )]++;
+            }
+        }
+        mLocked.assign( numClasses, false );
+        for (const auto& edge : edgeCount)
+        {
+            if (edge.second != 2)
+            {
+                mLocked[(uint32_t)(edge.first >> 32)] = true;
+                mLocked[(uint32_t)(edge.first & 0xffffffffu)] = true;
+            }
+        }
+
+        // Area weighted plane quadrics.
+        mQuadrics.assign( numClasses, Quadric() );
+        for (uint32_t t = 0; t < mTriangles.size(); t++)
+        {
+            glm::dvec3 const& p0 = mPositions[ClassOf( t, 0 )];
+            glm::dvec3 const& p1 = mPositions[ClassOf( t, 1 )];
+            glm::dvec3 const& p2 = mPositions[ClassOf( t, 2 )];
+            glm::dvec3 const cross = glm::cross( p1 - p0, p2 - p0 );
+            double const length = glm::length( cross );
+            if (length <= 0.0)
+                continue;
+            glm::dvec3 const normal = cross / length;
+            Quadric const q = Quadric::FromPlane( normal, -glm::dot( normal, p0 ), length * 0.5 );
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                mQuadrics[ClassOf( t, c )] += q;
+            }
+        }
+
+        // Every edge in both directions.
+        mVersion.assign( numClasses, 0 );
+        mRemoved.assign( numClasses, false );
+        mHeap = std::priority_queue<Collapse>();
+        for (uint32_t t = 0; t < mTriangles.size(); t++)
+        {
+            for (uint32_t e = 0; e < 3; e++)
+            {
+                PushCollapse( ClassOf( t, e ), ClassOf( t, (e + 1) % 3 ) );
+                PushCollapse( ClassOf( t, (e + 1) % 3 ), ClassOf( t, e ) );
+            }
+        }
+    }
+
+    static uint64_t EdgeKey( uint32_t const a, uint32_t const b )
+    {
+        return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+    }
+
+    void PushCollapse( uint32_t const from, uint32_t const to )
+    {
+        if (mLocked[from] || mSeam[from])
+            return;
+
+        Quadric q = mQuadrics[from];
+        q += mQuadrics[to];
+        Collapse collapse;
+        collapse.mCost = q.MeanSquaredDistance( mPositions[to] );
+        collapse.mFrom = from;
+        collapse.mTo = to;
+        collapse.mFromVersion = mVersion[from];
+        collapse.mToVersion = mVersion[to];
+        mHeap.push( collapse );
+    }
+
+    bool IsCurrent( const Collapse& collapse ) const
+    {
+        return !mRemoved[collapse.mFrom] && !mRemoved[collapse.mTo] &&
+               mVersion[collapse.mFrom] == collapse.mFromVersion &&
+               mVersion[collapse.mTo] == collapse.mToVersion;
+    }
+
+    bool Contains( uint32_t const triangle, uint32_t const cls ) const
+    {
+        return ClassOf( triangle, 0 ) == cls || ClassOf( triangle, 1 ) == cls || ClassOf( triangle, 2 ) == cls;
+    }
+
+    // How far moving 'from' onto 'to' takes triangle t off its own plane,
+    // the other two corners stay on it.
+    double PlaneDistance( uint32_t const t, uint32_t const from, uint32_t const to ) const
+    {
+        glm::dvec3 const& p0 = mPositions[ClassOf( t, 0 )];
+        glm::dvec3 const cross = glm::cross( mPositions[ClassOf( t, 1 )] - p0, mPositions[ClassOf( t, 2 )] - p0 );
+        double const length = glm::length( cross );
+        if (length <= 0.0)
+            return glm::length( mPositions[to] - mPositions[from] );
+        return glm::abs( glm::dot( cross, mPositions[to] - mPositions[from] ) ) / length;
+    }
+
+    // Furthest any triangle that survives the collapse ends up from the
+    // original surface.
+    double CollapseDistance( uint32_t const from, uint32_t const to ) const
+    {
+        double distance = 0.0;
+        for (uint32_t t : mClassTriangles[from])
+        {
+            if (!mTriangles[t].mAlive || Contains( t, to ))
+                continue;
+            distance = glm::max( distance, mTriangles[t].mDistance + PlaneDistance( t, from, to ) );
+        }
+        return distance;
+    }
+
+    bool CanCollapse( uint32_t const from, uint32_t const to )
+    {
+        // Link condition: the only neighbours from and to may share are the
+        // apexes of the triangles on their common edge, otherwise the
+        // collapse would pinch the surface.
+        mNeighbours.clear();
+        uint32_t sharedTriangles = 0;
+        for (uint32_t t : mClassTriangles[from])
+        {
+            if (!mTriangles[t].mAlive)
+                continue;
+            sharedTriangles += Contains( t, to ) ? 1 : 0;
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t const cls = ClassOf( t, c );
+                if (cls != from && cls != to)
+                    mNeighbours.push_back( cls );
+            }
+        }
+        if (sharedTriangles == 0)
+            return false;
+        std::sort( mNeighbours.begin(), mNeighbours.end() );
+        mNeighbours.erase( std::unique( mNeighbours.begin(), mNeighbours.end() ), mNeighbours.end() );
+
+        uint32_t sharedNeighbours = 0;
+        mToNeighbours.clear();
+        for (uint32_t t : mClassTriangles[to])
+        {
+            if (!mTriangles[t].mAlive)
+                continue;
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t const cls = ClassOf( t, c );
+                if (cls != from && cls != to)
+                    mToNeighbours.push_back( cls );
+            }
+        }
+        std::sort( mToNeighbours.begin(), mToNeighbours.end() );
+        mToNeighbours.erase( std::unique( mToNeighbours.begin(), mToNeighbours.end() ), mToNeighbours.end() );
+        for (uint32_t cls : mToNeighbours)
+        {
+            sharedNeighbours += std::binary_search( mNeighbours.begin(), mNeighbours.end(), cls ) ? 1 : 0;
+        }
+        if (sharedNeighbours > sharedTriangles)
+            return false;
+
+        // Don't flip or squash any of the triangles that survive.
+        for (uint32_t t : mClassTriangles[from])
+        {
+            if (!mTriangles[t].mAlive || Contains( t, to ))
+                continue;
+
+            glm::dvec3 p[3];
+            glm::dvec3 q[3];
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t const cls = ClassOf( t, c );
+                p[c] = mPositions[cls];
+                q[c] = cls == from ? mPositions[to] : p[c];
+            }
+            glm::dvec3 const before = glm::cross( p[1] - p[0], p[2] - p[0] );
+            glm::dvec3 const after = glm::cross( q[1] - q[0], q[2] - q[0] );
+            double const lengthBefore = glm::length( before );
+            double const lengthAfter = glm::length( after );
+            if (lengthAfter <= 1e-12 * mExtentSq || glm::dot( before, after ) < 0.2 * lengthBefore * lengthAfter)
+                return false;
+        }
+        return true;
+    }
+
+    void DoCollapse( uint32_t const from, uint32_t const to )
+    {
+        // The vertex of 'to' on from's side of any seam through 'to'; from
+        // isn't on a seam, so all of its triangles agree on which one that is.
+        uint32_t toVertex = ~0u;
+        for (uint32_t t : mClassTriangles[from])
+        {
+            if (!mTriangles[t].mAlive || !Contains( t, to ))
+                continue;
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                if (ClassOf( t, c ) == to)
+                    toVertex = mTriangles[t].mVertex[c];
+            }
+            break;
+        }
+
+        for (uint32_t t : mClassTriangles[from])
+        {
+            Triangle& tri = mTriangles[t];
+            if (!tri.mAlive)
+                continue;
+            if (Contains( t, to ))
+            {
+                tri.mAlive = false;
+                mLiveTriangles--;
+                continue;
+            }
+            tri.mDistance += PlaneDistance( t, from, to );
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                if (mClass[tri.mVertex[c]] == from)
+                    tri.mVertex[c] = toVertex;
+            }
+            mClassTriangles[to].push_back( t );
+        }
+        mClassTriangles[from].clear();
+        mRemoved[from] = true;
+        mQuadrics[to] += mQuadrics[from];
+        mVersion[from]++;
+        mVersion[to]++;
+
+        // Drop dead triangles from the survivor and requeue its edges, whose
+        // cost changed with its quadric. Edges elsewhere are unaffected.
+        std::vector<uint32_t>& triangles = mClassTriangles[to];
+        triangles.erase( std::remove_if( triangles.begin(), triangles.end(), [this]( uint32_t t ) { return !mTriangles[t].mAlive; } ), triangles.end() );
+        for (uint32_t t : triangles)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t const cls = ClassOf( t, c );
+                if (cls != to)
+                {
+                    PushCollapse( cls, to );
+                    PushCollapse( to, cls );
+                }
+            }
+        }
+    }
+
+    SimplifyLevel Snapshot( float const error ) const
+    {
+        SimplifyLevel level;
+        level.mError = error;
+        level.mIndices.reserve( mLiveTriangles * 3 );
+        for (const auto& tri : mTriangles)
+        {
+            if (tri.mAlive)
+            {
+                level.mIndices.insert( level.mIndices.end(), tri.mVertex, tri.mVertex + 3 );
+            }
+        }
+        return level;
+    }
+
+    std::vector<uint32_t> mClass;                           // vertex -> position class
+    std::vector<glm::dvec3> mPositions;                     // per class
+    std::vector<bool> mSeam;
+    std::vector<bool> mLocked;
+    std::vector<bool> mRemoved;
+    std::vector<uint32_t> mVersion;
+    std::vector<Quadric> mQuadrics;
+    std::vector<Triangle> mTriangles;
+    std::vector<std::vector<uint32_t>> mClassTriangles;     // class -> triangles using it
+    std::priority_queue<Collapse> mHeap;
+    std::vector<uint32_t> mNeighbours;
+    std::vector<uint32_t> mToNeighbours;
+    size_t mLiveTriangles;
+    double mExtentSq;
+};
+
+//=============================================================================
+
+#endif
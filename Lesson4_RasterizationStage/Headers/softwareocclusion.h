@@ -0,0 +1,460 @@
+//=============================================================================
+// Software Occlusion Culling
+//
+// Rasterizes a handful of occluder meshes into a small CPU depth buffer and
+// tests bounding boxes against it before any GL work is issued. Nothing in
+// here touches the GL, so it runs (and can be tested) without a GPU.
+//
+// Depth is stored as 1/w, which interpolates linearly in screen space and
+// grows towards the camera; the buffer is cleared to 0 (infinitely far).
+// The buffer is split into tiles that also keep the farthest depth they
+// contain, so most box tests are answered by a few tile lookups.
+//
+// Rasterization is split into horizontal bands of tiles, each band is
+// rasterized by one job, so no two threads ever write the same pixel.
+//=============================================================================
+
+#ifndef SOFTWAREOCCLUSION_H
+#define SOFTWAREOCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <bounds.h>
+#include <jobsystem.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(BOUNDS_USE_SSE)
+#include <xmmintrin.h>
+#endif
+
+//=============================================================================
+
+// Triangle soup used as an occluder. Must lie inside the object it stands
+// in for, or it would hide things that are actually visible: an occluder
+// made by simplifying the object's surface strays from it both ways and
+// has to go through InsetOccluder() before it is used. Counter clockwise
+// triangles face outwards, like the object's own.
+struct OccluderMesh
+{
+    std::vector<glm::vec3> mPositions;
+    std::vector<uint32_t> mIndices;
+};
+
+// Pulls every vertex of 'mesh' inwards so each of its triangles moves back
+// along its normal by at least 'distance', which has to be the most the
+// mesh strays outside the surface it approximates. Dropping triangles is
+// always safe, so those the inset can't move back far enough, or that turn
+// over on the way, are left out.
+inline void InsetOccluder( OccluderMesh& mesh, float const distance )
+{
+    if (distance <= 0.0f)
+        return;
+
+    // Area weighted vertex normals, from the occluder's own triangles.
+    std::vector<glm::vec3> faceNormals( mesh.mIndices.size() / 3 );
+    std::vector<glm::vec3> normals( mesh.mPositions.size(), glm::vec3( 0.0f ) );
+    for (size_t i = 0; i < faceNormals.size(); i++)
+    {
+        const uint32_t* const triangle = &mesh.mIndices[i * 3];
+        glm::vec3 const normal = glm::cross( mesh.mPositions[triangle[1]] - mesh.mPositions[triangle[0]],
+                                             mesh.mPositions[triangle[2]] - mesh.mPositions[triangle[0]] );
+        float const length = glm::length( normal );
+        faceNormals[i] = length > 0.0f ? normal / length : glm::vec3( 0.0f );
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+            normals[triangle[corner]] += normal;
+        }
+    }
+    for (auto& normal : normals)
+    {
+        float const length = glm::length( normal );
+        normal = length > 0.0f ? normal / length : glm::vec3( 0.0f );
+    }
+
+    // A vertex between faces at an angle has to go further than 'distance'
+    // for every one of them to move back that far. Past a point (about 75
+    // degrees off the averaged normal) the faces it leaves behind are
+    // dropped instead.
+    float const minCosine = 0.25f;
+    std::vector<float> cosines( mesh.mPositions.size(), 1.0f );
+    for (size_t i = 0; i < faceNormals.size(); i++)
+    {
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+            uint32_t const v = mesh.mIndices[i * 3 + corner];
+            cosines[v] = std::min( cosines[v], std::max( glm::dot( normals[v], faceNormals[i] ), minCosine ) );
+        }
+    }
+
+    std::vector<glm::vec3> positions( mesh.mPositions.size() );
+    for (size_t v = 0; v < positions.size(); v++)
+    {
+        positions[v] = mesh.mPositions[v] - normals[v] * (distance / cosines[v]);
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve( mesh.mIndices.size() );
+    for (size_t i = 0; i < faceNormals.size(); i++)
+    {
+        const uint32_t* const triangle = &mesh.mIndices[i * 3];
+        bool keep = glm::dot( faceNormals[i], faceNormals[i] ) > 0.0f;
+        for (uint32_t corner = 0; corner < 3 && keep; corner++)
+        {
+            keep = glm::dot( normals[triangle[corner]], faceNormals[i] ) >= minCosine;
+        }
+        glm::vec3 const normal = glm::cross( positions[triangle[1]] - positions[triangle[0]], positions[triangle[2]] - positions[triangle[0]] );
+        if (keep && glm::dot( normal, faceNormals[i] ) > 0.0f)
+        {
+            indices.insert( indices.end(), triangle, triangle + 3 );
+        }
+    }
+    mesh.mPositions.swap( positions );
+    mesh.mIndices.swap( indices );
+}
+
+//=============================================================================
+
+struct SoftwareOcclusionStats
+{
+    uint32_t mOccluders;
+    uint32_t mTriangles;
+    uint32_t mTested;
+    uint32_t mOccluded;
+};
+
+//=============================================================================
+
+class SoftwareOcclusion
+{
+public:
+    static uint32_t const WIDTH = 256;
+    static uint32_t const HEIGHT = 192;
+    static uint32_t const TILE_WIDTH = 8;
+    static uint32_t const TILE_HEIGHT = 8;
+    static uint32_t const TILES_X = WIDTH / TILE_WIDTH;
+    static uint32_t const TILES_Y = HEIGHT / TILE_HEIGHT;
+
+    SoftwareOcclusion():
+        mDepth( WIDTH * HEIGHT, 0.0f ),
+        mTileDepth( TILES_X * TILES_Y, 0.0f ),
+        mNearClip( 0.1f )
+    {
+        mStats = SoftwareOcclusionStats();
+    }
+
+    const SoftwareOcclusionStats& GetStats() const { return mStats; }
+
+    // Starts a new frame. nearClip is the near plane distance, geometry in front of it is ignored.
+    void Begin( const glm::mat4& viewProjection, float const nearClip )
+    {
+        mViewProjection = viewProjection;
+        mNearClip = nearClip;
+        mOccluders.clear();
+        mStats = SoftwareOcclusionStats();
+    }
+
+    void AddOccluder( const OccluderMesh* mesh, const glm::mat4& transform )
+    {
+        if (mesh == nullptr || mesh->mIndices.empty())
+            return;
+
+        Occluder occluder;
+        occluder.mMesh = mesh;
+        occluder.mTransform = transform;
+        mOccluders.push_back( occluder );
+    }
+
+    // Transforms all occluders and rasterizes them, spread over the job system when one is given.
+    void Rasterize( JobSystem* jobs )
+    {
+        // Transform and set up triangles, one job per occluder.
+        mOccluderTriangles.resize( mOccluders.size() );
+        auto setup = [this]( uint32_t const i ) { SetupTriangles( mOccluders[i], mOccluderTriangles[i] ); };
+        if (jobs != nullptr)
+        {
+            jobs->ParallelFor( (uint32_t)mOccluders.size(), setup );
+        }
+        else
+        {
+            for (uint32_t i = 0; i < mOccluders.size(); i++)
+            {
+                setup( i );
+            }
+        }
+
+        mTriangles.clear();
+        for (const auto& triangles : mOccluderTriangles)
+        {
+            mTriangles.insert( mTriangles.end(), triangles.begin(), triangles.end() );
+        }
+        mStats.mOccluders = (uint32_t)mOccluders.size();
+        mStats.mTriangles = (uint32_t)mTriangles.size();
+
+        // Clear, rasterize and build the tile depths, one job per band of tiles.
+        auto band = [this]( uint32_t const tileY ) { RasterizeBand( tileY ); };
+        if (jobs != nullptr)
+        {
+            jobs->ParallelFor( TILES_Y, band );
+        }
+        else
+        {
+            for (uint32_t tileY = 0; tileY < TILES_Y; tileY++)
+            {
+                band( tileY );
+            }
+        }
+    }
+
+    // Returns false only if the box is certainly hidden behind the occluders.
+    bool IsVisible( const BoundingBox& box )
+    {
+        mStats.mTested++;
+
+        // Project the corners. The nearest point of a box is one of its corners.
+        glm::vec2 screenMin( FLT_MAX );
+        glm::vec2 screenMax( -FLT_MAX );
+        float nearestDepth = 0.0f;
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            glm::vec3 const corner( (i & 1) ? box.mMax.x : box.mMin.x,
+                                    (i & 2) ? box.mMax.y : box.mMin.y,
+                                    (i & 4) ? box.mMax.z : box.mMin.z );
+            glm::vec4 const clip = mViewProjection * glm::vec4( corner, 1.0f );
+            if (clip.w < mNearClip)
+                return true;    // crosses the near plane, can't say anything useful
+
+            float const invW = 1.0f / clip.w;
+            glm::vec2 const screen = ToScreen( clip, invW );
+            screenMin = glm::min( screenMin, screen );
+            screenMax = glm::max( screenMax, screen );
+            nearestDepth = glm::max( nearestDepth, invW );
+        }
+
+        int const x0 = glm::max( (int)glm::floor( screenMin.x ), 0 );
+        int const y0 = glm::max( (int)glm::floor( screenMin.y ), 0 );
+        int const x1 = glm::min( (int)glm::ceil( screenMax.x ), (int)WIDTH - 1 );
+        int const y1 = glm::min( (int)glm::ceil( screenMax.y ), (int)HEIGHT - 1 );
+        if (x0 > x1 || y0 > y1)
+            return true;    // off screen, leave it to the frustum test
+
+        // Any tile whose farthest depth isn't in front of the box needs a closer look at its pixels.
+        for (int tileY = y0 / (int)TILE_HEIGHT; tileY <= y1 / (int)TILE_HEIGHT; tileY++)
+        {
+            for (int tileX = x0 / (int)TILE_WIDTH; tileX <= x1 / (int)TILE_WIDTH; tileX++)
+            {
+                if (mTileDepth[tileY * TILES_X + tileX] > nearestDepth)
+                    continue;
+
+                int const px0 = glm::max( x0, tileX * (int)TILE_WIDTH );
+                int const py0 = glm::max( y0, tileY * (int)TILE_HEIGHT );
+                int const px1 = glm::min( x1, (tileX + 1) * (int)TILE_WIDTH - 1 );
+                int const py1 = glm::min( y1, (tileY + 1) * (int)TILE_HEIGHT - 1 );
+                for (int y = py0; y <= py1; y++)
+                {
+                    for (int x = px0; x <= px1; x++)
+                    {
+                        if (mDepth[y * WIDTH + x] <= nearestDepth)
+                            return true;
+                    }
+                }
+            }
+        }
+
+        mStats.mOccluded++;
+        return false;
+    }
+
+    // Read access for debugging and tests.
+    float GetDepth( uint32_t const x, uint32_t const y ) const { return mDepth[y * WIDTH + x]; }
+
+private:
+    struct Occluder
+    {
+        const OccluderMesh* mMesh;
+        glm::mat4 mTransform;
+    };
+
+    // A screen space triangle with its edge and depth equations.
+    struct Triangle
+    {
+        float mMinX, mMinY, mMaxX, mMaxY;
+        float mEdgeA[3], mEdgeB[3], mEdgeC[3];  // E(x, y) = A * x + B * y + C, >= 0 inside
+        float mDepthA, mDepthB, mDepthC;        // 1/w(x, y) = A * x + B * y + C
+    };
+
+    glm::vec2 ToScreen( const glm::vec4& clip, float const invW ) const
+    {
+        return glm::vec2( (clip.x * invW * 0.5f + 0.5f) * (float)WIDTH,
+                          (clip.y * invW * 0.5f + 0.5f) * (float)HEIGHT );
+    }
+
+    void SetupTriangles( const Occluder& occluder, std::vector<Triangle>& triangles ) const
+    {
+        const OccluderMesh& mesh = *occluder.mMesh;
+        glm::mat4 const transform = mViewProjection * occluder.mTransform;
+
+        // Transform each vertex once. w < near marks vertices we can't project.
+        std::vector<glm::vec3> screen( mesh.mPositions.size() );
+        for (size_t i = 0; i < mesh.mPositions.size(); i++)
+        {
+            glm::vec4 const clip = transform * glm::vec4( mesh.mPositions[i], 1.0f );
+            if (clip.w < mNearClip)
+            {
+                screen[i] = glm::vec3( 0.0f, 0.0f, -1.0f );
+                continue;
+            }
+            float const invW = 1.0f / clip.w;
+            screen[i] = glm::vec3( ToScreen( clip, invW ), invW );
+        }
+
+        triangles.clear();
+        for (size_t i = 0; i + 2 < mesh.mIndices.size(); i += 3)
+        {
+            glm::vec3 const& v0 = screen[mesh.mIndices[i + 0]];
+            glm::vec3 const& v1 = screen[mesh.mIndices[i + 1]];
+            glm::vec3 const& v2 = screen[mesh.mIndices[i + 2]];
+
+            // Dropping triangles that cross the near plane only makes the occluder smaller.
+            if (v0.z < 0.0f || v1.z < 0.0f || v2.z < 0.0f)
+                continue;
+
+            // Counter clockwise is front facing, back faces and slivers are skipped.
+            float const area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+            if (area <= 0.0f)
+                continue;
+
+            Triangle tri;
+            tri.mMinX = glm::max( glm::min( glm::min( v0.x, v1.x ), v2.x ), 0.0f );
+            tri.mMinY = glm::max( glm::min( glm::min( v0.y, v1.y ), v2.y ), 0.0f );
+            tri.mMaxX = glm::min( glm::max( glm::max( v0.x, v1.x ), v2.x ), (float)WIDTH );
+            tri.mMaxY = glm::min( glm::max( glm::max( v0.y, v1.y ), v2.y ), (float)HEIGHT );
+            if (tri.mMinX > tri.mMaxX || tri.mMinY > tri.mMaxY)
+                continue;
+
+            // Edge i is opposite vertex i, positive on the inside.
+            const glm::vec3* v[3] = { &v0, &v1, &v2 };
+            for (uint32_t e = 0; e < 3; e++)
+            {
+                glm::vec3 const& a = *v[(e + 1) % 3];
+                glm::vec3 const& b = *v[(e + 2) % 3];
+                tri.mEdgeA[e] = a.y - b.y;
+                tri.mEdgeB[e] = b.x - a.x;
+                tri.mEdgeC[e] = a.x * b.y - a.y * b.x;
+            }
+
+            // Barycentric interpolation of 1/w as a plane equation.
+            float const invArea = 1.0f / area;
+            tri.mDepthA = (tri.mEdgeA[0] * v0.z + tri.mEdgeA[1] * v1.z + tri.mEdgeA[2] * v2.z) * invArea;
+            tri.mDepthB = (tri.mEdgeB[0] * v0.z + tri.mEdgeB[1] * v1.z + tri.mEdgeB[2] * v2.z) * invArea;
+            tri.mDepthC = (tri.mEdgeC[0] * v0.z + tri.mEdgeC[1] * v1.z + tri.mEdgeC[2] * v2.z) * invArea;
+            triangles.push_back( tri );
+        }
+    }
+
+    void RasterizeBand( uint32_t const tileY )
+    {
+        int const bandMinY = (int)(tileY * TILE_HEIGHT);
+        int const bandMaxY = bandMinY + (int)TILE_HEIGHT - 1;
+        std::fill( mDepth.begin() + bandMinY * WIDTH, mDepth.begin() + (bandMaxY + 1) * WIDTH, 0.0f );
+
+        for (const auto& tri : mTriangles)
+        {
+            int const y0 = glm::max( (int)glm::ceil( tri.mMinY - 0.5f ), bandMinY );
+            int const y1 = glm::min( (int)glm::floor( tri.mMaxY - 0.5f ), bandMaxY );
+            if (y0 > y1)
+                continue;
+
+            // Start on a multiple of four so SIMD stores stay within the row.
+            int const x0 = glm::max( (int)glm::ceil( tri.mMinX - 0.5f ), 0 ) & ~3;
+            int const x1 = glm::min( (int)glm::floor( tri.mMaxX - 0.5f ), (int)WIDTH - 1 );
+            if (x0 > x1)
+                continue;
+
+            for (int y = y0; y <= y1; y++)
+            {
+                RasterizeSpan( tri, y, x0, x1 );
+            }
+        }
+
+        // Farthest depth per tile.
+        for (uint32_t tileX = 0; tileX < TILES_X; tileX++)
+        {
+            float farthest = FLT_MAX;
+            for (int y = bandMinY; y <= bandMaxY; y++)
+            {
+                const float* row = &mDepth[y * WIDTH + tileX * TILE_WIDTH];
+                for (uint32_t x = 0; x < TILE_WIDTH; x++)
+                {
+                    farthest = glm::min( farthest, row[x] );
+                }
+            }
+            mTileDepth[tileY * TILES_X + tileX] = farthest;
+        }
+    }
+
+    // Rasterizes pixels [x0, x1] of row y, sampling at pixel centers.
+    void RasterizeSpan( const Triangle& tri, int const y, int const x0, int const x1 )
+    {
+        float const py = (float)y + 0.5f;
+        float* row = &mDepth[y * WIDTH];
+
+#if defined(BOUNDS_USE_SSE)
+        __m128 const offsets = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+        __m128 edgeA[3];
+        __m128 edgeRow[3];
+        for (uint32_t e = 0; e < 3; e++)
+        {
+            edgeA[e] = _mm_set1_ps( tri.mEdgeA[e] );
+            edgeRow[e] = _mm_set1_ps( tri.mEdgeB[e] * py + tri.mEdgeC[e] );
+        }
+        __m128 const depthA = _mm_set1_ps( tri.mDepthA );
+        __m128 const depthRow = _mm_set1_ps( tri.mDepthB * py + tri.mDepthC );
+        __m128 const zero = _mm_setzero_ps();
+
+        for (int x = x0; x <= x1; x += 4)
+        {
+            __m128 const px = _mm_add_ps( _mm_set1_ps( (float)x ), offsets );
+            __m128 inside = _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( edgeA[0], px ), edgeRow[0] ), zero );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( edgeA[1], px ), edgeRow[1] ), zero ) );
+            inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( edgeA[2], px ), edgeRow[2] ), zero ) );
+            if (_mm_movemask_ps( inside ) == 0)
+                continue;
+
+            __m128 const depth = _mm_add_ps( _mm_mul_ps( depthA, px ), depthRow );
+            __m128 const current = _mm_loadu_ps( row + x );
+            __m128 const closer = _mm_max_ps( current, depth );
+            _mm_storeu_ps( row + x, _mm_or_ps( _mm_and_ps( inside, closer ), _mm_andnot_ps( inside, current ) ) );
+        }
+#else
+        for (int x = x0; x <= x1; x++)
+        {
+            float const px = (float)x + 0.5f;
+            bool inside = true;
+            for (uint32_t e = 0; e < 3; e++)
+            {
+                inside = inside && (tri.mEdgeA[e] * px + tri.mEdgeB[e] * py + tri.mEdgeC[e]) >= 0.0f;
+            }
+            if (inside)
+            {
+                row[x] = glm::max( row[x], tri.mDepthA * px + tri.mDepthB * py + tri.mDepthC );
+            }
+        }
+#endif
+    }
+
+    glm::mat4 mViewProjection;
+    std::vector<float> mDepth;
+    std::vector<float> mTileDepth;
+    std::vector<Occluder> mOccluders;
+    std::vector<std::vector<Triangle>> mOccluderTriangles;
+    std::vector<Triangle> mTriangles;
+    float mNearClip;
+    SoftwareOcclusionStats mStats;
+};
+
+//=============================================================================
+
+#endif
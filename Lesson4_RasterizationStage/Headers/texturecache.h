@@ -0,0 +1,320 @@
+//=============================================================================
+// Texture Cache
+//
+// Block compressed copies of image files, cooked the first time an image
+// is loaded and kept next to it as <image>.bc, or <image>.srgb.bc for
+// colour maps (one image can be both, a colour map in one material and a
+// bump map in another, and each needs its own file). Cooking builds the whole
+// mip chain on the CPU with stb_image_resize, filtering colour maps in
+// linear light rather than on their sRGB values, and encodes every level
+// with stb_dxt: BC1 for images without alpha, BC3 for those with. A cache
+// file is a Header followed by the levels back to back, largest first,
+// exactly as glCompressedTexSubImage2D wants them, so loading one is just
+// a read.
+//
+// A cache file is used only while the image's size and modification time
+// match the ones recorded in it.
+//
+// The same cooking also serves texture array layers (see materialpacker.h),
+// which may have to be resized to the array's size first, and drivers
+// without S3TC, which get the mip chain as plain RGBA8.
+//=============================================================================
+
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <glad/glad.h>
+#include <stb_dxt.h>
+#include <stb_image.h>
+#include <stb_image_resize.h>
+
+#include <fileutils.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//=============================================================================
+
+class TextureCache
+{
+public:
+    enum Format
+    {
+        FORMAT_NONE = 0,
+        FORMAT_BC1 = 1,     // 8 bytes per 4x4 block, RGB
+        FORMAT_BC3 = 3,     // 16 bytes per 4x4 block, RGBA
+        FORMAT_RGBA8 = 4,   // uncompressed, never written to cache files
+    };
+
+    struct Header
+    {
+        uint32_t mMagic;
+        uint32_t mVersion;
+        uint64_t mSourceSize;
+        uint64_t mSourceTime;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mLevels;
+        uint32_t mFormat;
+        uint32_t mColor;        // mips were filtered as sRGB
+        uint32_t mDataSize;     // bytes of all levels
+    };
+
+    static uint32_t const MAGIC = 0x43425447;  // "GTBC"
+    static uint32_t const VERSION = 1;
+
+    // The driver has to be able to sample BC1 and BC3.
+    static bool IsSupported() { return GLAD_GL_EXT_texture_compression_s3tc != 0; }
+
+    static std::string GetPath( const std::string& source, bool const color ) { return source + (color ? ".srgb.bc" : ".bc"); }
+
+    static GLenum GetInternalFormat( uint32_t const format )
+    {
+        switch (format)
+        {
+        case FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case FORMAT_RGBA8: return GL_RGBA8;
+        default: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        }
+    }
+
+    static bool IsCompressed( uint32_t const format ) { return format == FORMAT_BC1 || format == FORMAT_BC3; }
+
+    static uint32_t GetLevelWidth( const Header& header, uint32_t const level ) { return std::max( header.mWidth >> level, 1u ); }
+    static uint32_t GetLevelHeight( const Header& header, uint32_t const level ) { return std::max( header.mHeight >> level, 1u ); }
+
+    static uint32_t GetLevelSize( const Header& header, uint32_t const level )
+    {
+        if (header.mFormat == FORMAT_RGBA8)
+            return GetLevelWidth( header, level ) * GetLevelHeight( header, level ) * 4;
+
+        uint32_t const blocks = ((GetLevelWidth( header, level ) + 3) / 4) * ((GetLevelHeight( header, level ) + 3) / 4);
+        return blocks * (header.mFormat == FORMAT_BC3 ? 16 : 8);
+    }
+
+    // Where a level starts in the data, or the size of the data for mLevels.
+    static uint32_t GetLevelOffset( const Header& header, uint32_t const level )
+    {
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < level; i++)
+        {
+            offset += GetLevelSize( header, i );
+        }
+        return offset;
+    }
+
+    // Describes the cache file an image of the given size would cook to.
+    // Returns false if the image can't be found.
+    static bool MakeHeader( const std::string& source, uint32_t const width, uint32_t const height, int const components, bool const color, Header& header )
+    {
+        memset( &header, 0, sizeof( header ) );
+        if (!StatSource( source, header ))
+            return false;
+
+        SetLayout( width, height, (components == 2 || components == 4) ? FORMAT_BC3 : FORMAT_BC1, color, header );
+        return true;
+    }
+
+    // Fills in everything about the levels of 'header': a full mip chain
+    // of a width x height image.
+    static void SetLayout( uint32_t const width, uint32_t const height, uint32_t const format, bool const color, Header& header )
+    {
+        header.mMagic = MAGIC;
+        header.mVersion = VERSION;
+        header.mWidth = width;
+        header.mHeight = height;
+        header.mLevels = 1;
+        for (uint32_t size = std::max( width, height ); size > 1; size >>= 1)
+        {
+            header.mLevels++;
+        }
+        header.mFormat = format;
+        header.mColor = color ? 1 : 0;
+        header.mDataSize = GetLevelOffset( header, header.mLevels );
+    }
+
+    // Reads the header of the cache file for 'source' if there is an up to date one.
+    static bool ReadHeader( const std::string& source, bool const color, Header& header )
+    {
+        Header expected;
+        memset( &expected, 0, sizeof( expected ) );
+        if (!StatSource( source, expected ))
+            return false;
+
+        std::ifstream file( GetPath( source, color ), std::ios::binary );
+        if (!file.read( (char*)&header, sizeof( header ) ))
+            return false;
+
+        return header.mMagic == MAGIC && header.mVersion == VERSION && header.mSourceSize == expected.mSourceSize &&
+               header.mSourceTime == expected.mSourceTime && header.mColor == (color ? 1u : 0u) && header.mLevels > 0;
+    }
+
+    // Reads levels [firstLevel, endLevel) of a cache file ReadHeader() accepted into 'data'.
+    static bool ReadData( const std::string& source, const Header& header, uint32_t const firstLevel, uint32_t const endLevel, unsigned char* data )
+    {
+        std::ifstream file( GetPath( source, header.mColor != 0 ), std::ios::binary );
+        Header check;
+        if (!file.read( (char*)&check, sizeof( check ) ) || memcmp( &check, &header, sizeof( header ) ) != 0)
+            return false;
+
+        uint32_t const offset = GetLevelOffset( header, firstLevel );
+        return (bool)file.seekg( sizeof( header ) + offset ) && (bool)file.read( (char*)data, GetLevelOffset( header, endLevel ) - offset );
+    }
+
+    // Decodes 'source', builds and compresses its mip chain as laid out by
+    // 'header', writes the cache file and copies levels from firstLevel on
+    // into 'data'. Safe to run off the main thread. Only fails if the image
+    // no longer matches 'header'; not being able to write the cache file
+    // just means cooking again next time.
+    static bool Cook( const std::string& source, const Header& header, uint32_t const firstLevel, unsigned char* data )
+    {
+        int width, height, components;
+        unsigned char* pixels = stbi_load( source.c_str(), &width, &height, &components, 4 );
+        if (pixels == nullptr || (uint32_t)width != header.mWidth || (uint32_t)height != header.mHeight)
+        {
+            stbi_image_free( pixels );
+            return false;
+        }
+
+        // Compress into memory we can read back, 'data' may be write only.
+        std::vector<unsigned char> level( pixels, pixels + (size_t)width * height * 4 );
+        std::vector<unsigned char> levels;
+        stbi_image_free( pixels );
+        BuildLevels( header, level, levels );
+        uint32_t const first = GetLevelOffset( header, firstLevel );
+        memcpy( data, &levels[first], header.mDataSize - first );
+
+        // Written under another name first so nobody reads half a file, one
+        // of its own since two jobs may be cooking the same image.
+        std::string const path = GetPath( source, header.mColor != 0 );
+        std::string const temporary = GetTemporaryPath( path );
+        {
+            std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+            file.write( (const char*)&header, sizeof( header ) );
+            file.write( (const char*)&levels[0], header.mDataSize );
+            if (!file)
+            {
+                file.close();
+                std::remove( temporary.c_str() );
+                return true;
+            }
+        }
+        if (!RenameOver( temporary, path ))
+        {
+            std::remove( temporary.c_str() );
+        }
+        return true;
+    }
+
+    // Like Cook(), for when 'header' needn't describe 'source' itself: the
+    // image is resized to the header's size first and no cache file is written.
+    static bool CookResized( const std::string& source, const Header& header, unsigned char* data )
+    {
+        int width, height, components;
+        unsigned char* pixels = stbi_load( source.c_str(), &width, &height, &components, 4 );
+        if (pixels == nullptr)
+            return false;
+
+        std::vector<unsigned char> level( (size_t)header.mWidth * header.mHeight * 4 );
+        if ((uint32_t)width == header.mWidth && (uint32_t)height == header.mHeight)
+        {
+            memcpy( &level[0], pixels, level.size() );
+        }
+        else
+        {
+            Resize( header, pixels, (uint32_t)width, (uint32_t)height, &level[0], header.mWidth, header.mHeight );
+        }
+        stbi_image_free( pixels );
+
+        std::vector<unsigned char> levels;
+        BuildLevels( header, level, levels );
+        memcpy( data, &levels[0], header.mDataSize );
+        return true;
+    }
+
+private:
+    // Filters an RGBA image the way the header's levels are filtered. The
+    // textures repeat, so do the filters.
+    static void Resize( const Header& header, const unsigned char* src, uint32_t const srcWidth, uint32_t const srcHeight,
+                        unsigned char* dst, uint32_t const dstWidth, uint32_t const dstHeight )
+    {
+        bool const alpha = header.mFormat != FORMAT_BC1;
+        stbir_resize_uint8_generic( src, (int)srcWidth, (int)srcHeight, 0, dst, (int)dstWidth, (int)dstHeight, 0, 4, alpha ? 3 : STBIR_ALPHA_CHANNEL_NONE, 0,
+                                    STBIR_EDGE_WRAP, STBIR_FILTER_DEFAULT, header.mColor ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR, nullptr );
+    }
+
+    // Turns the RGBA top level into all of the header's levels, encoded,
+    // back to back. 'level' is used up.
+    static void BuildLevels( const Header& header, std::vector<unsigned char>& level, std::vector<unsigned char>& levels )
+    {
+        levels.resize( header.mDataSize );
+        std::vector<unsigned char> smaller;
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < header.mLevels; i++)
+        {
+            uint32_t const levelWidth = GetLevelWidth( header, i );
+            uint32_t const levelHeight = GetLevelHeight( header, i );
+            if (i > 0)
+            {
+                // Each level from the one before.
+                smaller.resize( (size_t)levelWidth * levelHeight * 4 );
+                Resize( header, &level[0], GetLevelWidth( header, i - 1 ), GetLevelHeight( header, i - 1 ), &smaller[0], levelWidth, levelHeight );
+                level.swap( smaller );
+            }
+            if (header.mFormat == FORMAT_RGBA8)
+            {
+                memcpy( &levels[offset], &level[0], GetLevelSize( header, i ) );
+            }
+            else
+            {
+                CompressLevel( &level[0], levelWidth, levelHeight, header.mFormat == FORMAT_BC3, &levels[offset] );
+            }
+            offset += GetLevelSize( header, i );
+        }
+    }
+
+    static bool StatSource( const std::string& source, Header& header )
+    {
+        struct stat info;
+        if (stat( source.c_str(), &info ) != 0)
+            return false;
+        header.mSourceSize = (uint64_t)info.st_size;
+        header.mSourceTime = (uint64_t)info.st_mtime;
+        return true;
+    }
+
+    // Encodes an RGBA image 4x4 block at a time, repeating the last row
+    // and column into blocks that hang over the edge.
+    static void CompressLevel( const unsigned char* pixels, uint32_t const width, uint32_t const height, bool const alpha, unsigned char* blocks )
+    {
+        unsigned char block[16 * 4];
+        for (uint32_t by = 0; by < height; by += 4)
+        {
+            for (uint32_t bx = 0; bx < width; bx += 4)
+            {
+                for (uint32_t y = 0; y < 4; y++)
+                {
+                    for (uint32_t x = 0; x < 4; x++)
+                    {
+                        uint32_t const px = std::min( bx + x, width - 1 );
+                        uint32_t const py = std::min( by + y, height - 1 );
+                        memcpy( &block[(y * 4 + x) * 4], &pixels[((size_t)py * width + px) * 4], 4 );
+                    }
+                }
+                stb_compress_dxt_block( blocks, block, alpha ? 1 : 0, STB_DXT_HIGHQUAL );
+                blocks += alpha ? 16 : 8;
+            }
+        }
+    }
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,573 @@
+//=============================================================================
+// Texture Loader
+//
+// Loads image files into textures with the decoding spread over the job
+// system. Load() only reads the file's header on the calling thread: that
+// is enough to allocate the texture's immutable storage (glTexStorage2D)
+// and a pixel unpack buffer of the right size, which is mapped and handed
+// to a worker. The worker decodes the file straight into the mapped
+// memory, widening RGB to RGBA on the way since three byte texels are
+// not something drivers upload quickly. Update() then unmaps the finished
+// buffers and copies them into their textures from the main thread, the
+// only one allowed to touch GL.
+//
+// Where the driver can sample BC1/BC3 the loader goes through the
+// TextureCache instead: the storage and buffer are sized for the
+// compressed mip chain, and the worker either reads it from the cache
+// file or cooks it. Either way no mips are generated at load.
+//
+// Compressed textures can also be left to a TextureStreamer, see
+// SetStreaming(). Those get mutable storage holding just the levels the
+// streamer asks for, with GL_TEXTURE_BASE_LEVEL pointing at the finest,
+// and LoadLevels() adds finer ones from the cache file later.
+//
+// LoadLayer() fills one layer of a texture array someone else allocated,
+// resizing the image to the array's size if it has to.
+//
+// Texture ids are valid as soon as Load() returns, their contents only
+// once Update() has seen them through. Finish() waits for all of them.
+// Delete() may come at any point in between, loads still running for the
+// texture then finish into nowhere. SetTimingCallback() reports how long
+// each one took on its way.
+//=============================================================================
+
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <jobsystem.h>
+#include <texturecache.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+//=============================================================================
+
+class TextureLoader
+{
+public:
+    // Decoded images waiting to be uploaded stay mapped; past this many
+    // bytes new loads wait for earlier ones to finish.
+    static uint32_t const MAX_MAPPED_BYTES = 256 << 20;
+
+    // Returns the first level to load of a new compressed texture.
+    typedef std::function<uint32_t( GLuint texture, const std::string& path, const TextureCache::Header& header )> CreateCallback;
+    // Levels from 'firstLevel' on have arrived, or failed to.
+    typedef std::function<void( GLuint texture, uint32_t firstLevel, bool succeeded )> UploadCallback;
+    // The texture is about to be deleted.
+    typedef std::function<void( GLuint texture )> DeleteCallback;
+    // A load has been uploaded: time spent decoding on a worker, uploading
+    // on this thread, and from the request to the upload all told.
+    typedef std::function<void( const std::string& path, double decodeMs, double uploadMs, double latencyMs )> TimingCallback;
+
+    TextureLoader():
+        mJobSystem( nullptr ),
+        mMappedBytes( 0 )
+    {
+    }
+
+    ~TextureLoader()
+    {
+        if (mJobSystem != nullptr)
+        {
+            // Workers may still be writing into our requests.
+            mJobSystem->Wait( mCounter );
+        }
+    }
+
+    // Without a job system everything is decoded on the calling thread.
+    void SetJobSystem( JobSystem* jobs ) { mJobSystem = jobs; }
+
+    uint32_t GetNumPending() const { return (uint32_t)(mQueued.size() + mInFlight.size()); }
+
+    // Hands the levels of compressed textures loaded from now on to the callbacks.
+    void SetStreaming( const CreateCallback& create, const UploadCallback& uploaded, const DeleteCallback& deleted )
+    {
+        mCreateCallback = create;
+        mUploadCallback = uploaded;
+        mDeleteCallback = deleted;
+    }
+
+    void SetTimingCallback( const TimingCallback& timing ) { mTimingCallback = timing; }
+
+    // Loads levels [firstLevel, endLevel) of a streamed texture from its
+    // cache file, they become the finest levels it has.
+    void LoadLevels( GLuint const texture, const std::string& path, const TextureCache::Header& header, uint32_t const firstLevel, uint32_t const endLevel )
+    {
+        std::unique_ptr<Request> request( new Request );
+        request->mPath = path;
+        request->mTexture = texture;
+        request->mCache = header;
+        request->mCached = true;
+        request->mStreamed = true;
+        request->mWidth = (int)header.mWidth;
+        request->mHeight = (int)header.mHeight;
+        request->mFirstLevel = firstLevel;
+        request->mEndLevel = endLevel;
+        request->mSize = TextureCache::GetLevelOffset( header, endLevel ) - TextureCache::GetLevelOffset( header, firstLevel );
+        mQueued.push_back( std::move( request ) );
+        Start();
+    }
+
+    // Loads the image at 'path' into 'layer' of a texture array whose
+    // storage is laid out by 'header'.
+    void LoadLayer( GLuint const texture, const std::string& path, const TextureCache::Header& header, uint32_t const layer )
+    {
+        std::unique_ptr<Request> request( new Request );
+        request->mPath = path;
+        request->mTexture = texture;
+        request->mTarget = GL_TEXTURE_2D_ARRAY;
+        request->mLayer = layer;
+        request->mCache = header;
+        request->mResize = true;
+
+        // The image's own cache file will do if it was cooked the same way.
+        TextureCache::Header own;
+        if (TextureCache::ReadHeader( path, header.mColor != 0, own ) && own.mWidth == header.mWidth && own.mHeight == header.mHeight &&
+            own.mFormat == header.mFormat && own.mLevels == header.mLevels)
+        {
+            request->mCache = own;
+            request->mCached = true;
+            request->mResize = false;
+        }
+        request->mWidth = (int)header.mWidth;
+        request->mHeight = (int)header.mHeight;
+        request->mEndLevel = header.mLevels;
+        request->mSize = header.mDataSize;
+        mQueued.push_back( std::move( request ) );
+        Start();
+    }
+
+    // Returns a texture that will hold the image at 'path', or one without
+    // storage if the file can't be read. 'color' is for images holding
+    // sRGB colours rather than data, which changes how mips are filtered.
+    GLuint Load( const std::string& path, bool const color )
+    {
+        GLuint texture;
+        glGenTextures( 1, &texture );
+
+        std::unique_ptr<Request> request( new Request );
+        request->mPath = path;
+        request->mTexture = texture;
+        if (TextureCache::IsSupported() && TextureCache::ReadHeader( path, color, request->mCache ))
+        {
+            request->mCached = true;
+            request->mWidth = (int)request->mCache.mWidth;
+            request->mHeight = (int)request->mCache.mHeight;
+            request->mSize = request->mCache.mDataSize;
+        }
+        else
+        {
+            int width, height, components;
+            if (!stbi_info( path.c_str(), &width, &height, &components ))
+            {
+                std::cout << "Texture failed to load at path: " << path << std::endl;
+                return texture;
+            }
+
+            request->mWidth = width;
+            request->mHeight = height;
+            request->mComponents = components == 3 ? 4 : components;
+            request->mSize = (uint32_t)width * (uint32_t)height * (uint32_t)request->mComponents;
+            if (TextureCache::IsSupported() && TextureCache::MakeHeader( path, (uint32_t)width, (uint32_t)height, components, color, request->mCache ))
+            {
+                request->mSize = request->mCache.mDataSize;
+            }
+        }
+
+        request->mEndLevel = request->mCache.mLevels;
+        if (request->mCache.mFormat != TextureCache::FORMAT_NONE && mCreateCallback)
+        {
+            request->mStreamed = true;
+            request->mFirstLevel = std::min( mCreateCallback( texture, path, request->mCache ), request->mCache.mLevels - 1 );
+            request->mSize -= TextureCache::GetLevelOffset( request->mCache, request->mFirstLevel );
+            glBindTexture( GL_TEXTURE_2D, texture );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)request->mCache.mLevels - 1 );
+            SetParameters();
+            glBindTexture( GL_TEXTURE_2D, 0 );
+        }
+        else
+        {
+            AllocateStorage( *request );
+        }
+        mQueued.push_back( std::move( request ) );
+
+        Update();
+        return texture;
+    }
+
+    // Deletes a texture Load() returned, along with whatever is still to
+    // be uploaded into it.
+    void Delete( GLuint const texture )
+    {
+        mQueued.erase( std::remove_if( mQueued.begin(), mQueued.end(), [texture]( const std::unique_ptr<Request>& request ) { return request->mTexture == texture; } ),
+                       mQueued.end() );
+
+        // Workers may be writing into these, Update() frees them once they're done.
+        for (auto& request : mInFlight)
+        {
+            if (request->mTexture == texture)
+            {
+                request->mCancelled = true;
+            }
+        }
+
+        if (mDeleteCallback)
+        {
+            mDeleteCallback( texture );
+        }
+        glDeleteTextures( 1, &texture );
+    }
+
+    // Uploads whatever has finished decoding and starts queued decodes as
+    // mapped memory frees up. Binds textures and unpack buffers.
+    void Update()
+    {
+        for (size_t i = 0; i < mInFlight.size();)
+        {
+            if (!mInFlight[i]->mDecoded.load( std::memory_order_acquire ))
+            {
+                i++;
+                continue;
+            }
+            Upload( *mInFlight[i] );
+            mMappedBytes -= mInFlight[i]->mSize;
+            mInFlight[i] = std::move( mInFlight.back() );
+            mInFlight.pop_back();
+        }
+        Start();
+    }
+
+    // Waits for every load so far to be decoded and uploaded, helping with
+    // the decoding meanwhile.
+    void Finish()
+    {
+        while (!mQueued.empty() || !mInFlight.empty())
+        {
+            if (mJobSystem != nullptr)
+            {
+                mJobSystem->Wait( mCounter );
+            }
+            Update();
+        }
+    }
+
+private:
+    struct Request
+    {
+        Request():
+            mTexture( 0 ),
+            mTarget( GL_TEXTURE_2D ),
+            mLayer( 0 ),
+            mBuffer( 0 ),
+            mDestination( nullptr ),
+            mFirstLevel( 0 ),
+            mEndLevel( 0 ),
+            mCached( false ),
+            mStreamed( false ),
+            mResize( false ),
+            mCancelled( false ),
+            mDecoded( false ),
+            mSucceeded( false ),
+            mRequested( std::chrono::steady_clock::now() ),
+            mDecodeMs( 0.0 )
+        {
+            memset( &mCache, 0, sizeof( mCache ) );
+        }
+
+        std::string mPath;
+        GLuint mTexture;
+        GLenum mTarget;                     // GL_TEXTURE_2D_ARRAY for LoadLayer()
+        uint32_t mLayer;
+        int mWidth;
+        int mHeight;
+        int mComponents;                    // as stored, RGB files become 4
+        uint32_t mSize;                     // bytes of the decoded image or of all compressed levels
+        GLuint mBuffer;                     // pixel unpack buffer, 0 if it couldn't be mapped
+        unsigned char* mDestination;        // mapped buffer or mPixels
+        std::vector<unsigned char> mPixels;
+        TextureCache::Header mCache;        // mFormat is FORMAT_NONE when not compressed
+        uint32_t mFirstLevel;               // compressed levels [mFirstLevel, mEndLevel) are loaded
+        uint32_t mEndLevel;
+        bool mCached;                       // an up to date cache file exists, otherwise it gets cooked
+        bool mStreamed;                     // mutable storage, levels are specified as they arrive
+        bool mResize;                       // cooked to mCache's size, without a cache file
+        bool mCancelled;                    // the texture was deleted, only the buffer is left to free
+        std::atomic<bool> mDecoded;
+        bool mSucceeded;
+        std::chrono::steady_clock::time_point mRequested;
+        double mDecodeMs;
+    };
+
+    static double MillisecondsSince( std::chrono::steady_clock::time_point const start )
+    {
+        return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+    }
+
+    static GLenum Format( int const components )
+    {
+        switch (components)
+        {
+        case 1: return GL_RED;
+        case 2: return GL_RG;
+        default: return GL_RGBA;
+        }
+    }
+
+    static GLenum InternalFormat( int const components )
+    {
+        switch (components)
+        {
+        case 1: return GL_R8;
+        case 2: return GL_RG8;
+        default: return GL_RGBA8;
+        }
+    }
+
+    // Full mip chain of immutable storage where the driver has it.
+    static void AllocateStorage( const Request& request )
+    {
+        int levels = 1;
+        for (int size = std::max( request.mWidth, request.mHeight ); size > 1; size >>= 1)
+        {
+            levels++;
+        }
+
+        bool const compressed = request.mCache.mFormat != TextureCache::FORMAT_NONE;
+        GLenum const internalFormat = compressed ? TextureCache::GetInternalFormat( request.mCache.mFormat ) : InternalFormat( request.mComponents );
+        glBindTexture( GL_TEXTURE_2D, request.mTexture );
+        if (GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_storage)
+        {
+            glTexStorage2D( GL_TEXTURE_2D, levels, internalFormat, request.mWidth, request.mHeight );
+        }
+        else
+        {
+            for (int level = 0; level < levels; level++)
+            {
+                int const width = std::max( request.mWidth >> level, 1 );
+                int const height = std::max( request.mHeight >> level, 1 );
+                if (compressed)
+                {
+                    glCompressedTexImage2D( GL_TEXTURE_2D, level, internalFormat, width, height, 0,
+                                            TextureCache::GetLevelSize( request.mCache, (uint32_t)level ), nullptr );
+                }
+                else
+                {
+                    glTexImage2D( GL_TEXTURE_2D, level, internalFormat, width, height, 0, Format( request.mComponents ), GL_UNSIGNED_BYTE, nullptr );
+                }
+            }
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+        }
+        SetParameters();
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+
+    // Of the bound texture.
+    static void SetParameters()
+    {
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    }
+
+    // Maps a destination for each queued request that fits in the budget and
+    // hands it to a worker. One always goes, however big.
+    void Start()
+    {
+        while (!mQueued.empty() && (mInFlight.empty() || mMappedBytes + mQueued.front()->mSize <= MAX_MAPPED_BYTES))
+        {
+            std::unique_ptr<Request> request = std::move( mQueued.front() );
+            mQueued.erase( mQueued.begin() );
+
+            glGenBuffers( 1, &request->mBuffer );
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, request->mBuffer );
+            glBufferData( GL_PIXEL_UNPACK_BUFFER, request->mSize, nullptr, GL_STREAM_DRAW );
+            request->mDestination = (unsigned char*)glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, request->mSize,
+                                                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+            if (request->mDestination == nullptr)
+            {
+                glDeleteBuffers( 1, &request->mBuffer );
+                request->mBuffer = 0;
+                request->mPixels.resize( request->mSize );
+                request->mDestination = &request->mPixels[0];
+            }
+
+            Request* const decode = request.get();
+            mMappedBytes += request->mSize;
+            mInFlight.push_back( std::move( request ) );
+            if (mJobSystem != nullptr)
+            {
+                mJobSystem->Submit( [decode]() { Decode( *decode ); }, &mCounter );
+            }
+            else
+            {
+                Decode( *decode );
+            }
+        }
+    }
+
+    // Runs on a worker, must not touch GL.
+    static void Decode( Request& request )
+    {
+        std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+        DecodeImage( request );
+        request.mDecodeMs = MillisecondsSince( start );
+        request.mDecoded.store( true, std::memory_order_release );
+    }
+
+    static void DecodeImage( Request& request )
+    {
+        if (request.mCache.mFormat != TextureCache::FORMAT_NONE)
+        {
+            if (request.mCached)
+            {
+                request.mSucceeded = TextureCache::ReadData( request.mPath, request.mCache, request.mFirstLevel, request.mEndLevel, request.mDestination );
+            }
+            else if (request.mResize)
+            {
+                request.mSucceeded = TextureCache::CookResized( request.mPath, request.mCache, request.mDestination );
+            }
+            else
+            {
+                request.mSucceeded = TextureCache::Cook( request.mPath, request.mCache, request.mFirstLevel, request.mDestination );
+            }
+            return;
+        }
+
+        int width, height, components;
+        unsigned char* data = stbi_load( request.mPath.c_str(), &width, &height, &components, 0 );
+
+        // The file could have changed since we read its header.
+        int const stored = components == 3 ? 4 : components;
+        request.mSucceeded = data != nullptr && width == request.mWidth && height == request.mHeight && stored == request.mComponents;
+        if (request.mSucceeded)
+        {
+            uint32_t const numPixels = (uint32_t)width * (uint32_t)height;
+            if (components == 3)
+            {
+                unsigned char const* src = data;
+                unsigned char* dst = request.mDestination;
+                for (uint32_t i = 0; i < numPixels; i++, src += 3, dst += 4)
+                {
+                    dst[0] = src[0];
+                    dst[1] = src[1];
+                    dst[2] = src[2];
+                    dst[3] = 255;
+                }
+            }
+            else
+            {
+                memcpy( request.mDestination, data, request.mSize );
+            }
+        }
+        stbi_image_free( data );
+    }
+
+    void Upload( Request& request )
+    {
+        std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+        if (request.mBuffer != 0)
+        {
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, request.mBuffer );
+            if (glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER ) == GL_FALSE)
+            {
+                request.mSucceeded = false;
+            }
+        }
+
+        if (request.mCancelled)
+        {
+            // Nothing to upload into, or to tell anyone about.
+        }
+        else if (request.mSucceeded && request.mCache.mFormat != TextureCache::FORMAT_NONE)
+        {
+            // Every level is already there, one after the other.
+            glBindTexture( request.mTarget, request.mTexture );
+            GLenum const format = TextureCache::GetInternalFormat( request.mCache.mFormat );
+            uint32_t offset = 0;
+            for (uint32_t level = request.mFirstLevel; level < request.mEndLevel; level++)
+            {
+                GLsizei const width = (GLsizei)TextureCache::GetLevelWidth( request.mCache, level );
+                GLsizei const height = (GLsizei)TextureCache::GetLevelHeight( request.mCache, level );
+                uint32_t const size = TextureCache::GetLevelSize( request.mCache, level );
+                const void* const data = request.mBuffer != 0 ? (const void*)(uintptr_t)offset : request.mDestination + offset;
+                if (request.mTarget == GL_TEXTURE_2D_ARRAY && TextureCache::IsCompressed( request.mCache.mFormat ))
+                {
+                    glCompressedTexSubImage3D( GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, (GLint)request.mLayer, width, height, 1, format, (GLsizei)size, data );
+                }
+                else if (request.mTarget == GL_TEXTURE_2D_ARRAY)
+                {
+                    glTexSubImage3D( GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, (GLint)request.mLayer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data );
+                }
+                else if (request.mStreamed)
+                {
+                    glCompressedTexImage2D( GL_TEXTURE_2D, (GLint)level, format, width, height, 0, (GLsizei)size, data );
+                }
+                else
+                {
+                    glCompressedTexSubImage2D( GL_TEXTURE_2D, (GLint)level, 0, 0, width, height, format, (GLsizei)size, data );
+                }
+                offset += size;
+            }
+            if (request.mStreamed)
+            {
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)request.mFirstLevel );
+            }
+            glBindTexture( request.mTarget, 0 );
+        }
+        else if (request.mSucceeded)
+        {
+            // Rows of one and two byte texels needn't start on four byte boundaries.
+            int const rowBytes = request.mWidth * request.mComponents;
+            glPixelStorei( GL_UNPACK_ALIGNMENT, (rowBytes & 3) == 0 ? 4 : 1 );
+            glBindTexture( GL_TEXTURE_2D, request.mTexture );
+            glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, request.mWidth, request.mHeight, Format( request.mComponents ), GL_UNSIGNED_BYTE,
+                             request.mBuffer != 0 ? nullptr : request.mDestination );
+            glGenerateMipmap( GL_TEXTURE_2D );
+            glBindTexture( GL_TEXTURE_2D, 0 );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        }
+        else
+        {
+            std::cout << "Texture failed to load at path: " << request.mPath << std::endl;
+        }
+
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        glDeleteBuffers( 1, &request.mBuffer );
+
+        if (request.mStreamed && !request.mCancelled && mUploadCallback)
+        {
+            mUploadCallback( request.mTexture, request.mFirstLevel, request.mSucceeded );
+        }
+        if (!request.mCancelled && mTimingCallback)
+        {
+            mTimingCallback( request.mPath, request.mDecodeMs, MillisecondsSince( start ), MillisecondsSince( request.mRequested ) );
+        }
+    }
+
+    JobSystem* mJobSystem;
+    JobCounter mCounter;
+    CreateCallback mCreateCallback;
+    UploadCallback mUploadCallback;
+    DeleteCallback mDeleteCallback;
+    TimingCallback mTimingCallback;
+    std::vector<std::unique_ptr<Request>> mQueued;      // storage allocated, waiting for mapped memory
+    std::vector<std::unique_ptr<Request>> mInFlight;    // decoding or decoded, waiting for Update()
+    uint32_t mMappedBytes;
+};
+
+//=============================================================================
+
+#endif
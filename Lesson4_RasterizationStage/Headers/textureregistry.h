@@ -0,0 +1,352 @@
+//=============================================================================
+// Texture Registry
+//
+// One texture per image for the whole process, however many models use
+// it. Acquire() looks the image up by its canonical path first, so every
+// spelling of the same file finds the same texture without touching the
+// disk. A path it hasn't seen is checked against the textures loaded from
+// files of the same size: byte identical files under different names then
+// still share one texture, and the new path is remembered as another name
+// for it. Only then are files read, hashed once each and compared byte by
+// byte on a hash match, so most new paths cost a single size query.
+//
+// This all happens in Acquire(), on the thread that owns the context,
+// because the caller gets the GL texture back straight away.
+//
+// Textures are reference counted through TextureHandle. Copying a handle
+// adds a user, destroying one removes it, and the last one going away
+// deletes the texture (see TextureLoader::Delete()).
+//
+// Handles may well outlive the GL context, so Shutdown() has to be called
+// before it goes: from then on releasing only forgets.
+//=============================================================================
+
+#ifndef TEXTUREREGISTRY_H
+#define TEXTUREREGISTRY_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <fileutils.h>
+#include <texturecache.h>
+#include <textureloader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class TextureRegistry;
+
+//=============================================================================
+
+class TextureHandle
+{
+public:
+    TextureHandle():
+        mRegistry( nullptr ),
+        mTexture( 0 )
+    {
+    }
+
+    TextureHandle( const TextureHandle& other );
+    TextureHandle( TextureHandle&& other );
+    TextureHandle& operator=( TextureHandle other );
+    ~TextureHandle();
+
+    GLuint Get() const { return mTexture; }
+
+private:
+    friend class TextureRegistry;
+
+    // Takes over a reference the registry already counted.
+    TextureHandle( TextureRegistry* const registry, GLuint const texture ):
+        mRegistry( registry ),
+        mTexture( texture )
+    {
+    }
+
+    TextureRegistry* mRegistry;
+    GLuint mTexture;
+};
+
+//=============================================================================
+
+class TextureRegistry
+{
+public:
+    explicit TextureRegistry( TextureLoader& loader ):
+        mLoader( loader ),
+        mShutdown( false ),
+        mNumHits( 0 ),
+        mNumContentHits( 0 ),
+        mNumMisses( 0 ),
+        mBytes( 0 ),
+        mBytesSaved( 0 )
+    {
+    }
+
+    // The texture for the image at 'path', loading it if nobody has yet.
+    // 'color' is passed on to TextureLoader::Load(); the same image as
+    // colour and as data is two textures.
+    TextureHandle Acquire( const std::string& path, bool const color )
+    {
+        std::string const canonical = CanonicalPath( path );
+        auto byPath = mPaths[color].find( canonical );
+        if (byPath != mPaths[color].end())
+        {
+            mNumHits++;
+            return Reference( byPath->second );
+        }
+
+        uint64_t size = 0;
+        bool const sized = GetFileSize( canonical, size );
+        bool hashed = false;
+        uint64_t hash = 0;
+        if (sized)
+        {
+            GLuint const same = FindSameContents( canonical, size, color, hashed, hash );
+            if (same != 0)
+            {
+                mNumHits++;
+                mNumContentHits++;
+                mPaths[color][canonical] = same;
+                mEntries[same].mPaths.push_back( canonical );
+                return Reference( same );
+            }
+        }
+
+        mNumMisses++;
+        GLuint const texture = mLoader.Load( canonical, color );
+        Entry& entry = mEntries[texture];
+        entry.mRefs = 0;
+        entry.mColor = color;
+        entry.mSized = sized;
+        entry.mSize = size;
+        entry.mHashed = hashed;
+        entry.mHash = hash;
+        entry.mBytes = EstimateBytes( canonical, color );
+        entry.mPaths.push_back( canonical );
+        mPaths[color][canonical] = texture;
+        if (sized)
+        {
+            mSizes[color][size].push_back( texture );
+        }
+        mBytes += entry.mBytes;
+        return Reference( texture );
+    }
+
+    // GL is about to go away, stop deleting textures.
+    void Shutdown() { mShutdown = true; }
+
+    uint32_t GetNumTextures() const { return (uint32_t)mEntries.size(); }
+    uint32_t GetNumHits() const { return mNumHits; }
+    uint32_t GetNumContentHits() const { return mNumContentHits; }   // hits on a path seen for the first time
+    uint32_t GetNumMisses() const { return mNumMisses; }
+    uint64_t GetBytes() const { return mBytes; }                      // of the textures alive, as fully loaded
+    uint64_t GetBytesSaved() const { return mBytesSaved; }            // the hits would have loaded again
+
+private:
+    friend class TextureHandle;
+
+    struct Entry
+    {
+        uint32_t mRefs;
+        bool mColor;
+        bool mSized;                        // the file could be opened, mSize is its size
+        bool mHashed;                       // mHash is the file's contents', hashed when first needed
+        uint64_t mSize;
+        uint64_t mHash;
+        uint64_t mBytes;
+        std::vector<std::string> mPaths;    // every name it was acquired under
+    };
+
+    TextureHandle Reference( GLuint const texture )
+    {
+        Entry& entry = mEntries[texture];
+        if (entry.mRefs > 0)
+        {
+            mBytesSaved += entry.mBytes;
+        }
+        entry.mRefs++;
+        return TextureHandle( this, texture );
+    }
+
+    void AddRef( GLuint const texture )
+    {
+        mEntries[texture].mRefs++;
+    }
+
+    void Release( GLuint const texture )
+    {
+        auto it = mEntries.find( texture );
+        if (it == mEntries.end() || --it->second.mRefs > 0)
+            return;
+
+        const Entry& entry = it->second;
+        for (const auto& path : entry.mPaths)
+        {
+            mPaths[entry.mColor].erase( path );
+        }
+        if (entry.mSized)
+        {
+            auto bySize = mSizes[entry.mColor].find( entry.mSize );
+            std::vector<GLuint>& textures = bySize->second;
+            textures.erase( std::find( textures.begin(), textures.end(), texture ) );
+            if (textures.empty())
+            {
+                mSizes[entry.mColor].erase( bySize );
+            }
+        }
+        mBytes -= entry.mBytes;
+        mEntries.erase( it );
+        if (!mShutdown)
+        {
+            mLoader.Delete( texture );
+        }
+    }
+
+    // A texture loaded from a file with the same contents as 'path', which
+    // is 'size' bytes, or 0. Hashes 'path' only if there is a file of that
+    // size to compare with, and says so in 'hashed' and 'hash'.
+    GLuint FindSameContents( const std::string& path, uint64_t const size, bool const color, bool& hashed, uint64_t& hash )
+    {
+        auto bySize = mSizes[color].find( size );
+        if (bySize == mSizes[color].end())
+            return 0;
+
+        hashed = HashFile( path, hash );
+        if (!hashed)
+            return 0;
+
+        for (GLuint const texture : bySize->second)
+        {
+            Entry& entry = mEntries[texture];
+            if (!entry.mHashed)
+            {
+                entry.mHashed = HashFile( entry.mPaths.front(), entry.mHash );
+            }
+            if (entry.mHashed && entry.mHash == hash && SameContents( entry.mPaths.front(), path ))
+                return texture;
+        }
+        return 0;
+    }
+
+    static bool GetFileSize( const std::string& path, uint64_t& size )
+    {
+        std::ifstream file( path, std::ios::binary | std::ios::ate );
+        if (!file)
+            return false;
+        size = (uint64_t)file.tellg();
+        return true;
+    }
+
+    // Whether both files can be read and hold the same bytes.
+    static bool SameContents( const std::string& first, const std::string& second )
+    {
+        std::ifstream a( first, std::ios::binary );
+        std::ifstream b( second, std::ios::binary );
+        if (!a || !b)
+            return false;
+
+        std::vector<char> bufferA( 64 << 10 );
+        std::vector<char> bufferB( 64 << 10 );
+        for (;;)
+        {
+            a.read( bufferA.data(), (std::streamsize)bufferA.size() );
+            b.read( bufferB.data(), (std::streamsize)bufferB.size() );
+            if (a.gcount() != b.gcount() || memcmp( bufferA.data(), bufferB.data(), (size_t)a.gcount() ) != 0)
+                return false;
+            if (a.gcount() == 0)
+                return true;
+        }
+    }
+
+    // FNV-1a over the whole file.
+    static bool HashFile( const std::string& path, uint64_t& hash )
+    {
+        std::ifstream file( path, std::ios::binary );
+        if (!file)
+            return false;
+
+        hash = 14695981039346656037ull;
+        char buffer[64 << 10];
+        while (file.read( buffer, sizeof( buffer ) ) || file.gcount() > 0)
+        {
+            for (std::streamsize i = 0; i < file.gcount(); i++)
+            {
+                hash = (hash ^ (unsigned char)buffer[i]) * 1099511628211ull;
+            }
+        }
+        return true;
+    }
+
+    // Video memory the image takes with all its levels, the way TextureLoader loads it.
+    static uint64_t EstimateBytes( const std::string& path, bool const color )
+    {
+        int width, height, components;
+        if (!stbi_info( path.c_str(), &width, &height, &components ))
+            return 0;
+
+        TextureCache::Header header;
+        if (TextureCache::IsSupported() && TextureCache::MakeHeader( path, (uint32_t)width, (uint32_t)height, components, color, header ))
+            return header.mDataSize;
+
+        // A full mip chain adds a third.
+        return (uint64_t)width * (uint64_t)height * (uint64_t)(components == 3 ? 4 : components) * 4 / 3;
+    }
+
+    TextureLoader& mLoader;
+    bool mShutdown;
+    uint32_t mNumHits;
+    uint32_t mNumContentHits;
+    uint32_t mNumMisses;
+    uint64_t mBytes;
+    uint64_t mBytesSaved;
+    std::unordered_map<GLuint, Entry> mEntries;
+    std::unordered_map<std::string, GLuint> mPaths[2];             // by colour, then canonical path
+    std::unordered_map<uint64_t, std::vector<GLuint>> mSizes[2];   // by colour, then file size
+};
+
+//=============================================================================
+
+inline TextureHandle::TextureHandle( const TextureHandle& other ):
+    mRegistry( other.mRegistry ),
+    mTexture( other.mTexture )
+{
+    if (mRegistry != nullptr)
+    {
+        mRegistry->AddRef( mTexture );
+    }
+}
+
+inline TextureHandle::TextureHandle( TextureHandle&& other ):
+    mRegistry( other.mRegistry ),
+    mTexture( other.mTexture )
+{
+    other.mRegistry = nullptr;
+    other.mTexture = 0;
+}
+
+inline TextureHandle& TextureHandle::operator=( TextureHandle other )
+{
+    std::swap( mRegistry, other.mRegistry );
+    std::swap( mTexture, other.mTexture );
+    return *this;
+}
+
+inline TextureHandle::~TextureHandle()
+{
+    if (mRegistry != nullptr)
+    {
+        mRegistry->Release( mTexture );
+    }
+}
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,299 @@
+//=============================================================================
+// Texture Streamer
+//
+// Keeps only as much of each block compressed texture in video memory as
+// the visible scene needs. A texture starts out with just its tail, the
+// levels TAIL_SIZE texels across and smaller, and every frame the
+// renderer reports how finely each texture is being sampled (see
+// Request()). Update() then loads the missing finer levels from the
+// texture cache in the background, neediest textures first.
+//
+// What is resident is kept under a budget. When a load wouldn't fit,
+// levels are dropped from the least recently used textures first:
+// textures nobody drew this frame go back to their tail, ones that did
+// keep what they need. Tails are never dropped.
+//
+// Streamed textures use mutable storage, with GL_TEXTURE_BASE_LEVEL on
+// the finest resident level. Dropping a level respecifies it as empty,
+// which is how GL 3.3 gives memory back.
+//=============================================================================
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <glad/glad.h>
+
+#include <texturecache.h>
+#include <textureloader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//=============================================================================
+
+class TextureStreamer
+{
+public:
+    static uint32_t const TAIL_SIZE = 64;
+
+    TextureStreamer():
+        mLoader( nullptr ),
+        mBudget( 0 ),
+        mResidentBytes( 0 ),
+        mPendingBytes( 0 ),
+        mFrame( 0 ),
+        mNumLoads( 0 ),
+        mNumEvictions( 0 )
+    {
+    }
+
+    // From now on compressed textures 'loader' creates are streamed, within
+    // 'budget' bytes where the tails allow.
+    void Init( TextureLoader& loader, uint64_t const budget )
+    {
+        mLoader = &loader;
+        mBudget = budget;
+        loader.SetStreaming( [this]( GLuint texture, const std::string& path, const TextureCache::Header& header ) { return Add( texture, path, header ); },
+                             [this]( GLuint texture, uint32_t firstLevel, bool succeeded ) { Uploaded( texture, firstLevel, succeeded ); },
+                             [this]( GLuint texture ) { Remove( texture ); } );
+    }
+
+    uint64_t GetBudget() const { return mBudget; }
+    void SetBudget( uint64_t const budget ) { mBudget = budget; }
+    uint64_t GetResidentBytes() const { return mResidentBytes; }
+    uint64_t GetPendingBytes() const { return mPendingBytes; }
+    uint32_t GetNumTextures() const { return (uint32_t)mEntries.size(); }
+    uint32_t GetNumLoads() const { return mNumLoads; }
+    uint32_t GetNumEvictions() const { return mNumEvictions; }
+
+    // Notes that 'texture' is drawn this frame covering 'uvPerPixel' of its
+    // texture coordinate range per screen pixel. Textures that aren't
+    // streamed are ignored.
+    void Request( GLuint const texture, float const uvPerPixel )
+    {
+        auto it = mIndex.find( texture );
+        if (it == mIndex.end())
+            return;
+
+        Entry& entry = mEntries[it->second];
+        float const texelsPerPixel = (float)std::max( entry.mHeader.mWidth, entry.mHeader.mHeight ) * uvPerPixel;
+        uint32_t const level = texelsPerPixel > 1.0f ? (uint32_t)std::log2( texelsPerPixel ) : 0;
+        entry.mWanted = std::min( entry.mWanted, std::min( level, entry.mTail ) );
+        entry.mLastUsed = mFrame;
+    }
+
+    // Starts loads for this frame's requests, evicting to make room, and
+    // starts over collecting requests. Binds textures.
+    void Update()
+    {
+        mLoads.clear();
+        for (uint32_t i = 0; i < mEntries.size(); i++)
+        {
+            const Entry& entry = mEntries[i];
+            if (entry.mWanted < entry.mResident && entry.mPending == entry.mResident && !entry.mFailed)
+            {
+                mLoads.push_back( i );
+            }
+        }
+
+        // Those missing the most levels first.
+        std::sort( mLoads.begin(), mLoads.end(), [this]( uint32_t const a, uint32_t const b )
+        {
+            return mEntries[a].mResident - mEntries[a].mWanted > mEntries[b].mResident - mEntries[b].mWanted;
+        } );
+
+        for (uint32_t const index : mLoads)
+        {
+            // As much of what's wanted as fits, finest first.
+            Entry& entry = mEntries[index];
+            for (uint32_t first = entry.mWanted; first < entry.mResident; first++)
+            {
+                uint64_t const bytes = GetBytes( entry, first, entry.mResident );
+                if (MakeRoom( bytes, index ))
+                {
+                    entry.mPending = first;
+                    mPendingBytes += bytes;
+                    mNumLoads++;
+                    mLoader->LoadLevels( entry.mTexture, entry.mPath, entry.mHeader, first, entry.mResident );
+                    break;
+                }
+            }
+        }
+
+        mFrame++;
+        for (Entry& entry : mEntries)
+        {
+            entry.mWanted = entry.mTail;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        GLuint mTexture;
+        std::string mPath;
+        TextureCache::Header mHeader;
+        uint32_t mTail;         // first level that always stays resident
+        uint32_t mResident;     // first resident level, mHeader.mLevels before the tail arrives
+        uint32_t mPending;      // first level being loaded, mResident if none are
+        uint32_t mWanted;       // finest level asked for this frame
+        uint64_t mLastUsed;     // frame it was last asked for
+        bool mFailed;           // its cache file let us down, stop trying
+    };
+
+    static uint64_t GetBytes( const Entry& entry, uint32_t const firstLevel, uint32_t const endLevel )
+    {
+        return TextureCache::GetLevelOffset( entry.mHeader, endLevel ) - TextureCache::GetLevelOffset( entry.mHeader, firstLevel );
+    }
+
+    // TextureLoader is creating a texture, returns the first level it should load.
+    uint32_t Add( GLuint const texture, const std::string& path, const TextureCache::Header& header )
+    {
+        Entry entry;
+        entry.mTexture = texture;
+        entry.mPath = path;
+        entry.mHeader = header;
+        entry.mTail = 0;
+        while (entry.mTail + 1 < header.mLevels &&
+               std::max( TextureCache::GetLevelWidth( header, entry.mTail ), TextureCache::GetLevelHeight( header, entry.mTail ) ) > TAIL_SIZE)
+        {
+            entry.mTail++;
+        }
+        entry.mResident = header.mLevels;
+        entry.mPending = entry.mTail;
+        entry.mWanted = entry.mTail;
+        entry.mLastUsed = 0;
+        entry.mFailed = false;
+
+        mPendingBytes += GetBytes( entry, entry.mTail, entry.mResident );
+        mIndex[texture] = (uint32_t)mEntries.size();
+        mEntries.push_back( entry );
+        return entry.mTail;
+    }
+
+    void Uploaded( GLuint const texture, uint32_t const firstLevel, bool const succeeded )
+    {
+        auto it = mIndex.find( texture );
+        if (it == mIndex.end())
+            return;
+
+        Entry& entry = mEntries[it->second];
+        uint64_t const bytes = GetBytes( entry, firstLevel, entry.mResident );
+        mPendingBytes -= bytes;
+        if (succeeded)
+        {
+            mResidentBytes += bytes;
+            entry.mResident = firstLevel;
+        }
+        else
+        {
+            entry.mFailed = true;
+        }
+        entry.mPending = entry.mResident;
+    }
+
+    // TextureLoader is deleting a texture, along with any levels still on their way.
+    void Remove( GLuint const texture )
+    {
+        auto it = mIndex.find( texture );
+        if (it == mIndex.end())
+            return;
+
+        uint32_t const index = it->second;
+        const Entry& entry = mEntries[index];
+        mResidentBytes -= GetBytes( entry, entry.mResident, entry.mHeader.mLevels );
+        mPendingBytes -= GetBytes( entry, entry.mPending, entry.mResident );
+        mIndex.erase( it );
+
+        // The last entry takes its place.
+        if (index + 1 != mEntries.size())
+        {
+            mEntries[index] = std::move( mEntries.back() );
+            mIndex[mEntries[index].mTexture] = index;
+        }
+        mEntries.pop_back();
+    }
+
+    // Evicts until 'bytes' more fit in the budget, never touching 'keep'.
+    // Returns false, having evicted nothing, if that isn't possible.
+    bool MakeRoom( uint64_t const bytes, uint32_t const keep )
+    {
+        if (mResidentBytes + mPendingBytes + bytes <= mBudget)
+            return true;
+
+        // What each candidate could give back, least recently used first.
+        mEvictions.clear();
+        uint64_t available = 0;
+        for (uint32_t i = 0; i < mEntries.size(); i++)
+        {
+            const Entry& entry = mEntries[i];
+            uint32_t const target = Keep( entry );
+            if (i != keep && entry.mPending == entry.mResident && entry.mResident < target)
+            {
+                mEvictions.push_back( i );
+                available += GetBytes( entry, entry.mResident, target );
+            }
+        }
+        if (mResidentBytes + mPendingBytes + bytes > mBudget + available)
+            return false;
+
+        std::sort( mEvictions.begin(), mEvictions.end(), [this]( uint32_t const a, uint32_t const b )
+        {
+            return mEntries[a].mLastUsed < mEntries[b].mLastUsed;
+        } );
+
+        // Coarsest levels last, so a texture gives up its finest first.
+        for (uint32_t const index : mEvictions)
+        {
+            Entry& entry = mEntries[index];
+            uint32_t const target = Keep( entry );
+            while (entry.mResident < target && mResidentBytes + mPendingBytes + bytes > mBudget)
+            {
+                Drop( entry );
+            }
+            if (mResidentBytes + mPendingBytes + bytes <= mBudget)
+                break;
+        }
+        return true;
+    }
+
+    // The first level an eviction may leave an entry with.
+    uint32_t Keep( const Entry& entry ) const
+    {
+        return entry.mLastUsed == mFrame ? std::max( entry.mWanted, entry.mResident ) : entry.mTail;
+    }
+
+    // Gives back the finest resident level.
+    void Drop( Entry& entry )
+    {
+        uint32_t const level = entry.mResident;
+        mResidentBytes -= TextureCache::GetLevelSize( entry.mHeader, level );
+        entry.mResident = entry.mPending = level + 1;
+        mNumEvictions++;
+
+        glBindTexture( GL_TEXTURE_2D, entry.mTexture );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)entry.mResident );
+        glCompressedTexImage2D( GL_TEXTURE_2D, (GLint)level, TextureCache::GetInternalFormat( entry.mHeader.mFormat ), 0, 0, 0, 0, nullptr );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+
+    TextureLoader* mLoader;
+    uint64_t mBudget;
+    uint64_t mResidentBytes;
+    uint64_t mPendingBytes;
+    uint64_t mFrame;
+    uint32_t mNumLoads;
+    uint32_t mNumEvictions;
+    std::vector<Entry> mEntries;
+    std::unordered_map<GLuint, uint32_t> mIndex;
+    std::vector<uint32_t> mLoads;
+    std::vector<uint32_t> mEvictions;
+};
+
+//=============================================================================
+
+#endif
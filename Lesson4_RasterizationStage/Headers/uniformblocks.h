@@ -0,0 +1,105 @@
+//=============================================================================
+// Uniform Blocks
+//
+// CPU mirrors of the std140 blocks declared in shaders/uniforms.glsl. Both
+// blocks live in one uniform buffer that is rewritten with a single upload
+// per frame and bound to the shared binding points (see UniformBlock in
+// shader.h), so no program needs per frame uniform calls for them.
+//=============================================================================
+
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//=============================================================================
+
+// Must match MAX_LIGHTS in uniforms.glsl. 512 lights of 32 bytes fill the
+// 16KB every GL implementation guarantees for a uniform block.
+uint32_t const MAX_LIGHTS = 512;
+
+//=============================================================================
+
+// std140: mat4 is four vec4 columns, vec3 is padded to a vec4.
+struct FrameBlock
+{
+    glm::mat4 mView;
+    glm::mat4 mProjection;
+    glm::vec4 mCameraPos;
+    int32_t mNumLights;
+    int32_t mPad[3];
+    glm::vec4 mClusterScale;    // see LightClusters: xy tiles per pixel, zw depth slice scale and bias
+    glm::ivec4 mClusterDims;    // tiles x, tiles y, slices, 0 to shade every light
+    glm::vec4 mViewportSize;    // xy framebuffer size in pixels
+};
+
+//=============================================================================
+
+struct PointLightBlock
+{
+    glm::vec4 mPositionRadius;  // xyz position, w radius
+    glm::vec4 mColor;
+};
+
+//=============================================================================
+
+class UniformBlocks
+{
+public:
+    void Init()
+    {
+        // Each block has to start at a multiple of the offset alignment.
+        GLint alignment = 256;
+        glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+        mLightsOffset = ((uint32_t)sizeof( FrameBlock ) + alignment - 1) / alignment * alignment;
+        mSize = mLightsOffset + MAX_LIGHTS * (uint32_t)sizeof( PointLightBlock );
+        mStaging.resize( mSize );
+
+        glGenBuffers( 1, &mBuffer );
+        glBindBuffer( GL_UNIFORM_BUFFER, mBuffer );
+        glBufferData( GL_UNIFORM_BUFFER, mSize, nullptr, GL_STREAM_DRAW );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+        glBindBufferRange( GL_UNIFORM_BUFFER, UNIFORM_BLOCK_FRAME, mBuffer, 0, sizeof( FrameBlock ) );
+        glBindBufferRange( GL_UNIFORM_BUFFER, UNIFORM_BLOCK_LIGHTS, mBuffer, mLightsOffset, MAX_LIGHTS * sizeof( PointLightBlock ) );
+    }
+
+    // Lights beyond MAX_LIGHTS are dropped.
+    void Update( const FrameBlock& frame, const std::vector<PointLightBlock>& lights )
+    {
+        uint32_t const numLights = glm::min( (uint32_t)lights.size(), MAX_LIGHTS );
+
+        FrameBlock frameBlock = frame;
+        frameBlock.mNumLights = (int32_t)numLights;
+        memcpy( &mStaging[0], &frameBlock, sizeof( FrameBlock ) );
+        if (numLights > 0)
+        {
+            memcpy( &mStaging[mLightsOffset], &lights[0], numLights * sizeof( PointLightBlock ) );
+        }
+
+        // One write covering the frame block and the lights in use. Orphaning
+        // first means we never wait on the GPU still reading last frame's data.
+        uint32_t const usedSize = mLightsOffset + numLights * (uint32_t)sizeof( PointLightBlock );
+        glBindBuffer( GL_UNIFORM_BUFFER, mBuffer );
+        glBufferData( GL_UNIFORM_BUFFER, mSize, nullptr, GL_STREAM_DRAW );
+        glBufferSubData( GL_UNIFORM_BUFFER, 0, usedSize, &mStaging[0] );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    }
+
+private:
+    GLuint mBuffer;
+    uint32_t mLightsOffset;
+    uint32_t mSize;
+    std::vector<uint8_t> mStaging;
+};
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,178 @@
+//=============================================================================
+// Vertex Format
+//
+// The 16 byte vertex the GPU sees, packed from the float Vertex the loader
+// builds (56 bytes):
+//
+//   position   4 x int16   xyz quantized over the model's bounds, w is the
+//                          sign of the bitangent times one more than the
+//                          material array layer (see materialpacker.h)
+//   normal     2 x int8    octahedral
+//   tangent    2 x int8    octahedral, the bitangent is cross( n, t ) * sign( w )
+//   uv         2 x half
+//
+// Attributes are read as plain integers (not normalized) so the decode is
+// exact and doesn't depend on the GL version's snorm rules. The position
+// scale and offset live in a matrix (see QuantizationTransform) that is
+// folded into each instance's model matrix; the shader side is in
+// vertexformat.glsl.
+//=============================================================================
+
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <bounds.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+
+//=============================================================================
+
+struct PackedVertex
+{
+    int16_t mPosition[4];
+    int8_t mNormal[2];
+    int8_t mTangent[2];
+    uint16_t mTexCoords[2];
+};
+
+static_assert( sizeof( PackedVertex ) == 16, "PackedVertex should be 16 bytes" );
+
+//=============================================================================
+
+static float const POSITION_QUANTIZATION_SCALE = 32767.0f;
+static float const DIRECTION_QUANTIZATION_SCALE = 127.0f;
+
+//=============================================================================
+
+// Maps quantized positions back to the box they were quantized over.
+inline glm::mat4 QuantizationTransform( const BoundingBox& box )
+{
+    glm::vec3 const halfExtents = glm::max( box.GetExtents(), glm::vec3( 1e-6f ) );
+    glm::mat4 transform = glm::translate( glm::mat4( 1.0f ), box.GetCenter() );
+    return glm::scale( transform, halfExtents / POSITION_QUANTIZATION_SCALE );
+}
+
+//=============================================================================
+
+// Unit vector to the octahedron, unfolded onto [-1, 1]^2.
+inline glm::vec2 OctahedralEncode( glm::vec3 const& n )
+{
+    glm::vec3 const octahedron = n / (glm::abs( n.x ) + glm::abs( n.y ) + glm::abs( n.z ));
+    glm::vec2 p( octahedron.x, octahedron.y );
+    if (octahedron.z < 0.0f)
+    {
+        glm::vec2 const signs( p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f );
+        p = (1.0f - glm::abs( glm::vec2( p.y, p.x ) )) * signs;
+    }
+    return p;
+}
+
+//=============================================================================
+
+inline int8_t QuantizeDirection( float const x )
+{
+    return (int8_t)glm::round( glm::clamp( x, -1.0f, 1.0f ) * DIRECTION_QUANTIZATION_SCALE );
+}
+
+//=============================================================================
+
+// Packs a vertex whose position lies in 'box' and that samples 'materialLayer'
+// of its model's material array, if it has one.
+inline PackedVertex PackVertex( glm::vec3 const& position, glm::vec3 const& normal, glm::vec2 const& texCoords,
+                                glm::vec3 const& tangent, glm::vec3 const& bitangent, const BoundingBox& box, uint32_t const materialLayer = 0 )
+{
+    PackedVertex packed;
+
+    glm::vec3 const halfExtents = glm::max( box.GetExtents(), glm::vec3( 1e-6f ) );
+    glm::vec3 const q = glm::clamp( (position - box.GetCenter()) / halfExtents, -1.0f, 1.0f ) * POSITION_QUANTIZATION_SCALE;
+    packed.mPosition[0] = (int16_t)glm::round( q.x );
+    packed.mPosition[1] = (int16_t)glm::round( q.y );
+    packed.mPosition[2] = (int16_t)glm::round( q.z );
+    int16_t const layer = (int16_t)(1 + std::min( materialLayer, (uint32_t)INT16_MAX - 1 ));
+    packed.mPosition[3] = glm::dot( glm::cross( normal, tangent ), bitangent ) < 0.0f ? -layer : layer;
+
+    // Degenerate directions (missing tangents, say) still need to decode to something.
+    glm::vec3 const n = glm::dot( normal, normal ) > 0.0f ? glm::normalize( normal ) : glm::vec3( 0.0f, 0.0f, 1.0f );
+    glm::vec3 const t = glm::dot( tangent, tangent ) > 0.0f ? glm::normalize( tangent ) : glm::vec3( 1.0f, 0.0f, 0.0f );
+    glm::vec2 const octNormal = OctahedralEncode( n );
+    glm::vec2 const octTangent = OctahedralEncode( t );
+    packed.mNormal[0] = QuantizeDirection( octNormal.x );
+    packed.mNormal[1] = QuantizeDirection( octNormal.y );
+    packed.mTangent[0] = QuantizeDirection( octTangent.x );
+    packed.mTangent[1] = QuantizeDirection( octTangent.y );
+
+    packed.mTexCoords[0] = glm::packHalf1x16( texCoords.x );
+    packed.mTexCoords[1] = glm::packHalf1x16( texCoords.y );
+    return packed;
+}
+
+//=============================================================================
+
+// What vertexformat.glsl decodes a PackedVertex into, with the position
+// already mapped back into its box. Only for checking packed data on the CPU.
+struct UnpackedVertex
+{
+    glm::vec3 mPosition;
+    glm::vec3 mNormal;
+    glm::vec3 mTangent;
+    glm::vec3 mBitangent;
+    glm::vec2 mTexCoords;
+    uint32_t mMaterialLayer;
+};
+
+//=============================================================================
+
+inline glm::vec3 OctahedralDecode( glm::vec2 const& e )
+{
+    glm::vec3 n( e, 1.0f - glm::abs( e.x ) - glm::abs( e.y ) );
+    if (n.z < 0.0f)
+    {
+        glm::vec2 const signs( n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f );
+        glm::vec2 const xy = (1.0f - glm::abs( glm::vec2( n.y, n.x ) )) * signs;
+        n.x = xy.x;
+        n.y = xy.y;
+    }
+    return glm::normalize( n );
+}
+
+//=============================================================================
+
+// The inverse of PackVertex, as the shaders do it.
+inline UnpackedVertex UnpackVertex( const PackedVertex& packed, const BoundingBox& box )
+{
+    UnpackedVertex vertex;
+    glm::vec4 const q( packed.mPosition[0], packed.mPosition[1], packed.mPosition[2], 1.0f );
+    vertex.mPosition = glm::vec3( QuantizationTransform( box ) * q );
+    vertex.mNormal = OctahedralDecode( glm::vec2( packed.mNormal[0], packed.mNormal[1] ) / DIRECTION_QUANTIZATION_SCALE );
+    vertex.mTangent = OctahedralDecode( glm::vec2( packed.mTangent[0], packed.mTangent[1] ) / DIRECTION_QUANTIZATION_SCALE );
+    vertex.mBitangent = glm::cross( vertex.mNormal, vertex.mTangent ) * (packed.mPosition[3] < 0 ? -1.0f : 1.0f);
+    vertex.mTexCoords = glm::vec2( glm::unpackHalf1x16( packed.mTexCoords[0] ), glm::unpackHalf1x16( packed.mTexCoords[1] ) );
+    vertex.mMaterialLayer = (uint32_t)(std::abs( (int32_t)packed.mPosition[3] ) - 1);
+    return vertex;
+}
+
+//=============================================================================
+
+// Describes PackedVertex to the bound vertex array:
+//   0 ivec4 position + bitangent sign and layer, 1 normal.xy tangent.xy, 2 uv.
+inline void SetupPackedVertexAttributes()
+{
+    glEnableVertexAttribArray( 0 );
+    glVertexAttribPointer( 0, 4, GL_SHORT, GL_FALSE, sizeof( PackedVertex ), (void*)offsetof( PackedVertex, mPosition ) );
+    glEnableVertexAttribArray( 1 );
+    glVertexAttribPointer( 1, 4, GL_BYTE, GL_FALSE, sizeof( PackedVertex ), (void*)offsetof( PackedVertex, mNormal ) );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribPointer( 2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof( PackedVertex ), (void*)offsetof( PackedVertex, mTexCoords ) );
+}
+
+//=============================================================================
+
+#endif
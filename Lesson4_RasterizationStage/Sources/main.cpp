@@ -2,12 +2,26 @@
 // VFSRenderingEnginesAndShaders
 //=============================================================================
 
+#include "assetloader.h"
+#include "bounds.h"
+#include "deferred.h"
+#include "depthprepass.h"
+#include "lightclusters.h"
 #include "model.h"
+#include "occlusion.h"
+#include "renderqueue.h"
+#include "sceneindex.h"
 #include "shader.h"
+#include "shadervariants.h"
+#include "softwareocclusion.h"
+#include "texturestreamer.h"
+#include "uniformblocks.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <iostream>
@@ -19,45 +33,75 @@ const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 const float FLOOR_SIZE = 50.0f;
 const float FLOOR_HALF_SIZE = FLOOR_SIZE * 0.5f;
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 100.0f;
+const uint32_t MAX_SOFTWARE_OCCLUDERS = 16;
+// Fraction of the screen height a model's bounding sphere must cover to be drawn at each level of detail.
+const float LOD_SCREEN_SIZES[Model::MAX_LODS] = { 0.2f, 0.1f, 0.05f, 0.0f };
+// How far past a threshold the size has to go before the level changes.
+const float LOD_HYSTERESIS = 0.15f;
+// The scene's lights. Lights are culled per froxel, so there can be up to MAX_LIGHTS of them as long as
+// each only reaches a little way, MAX_LIGHTS of radius 3 and power 4 for instance.
+const uint32_t NUM_LIGHTS = 10;
+const float LIGHT_RADIUS = 10.0f;
+const float LIGHT_POWER = 10.0f;
+static_assert( NUM_LIGHTS <= MAX_LIGHTS, "the light uniform block holds MAX_LIGHTS lights" );
+// Video memory streamed textures may use. Their smallest levels stay resident regardless.
+const uint64_t TEXTURE_BUDGET = 96ull << 20;
 
 //=============================================================================
 
 struct Object
 {
-    virtual ~Object() {};
+    Object(): mSceneIndex( nullptr ), mSpatialLeaf( nullptr ) {};
+    virtual ~Object();
     virtual void Update( float const deltaTime ) {};
     virtual void Render() {};
+    // World space bounds, objects without bounds are never culled.
+    virtual bool GetBounds( BoundingSphere& /*sphere*/, BoundingBox& /*box*/ ) const { return false; };
+    // Simplified geometry used to hide other objects in software occlusion culling.
+    virtual const OccluderMesh* GetOccluder( glm::mat4& /*transform*/ ) const { return nullptr; };
+
+    // Inserts or refits this object's leaf in the scene index, call whenever the bounds change.
+    void UpdateSpatialLeaf();
+
+    SceneIndex* mSceneIndex;    // the index mSpatialLeaf is in, it outlives the object
+    SceneIndex::Leaf mSpatialLeaf;
 };
 
 //=============================================================================
 
 struct Prop : public Object
 {
-    Prop( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader, float const scale );
+    Prop( const std::shared_ptr<Model>& model, const std::shared_ptr<ShaderVariants>& shader, float const scale );
     virtual ~Prop() {};
     virtual void Update( float const deltaTime ) override;
     virtual void Render() override;
+    virtual bool GetBounds( BoundingSphere& sphere, BoundingBox& box ) const override;
+    virtual const OccluderMesh* GetOccluder( glm::mat4& transform ) const override;
 
     std::shared_ptr<Model> mModel;
-    std::shared_ptr<Shader> mShader;
+    std::shared_ptr<ShaderVariants> mShader;
     glm::mat4 mTransform;
     glm::vec2 mPosXZ;
     glm::vec2 mVelocityXZ;
     float mScale;
     float mOverrideDist;
     uint32_t mUpdateFrame;
+    uint32_t mLod;
 };
 
 //=============================================================================
 
 struct Floor : public Object
 {
-    Floor( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader );
+    Floor( const std::shared_ptr<Model>& model, const std::shared_ptr<ShaderVariants>& shader );
     virtual ~Floor() {};
     virtual void Render() override;
+    virtual bool GetBounds( BoundingSphere& sphere, BoundingBox& box ) const override;
 
     std::shared_ptr<Model> mModel;
-    std::shared_ptr<Shader> mShader;
+    std::shared_ptr<ShaderVariants> mShader;
     glm::mat4 mTransform;
 };
 
@@ -77,7 +121,7 @@ struct Camera : public Object
 
 struct Light : public Object
 {
-    Light( const glm::vec3& color );
+    Light( const glm::vec3& color, float const radius );
     virtual ~Light() {};
     virtual void Update( float const deltaTime ) override;
 
@@ -89,6 +133,19 @@ struct Light : public Object
 
 //=============================================================================
 
+// All instances of one model drawn with the same shader, material and level of detail this frame.
+struct InstanceBatch
+{
+    std::shared_ptr<Model> mModel;
+    std::shared_ptr<ShaderVariants> mShader;
+    Material mMaterial;
+    uint32_t mLod;
+    float mScreenScale;         // largest on screen size of a model space unit among the instances, in half view heights
+    std::vector<InstanceData> mInstances;
+};
+
+//=============================================================================
+
 struct GameState
 {
     enum
@@ -103,14 +160,62 @@ struct GameState
     glm::mat4 mViewMatrix;
     glm::mat4 mCameraMatrix;
     glm::mat4 mProjectionMatrix;
+    SceneIndex mSceneIndex;     // declared before mObjects so it outlives them
     std::vector<std::shared_ptr<Object>> mObjects;
+    std::vector<Object*> mUnindexedObjects;     // those of mObjects without bounds, never in the scene index
     std::vector<std::shared_ptr<Light>> mLights;
+    std::vector<InstanceBatch> mBatches;
+    std::vector<InstanceData> mInstanceStream;
+    RenderQueue mRenderQueue;
+    RenderQueue mDepthQueue;
+    DepthPrepass mDepthPrepass;
+    RenderBackend mRenderBackend;
+    UniformBlocks mUniformBlocks;
+    LightClusters mLightClusters;
+    DeferredRenderer mDeferredRenderer;
+    OcclusionCuller mOcclusionCuller;
+    SoftwareOcclusion mSoftwareOcclusionCuller;
+    std::unique_ptr<JobSystem> mJobSystem;
+    TextureStreamer mTextureStreamer;
+    std::vector<PointLightBlock> mLightBlocks;
     uint32_t mButtonMask;
     glm::vec2 mPrevMousePos;
     glm::vec2 mCurMousePos;
+    SphereCuller mSphereCuller;
+    std::vector<void*> mVisibleLeaves;
+    std::vector<Object*> mCullObjects;
+    std::vector<BoundingBox> mCullBoxes;
+    std::vector<Object*> mFrustumVisible;
+    std::vector<BoundingBox> mFrustumVisibleBoxes;
+    std::vector<std::pair<float, uint32_t>> mOccluderCandidates;
+    float mSoftwareOcclusionMs;
+    std::vector<uint8_t> mCullVisible;
+    uint32_t mLodInstances[Model::MAX_LODS];
+    uint32_t mVisibleObjects;
+    uint32_t mCulledObjects;
     uint32_t mFrame;
     bool mPauseKey;
     bool mPaused;
+    bool mStatsKey;
+    bool mShowStats;
+    double mStatsTime;
+    bool mFrustumCullingKey;
+    bool mFrustumCulling;
+    bool mHierarchicalCullingKey;
+    bool mHierarchicalCulling;
+    bool mOcclusionCullingKey;
+    bool mOcclusionCulling;
+    bool mSoftwareOcclusionKey;
+    bool mSoftwareOcclusion;
+    bool mLodSelectionKey;
+    bool mLodSelection;
+    bool mClusteredLightingKey;
+    bool mClusteredLighting;
+    bool mDeferredShadingKey;
+    bool mDeferredShading;
+    bool mDepthPrepassKey;
+    bool mVertexLightingKey;
+    bool mVertexLighting;
 };
 
 //=============================================================================
@@ -119,12 +224,152 @@ static std::shared_ptr<GameState> gGameState;
 
 //=============================================================================
 
-Prop::Prop( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader, float const scale ):
+Object::~Object()
+{
+    if (mSpatialLeaf != nullptr)
+    {
+        mSceneIndex->Remove( mSpatialLeaf );
+    }
+}
+
+//=============================================================================
+
+void Object::UpdateSpatialLeaf()
+{
+    BoundingSphere sphere;
+    BoundingBox box;
+    if (!GetBounds( sphere, box ))
+        return;
+
+    if (mSpatialLeaf == nullptr)
+    {
+        mSceneIndex = &gGameState->mSceneIndex;
+        mSpatialLeaf = mSceneIndex->Insert( box, this );
+    }
+    else
+    {
+        gGameState->mSceneIndex.Update( mSpatialLeaf, box );
+    }
+}
+
+//=============================================================================
+
+// Adds an object to the scene. Those without bounds are kept aside so the
+// hierarchical cull can draw them without walking every object.
+void AddObject( const std::shared_ptr<Object>& object )
+{
+    gGameState->mObjects.push_back( object );
+
+    BoundingSphere sphere;
+    BoundingBox box;
+    if (!object->GetBounds( sphere, box ))
+    {
+        gGameState->mUnindexedObjects.push_back( object.get() );
+    }
+}
+
+//=============================================================================
+
+// Picks a level of detail from how much of the screen height the sphere
+// covers. Switching needs the size to clear a threshold by LOD_HYSTERESIS so
+// objects hovering around one don't pop back and forth.
+uint32_t SelectLod( const BoundingSphere& sphere, uint32_t lod, uint32_t const numLods )
+{
+    // mProjectionMatrix[1][1] is cot( fov / 2 ), so this is the diameter over the height of the view at that distance.
+    glm::vec3 const cameraPos( gGameState->mCameraMatrix[3] );
+    float const distance = glm::max( glm::length( sphere.mCenter - cameraPos ), CAMERA_NEAR );
+    float const size = sphere.mRadius * gGameState->mProjectionMatrix[1][1] / distance;
+
+    lod = glm::min( lod, numLods - 1 );
+    while (lod + 1 < numLods && size < LOD_SCREEN_SIZES[lod] * (1.0f - LOD_HYSTERESIS))
+    {
+        lod++;
+    }
+    while (lod > 0 && size > LOD_SCREEN_SIZES[lod - 1] * (1.0f + LOD_HYSTERESIS))
+    {
+        lod--;
+    }
+    return lod;
+}
+
+//=============================================================================
+
+void SubmitInstance( const std::shared_ptr<Model>& model, const std::shared_ptr<ShaderVariants>& shader, const Material& material, const glm::mat4& transform, uint32_t const lod = 0 )
+{
+    // Find the batch for this model / shader / material / LOD. There are only a handful
+    // of distinct combinations so a linear search is cheaper than a map.
+    InstanceBatch* batch = nullptr;
+    for (auto& b : gGameState->mBatches)
+    {
+        if (b.mModel == model && b.mShader == shader && b.mLod == lod &&
+            b.mMaterial.mShininess == material.mShininess &&
+            b.mMaterial.mDiffuseScale == material.mDiffuseScale &&
+            b.mMaterial.mSpecularScale == material.mSpecularScale)
+        {
+            batch = &b;
+            break;
+        }
+    }
+    if (batch == nullptr)
+    {
+        gGameState->mBatches.push_back( InstanceBatch() );
+        batch = &gGameState->mBatches.back();
+        batch->mModel = model;
+        batch->mShader = shader;
+        batch->mMaterial = material;
+        batch->mLod = lod;
+        batch->mScreenScale = 0.0f;
+    }
+
+    // How big the model gets on screen at the nearest point of this instance, for texture streaming.
+    // mProjectionMatrix[1][1] is cot( fov / 2 ), as in SelectLod.
+    BoundingSphere const sphere = model->boundingSphere.Transform( transform );
+    glm::vec3 const cameraPos( gGameState->mCameraMatrix[3] );
+    float const distance = glm::max( glm::length( sphere.mCenter - cameraPos ) - sphere.mRadius, CAMERA_NEAR );
+    float const scale = glm::max( glm::length( glm::vec3( transform[0] ) ), glm::max( glm::length( glm::vec3( transform[1] ) ), glm::length( glm::vec3( transform[2] ) ) ) );
+    batch->mScreenScale = glm::max( batch->mScreenScale, scale * gGameState->mProjectionMatrix[1][1] / distance );
+
+    // The model's dequantization goes into the instance matrix, normals only see the object's own transform.
+    InstanceData instance;
+    instance.Model = transform * model->quantizationTransform;
+    instance.ItModel[0] = normalize( glm::vec3( transform[0] ) );
+    instance.ItModel[1] = normalize( glm::vec3( transform[1] ) );
+    instance.ItModel[2] = normalize( glm::vec3( transform[2] ) );
+    batch->mInstances.push_back( instance );
+}
+
+//=============================================================================
+
+// The cheapest variant of the model shader that draws this mesh with this material the same way.
+uint32_t SelectShaderFeatures( const Material& material, const Mesh& mesh )
+{
+    uint32_t features = gGameState->mVertexLighting ? SHADER_FEATURE_VERTEX_LIGHTING : 0;
+    if (material.mSpecularScale == 0.0f)
+    {
+        features |= SHADER_FEATURE_NO_SPECULAR;
+    }
+    UniformName const diffuseMap( "texture_diffuse1" );
+    if (std::none_of( mesh.samplerNames.begin(), mesh.samplerNames.end(), [&]( const UniformName& name ) { return name.hash == diffuseMap.hash; } ))
+    {
+        features |= SHADER_FEATURE_NO_TEXTURE;
+    }
+    if (mesh.materialLayer >= 0)
+    {
+        features |= SHADER_FEATURE_MATERIAL_ARRAY;
+    }
+    return features;
+}
+
+//=============================================================================
+
+Prop::Prop( const std::shared_ptr<Model>& model, const std::shared_ptr<ShaderVariants>& shader, float const scale ):
     mModel( model ),
     mShader( shader ),
+    mTransform( 1.0f ),
     mScale( scale ),
     mOverrideDist( 0.0f ),
-    mUpdateFrame( 0 )
+    mUpdateFrame( 0 ),
+    mLod( 0 )
 {
     mPosXZ.x = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
     mPosXZ.y = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
@@ -196,6 +441,8 @@ void Prop::Update( float const deltaTime )
     mTransform = glm::translate( mTransform, glm::vec3( mPosXZ.x, 0.0f, mPosXZ.y ) );
     mTransform *= rot;
     mTransform = glm::scale( mTransform, glm::vec3( mScale ) );
+
+    UpdateSpatialLeaf();
 }
 
 //=============================================================================
@@ -204,29 +451,54 @@ void Prop::Render()
 {
     if (mModel != nullptr && mShader != nullptr)
     {
-        glm::mat3 itModelMatrix( 1.0f );
-        itModelMatrix[0] = normalize( glm::vec3( mTransform[0] ) );
-        itModelMatrix[1] = normalize( glm::vec3( mTransform[1] ) );
-        itModelMatrix[2] = normalize( glm::vec3( mTransform[2] ) );
+        if (gGameState->mLodSelection)
+        {
+            mLod = SelectLod( mModel->boundingSphere.Transform( mTransform ), mLod, mModel->lodCount );
+        }
+        else
+        {
+            mLod = 0;
+        }
+        gGameState->mLodInstances[mLod]++;
 
-        mShader->use();
-        mShader->setMat4( "model", mTransform );
-        mShader->setMat3( "itModel", itModelMatrix );
-        mShader->setFloat( "shininess", 100.0f );
-        mShader->setFloat( "diffuseScale", 1.0f );
-        mShader->setFloat( "specularScale", 1.0f );
-        mModel->Draw( *mShader );
+        Material const material = { 100.0f, 1.0f, 1.0f };
+        SubmitInstance( mModel, mShader, material, mTransform, mLod );
     }
 }
 
 //=============================================================================
 
-Floor::Floor( const std::shared_ptr<Model>& model, const std::shared_ptr<Shader>& shader ):
+bool Prop::GetBounds( BoundingSphere& sphere, BoundingBox& box ) const
+{
+    if (mModel == nullptr)
+        return false;
+
+    sphere = mModel->boundingSphere.Transform( mTransform );
+    box = mModel->aabb.Transform( mTransform );
+    return true;
+}
+
+//=============================================================================
+
+const OccluderMesh* Prop::GetOccluder( glm::mat4& transform ) const
+{
+    if (mModel == nullptr)
+        return nullptr;
+
+    transform = mTransform;
+    return &mModel->occluder;
+}
+
+//=============================================================================
+
+Floor::Floor( const std::shared_ptr<Model>& model, const std::shared_ptr<ShaderVariants>& shader ):
     mModel( model ),
     mShader( shader )
 {
     mTransform = glm::mat4( 1.0f );
     mTransform = glm::scale( mTransform, glm::vec3( FLOOR_SIZE, 1.0f, FLOOR_SIZE ) );
+
+    UpdateSpatialLeaf();
 }
 
 //=============================================================================
@@ -235,23 +507,25 @@ void Floor::Render()
 {
     if (mModel != nullptr && mShader != nullptr)
     {
-        glm::mat3 itModelMatrix( 1.0f );
-        itModelMatrix[0] = normalize( glm::vec3( mTransform[0] ) );
-        itModelMatrix[1] = normalize( glm::vec3( mTransform[1] ) );
-        itModelMatrix[2] = normalize( glm::vec3( mTransform[2] ) );
-
-        mShader->use();
-        mShader->setMat4( "model", mTransform );
-        mShader->setMat3( "itModel", itModelMatrix );
-        mShader->setFloat( "shininess", 100.0f );
-        mShader->setFloat( "diffuseScale", 1.0f );
-        mShader->setFloat( "specularScale", 0.0f );
-        mModel->Draw( *mShader );
+        Material const material = { 100.0f, 1.0f, 0.0f };
+        SubmitInstance( mModel, mShader, material, mTransform );
     }
 }
 
 //=============================================================================
 
+bool Floor::GetBounds( BoundingSphere& sphere, BoundingBox& box ) const
+{
+    if (mModel == nullptr)
+        return false;
+
+    sphere = mModel->boundingSphere.Transform( mTransform );
+    box = mModel->aabb.Transform( mTransform );
+    return true;
+}
+
+//=============================================================================
+
 Camera::Camera():
     mPosition( 0.0f, 13.0f, 23.0f ),
     mPitchYaw( 0.0f, -28.0f )
@@ -294,15 +568,15 @@ void Camera::Update( float const deltaTime )
     gGameState->mViewMatrix = glm::inverse( transform );
 
     // build projection matrix wd / ht aspect ratio with 45 degree field of view
-    gGameState->mProjectionMatrix = glm::perspective( glm::radians( 45.0f ), windowSize.x / windowSize.y, 0.1f, 100.0f );
+    gGameState->mProjectionMatrix = glm::perspective( glm::radians( 45.0f ), windowSize.x / windowSize.y, CAMERA_NEAR, CAMERA_FAR );
     //gGameState->mProjectionMatrix = glm::ortho( -10 * aspectRatio, 10.0f * aspectRatio, -FLOOR_HALF_SIZE, 10.0f, 0.1f, 100.0f );
 }
 
 //=============================================================================
 
-Light::Light( const glm::vec3& color ):
+Light::Light( const glm::vec3& color, float const radius ):
     mColor( color ),
-    mRadius( 10.0f )
+    mRadius( radius )
 {
     mPosXZ.x = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
     mPosXZ.y = -FLOOR_HALF_SIZE + ((float)(rand() % 101) / 100.0f * FLOOR_SIZE);
@@ -332,6 +606,17 @@ void Light::Update( float const deltaTime )
 
 //=============================================================================
 
+// Returns true on the frame a key is let go.
+bool KeyReleased( int const key, bool& keyState )
+{
+    bool const pressed = glfwGetKey( gGameState->mWindow, key ) == GLFW_PRESS ? true : false;
+    bool const released = !pressed && keyState;
+    keyState = pressed;
+    return released;
+}
+
+//=============================================================================
+
 void ProcessInput()
 {
     if (glfwGetKey( gGameState->mWindow, GLFW_KEY_ESCAPE ) == GLFW_PRESS)
@@ -351,12 +636,62 @@ void ProcessInput()
     gGameState->mCurMousePos.x = (float)xpos;
     gGameState->mCurMousePos.y = (float)ypos;
 
-    bool const pauseKey = glfwGetKey( gGameState->mWindow, GLFW_KEY_P ) == GLFW_PRESS ? true : false;
-    if (!pauseKey && gGameState->mPauseKey)
+    if (KeyReleased( GLFW_KEY_P, gGameState->mPauseKey ))
     {
         gGameState->mPaused = !gGameState->mPaused;
     }
-    gGameState->mPauseKey = pauseKey;
+
+    if (KeyReleased( GLFW_KEY_I, gGameState->mStatsKey ))
+    {
+        gGameState->mShowStats = !gGameState->mShowStats;
+    }
+
+    if (KeyReleased( GLFW_KEY_C, gGameState->mFrustumCullingKey ))
+    {
+        gGameState->mFrustumCulling = !gGameState->mFrustumCulling;
+    }
+
+    if (KeyReleased( GLFW_KEY_B, gGameState->mHierarchicalCullingKey ))
+    {
+        gGameState->mHierarchicalCulling = !gGameState->mHierarchicalCulling;
+    }
+
+    if (KeyReleased( GLFW_KEY_O, gGameState->mOcclusionCullingKey ))
+    {
+        gGameState->mOcclusionCulling = !gGameState->mOcclusionCulling;
+    }
+
+    if (KeyReleased( GLFW_KEY_M, gGameState->mSoftwareOcclusionKey ))
+    {
+        gGameState->mSoftwareOcclusion = !gGameState->mSoftwareOcclusion;
+    }
+
+    if (KeyReleased( GLFW_KEY_L, gGameState->mLodSelectionKey ))
+    {
+        gGameState->mLodSelection = !gGameState->mLodSelection;
+    }
+
+    if (KeyReleased( GLFW_KEY_K, gGameState->mClusteredLightingKey ))
+    {
+        gGameState->mClusteredLighting = !gGameState->mClusteredLighting;
+    }
+
+    if (KeyReleased( GLFW_KEY_G, gGameState->mDeferredShadingKey ))
+    {
+        gGameState->mDeferredShading = !gGameState->mDeferredShading;
+    }
+
+    if (KeyReleased( GLFW_KEY_V, gGameState->mVertexLightingKey ))
+    {
+        gGameState->mVertexLighting = !gGameState->mVertexLighting;
+    }
+
+    // Depth pre-pass: off, on, auto.
+    if (KeyReleased( GLFW_KEY_Z, gGameState->mDepthPrepassKey ))
+    {
+        DepthPrepass& prepass = gGameState->mDepthPrepass;
+        prepass.SetMode( (DepthPrepass::Mode)((prepass.GetMode() + 1) % DepthPrepass::NUM_MODES) );
+    }
 }
 
 //=============================================================================
@@ -406,6 +741,7 @@ bool Init()
         glfwTerminate();
         return false;
     }
+    Shader::enableParallelCompile( (GLADloadproc)glfwGetProcAddress );
 
     glfwSetInputMode( gGameState->mWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED );
 
@@ -416,9 +752,40 @@ bool Init()
 
     gGameState->mPauseKey = false;
     gGameState->mPaused = false;
+    gGameState->mStatsKey = false;
+    gGameState->mShowStats = false;
+    gGameState->mStatsTime = 0.0;
+    gGameState->mFrustumCullingKey = false;
+    gGameState->mFrustumCulling = true;
+    gGameState->mHierarchicalCullingKey = false;
+    gGameState->mHierarchicalCulling = true;
+    gGameState->mOcclusionCullingKey = false;
+    gGameState->mOcclusionCulling = false;
+    gGameState->mSoftwareOcclusionKey = false;
+    gGameState->mSoftwareOcclusion = false;
+    gGameState->mSoftwareOcclusionMs = 0.0f;
+    gGameState->mLodSelectionKey = false;
+    gGameState->mLodSelection = true;
+    gGameState->mClusteredLightingKey = false;
+    gGameState->mClusteredLighting = true;
+    gGameState->mDeferredShadingKey = false;
+    gGameState->mDeferredShading = false;
+    gGameState->mDepthPrepassKey = false;
+    gGameState->mVertexLightingKey = false;
+    gGameState->mVertexLighting = false;
 
     gGameState->mFrame = 1;
 
+    gGameState->mRenderBackend.Init();
+    gGameState->mUniformBlocks.Init();
+    gGameState->mLightClusters.Init();
+    gGameState->mDeferredRenderer.Init();
+    gGameState->mDepthPrepass.Init();
+    gGameState->mOcclusionCuller.Init();
+    gGameState->mJobSystem.reset( new JobSystem() );
+    ModelTextureLoader().SetJobSystem( gGameState->mJobSystem.get() );
+    gGameState->mTextureStreamer.Init( ModelTextureLoader(), TEXTURE_BUDGET );
+
     srand( (uint32_t)(glfwGetTime() * 10000) );
 
     return true;
@@ -441,55 +808,386 @@ void Update( float const deltaTime )
     {
         obj->Update( deltaTime );
     }
+
+    // keep the culling hierarchy in shape after this frame's refits
+    gGameState->mSceneIndex.Optimize();
 }
 
 //=============================================================================
 
-void PrepareShader( const std::shared_ptr<Shader>& shader )
+void PrepareFrame()
 {
-    shader->use();
+    // Per frame camera data.
+    FrameBlock frame;
+    frame.mView = gGameState->mViewMatrix;
+    frame.mProjection = gGameState->mProjectionMatrix;
+    frame.mCameraPos = gGameState->mCameraMatrix[3];
+
+    // Light list.
+    gGameState->mLightBlocks.resize( gGameState->mLights.size() );
+    for (uint32_t i = 0; i < gGameState->mLights.size(); i++)
+    {
+        const Light& light = *gGameState->mLights[i];
+        gGameState->mLightBlocks[i].mPositionRadius = glm::vec4( light.mPosXZ.x, 2.0f, light.mPosXZ.y, light.mRadius );
+        gGameState->mLightBlocks[i].mColor = glm::vec4( light.mColor, 1.0f );
+    }
+
+    // Bin the lights into froxels.
+    int wd;
+    int ht;
+    glfwGetFramebufferSize( gGameState->mWindow, &wd, &ht );
+    gGameState->mLightClusters.Update( frame, gGameState->mLightBlocks, gGameState->mViewMatrix, gGameState->mProjectionMatrix,
+                                       glm::ivec2( wd, ht ), CAMERA_NEAR, CAMERA_FAR,
+                                       gGameState->mClusteredLighting && !gGameState->mDeferredShading );
 
-    // Set projection and view matrix.
-    shader->setMat4( "projection", gGameState->mProjectionMatrix );
-    shader->setMat4( "view", gGameState->mViewMatrix );
+    // One upload shared by every program.
+    gGameState->mUniformBlocks.Update( frame, gGameState->mLightBlocks );
+}
 
-    // Set camera position.
-    shader->setVec3( "cameraPos", gGameState->mCameraMatrix[3] );
+//=============================================================================
 
-    // Set lighting state.
-    char nameStr[64];
-    for (uint32_t i = 0; i < gGameState->mLights.size(); i++)
+// Draws objects that survived frustum culling, minus those the occlusion
+// cullers find hidden.
+void RenderVisibleObjects()
+{
+    std::vector<Object*>& objects = gGameState->mFrustumVisible;
+    std::vector<BoundingBox>& boxes = gGameState->mFrustumVisibleBoxes;
+    glm::vec3 const cameraPos( gGameState->mCameraMatrix[3] );
+
+    // Rasterize the nearest occluders on the CPU.
+    if (gGameState->mSoftwareOcclusion)
+    {
+        auto const t0 = std::chrono::high_resolution_clock::now();
+
+        gGameState->mOccluderCandidates.clear();
+        for (uint32_t i = 0; i < objects.size(); i++)
+        {
+            glm::mat4 transform;
+            if (objects[i]->GetOccluder( transform ) != nullptr)
+            {
+                float const distance = glm::length( boxes[i].GetCenter() - cameraPos );
+                gGameState->mOccluderCandidates.push_back( std::make_pair( distance, i ) );
+            }
+        }
+        uint32_t const numOccluders = glm::min( (uint32_t)gGameState->mOccluderCandidates.size(), MAX_SOFTWARE_OCCLUDERS );
+        std::partial_sort( gGameState->mOccluderCandidates.begin(), gGameState->mOccluderCandidates.begin() + numOccluders, gGameState->mOccluderCandidates.end() );
+
+        SoftwareOcclusion& occlusion = gGameState->mSoftwareOcclusionCuller;
+        occlusion.Begin( gGameState->mProjectionMatrix * gGameState->mViewMatrix, CAMERA_NEAR );
+        for (uint32_t i = 0; i < numOccluders; i++)
+        {
+            glm::mat4 transform;
+            const OccluderMesh* occluder = objects[gGameState->mOccluderCandidates[i].second]->GetOccluder( transform );
+            occlusion.AddOccluder( occluder, transform );
+        }
+        occlusion.Rasterize( gGameState->mJobSystem.get() );
+
+        auto const t1 = std::chrono::high_resolution_clock::now();
+        gGameState->mSoftwareOcclusionMs = std::chrono::duration<float, std::milli>( t1 - t0 ).count();
+    }
+
+    for (uint32_t i = 0; i < objects.size(); i++)
+    {
+        if (gGameState->mSoftwareOcclusion && !gGameState->mSoftwareOcclusionCuller.IsVisible( boxes[i] ))
+            continue;
+
+        if (gGameState->mOcclusionCulling && !gGameState->mOcclusionCuller.IsVisible( objects[i], boxes[i], cameraPos, CAMERA_NEAR ))
+            continue;
+
+        objects[i]->Render();
+        gGameState->mVisibleObjects++;
+    }
+}
+
+//=============================================================================
+
+void CullObjectsHierarchical()
+{
+    // Objects that aren't in the scene index are always rendered.
+    for (Object* obj : gGameState->mUnindexedObjects)
+    {
+        obj->Render();
+    }
+
+    // Walk the tree, whole subtrees are accepted or rejected at once.
+    Frustum const frustum( gGameState->mProjectionMatrix * gGameState->mViewMatrix );
+    gGameState->mVisibleLeaves.clear();
+    gGameState->mSceneIndex.Cull( frustum, gGameState->mVisibleLeaves );
+    for (void* leaf : gGameState->mVisibleLeaves)
     {
-        sprintf( nameStr, "lightPositions[%d]", i );
-        shader->setVec3( nameStr, glm::vec3( gGameState->mLights[i]->mPosXZ.x, 2.0f, gGameState->mLights[i]->mPosXZ.y ) );
-        sprintf( nameStr, "lightColors[%d]", i );
-        shader->setVec3( nameStr, gGameState->mLights[i]->mColor );
-        sprintf( nameStr, "lightRadii[%d]", i );
-        shader->setFloat( nameStr, gGameState->mLights[i]->mRadius );
+        Object* obj = static_cast<Object*>( leaf );
+        BoundingSphere sphere;
+        BoundingBox box;
+        obj->GetBounds( sphere, box );
+        gGameState->mFrustumVisible.push_back( obj );
+        gGameState->mFrustumVisibleBoxes.push_back( box );
     }
 
+    gGameState->mCulledObjects = gGameState->mSceneIndex.GetNumLeaves() - (uint32_t)gGameState->mVisibleLeaves.size();
 }
 
 //=============================================================================
 
-void Render( const std::shared_ptr<Shader>& shader )
+void CullObjects()
+{
+    gGameState->mVisibleObjects = 0;
+    gGameState->mCulledObjects = 0;
+    std::fill( gGameState->mLodInstances, gGameState->mLodInstances + Model::MAX_LODS, 0 );
+    gGameState->mFrustumVisible.clear();
+    gGameState->mFrustumVisibleBoxes.clear();
+
+    if (gGameState->mFrustumCulling && gGameState->mHierarchicalCulling)
+    {
+        CullObjectsHierarchical();
+        RenderVisibleObjects();
+        return;
+    }
+
+    // Objects without bounds are always rendered, the rest are gathered for culling.
+    gGameState->mSphereCuller.Clear();
+    gGameState->mCullObjects.clear();
+    gGameState->mCullBoxes.clear();
+    for (const auto& obj : gGameState->mObjects)
+    {
+        BoundingSphere sphere;
+        BoundingBox box;
+        if (gGameState->mFrustumCulling && obj->GetBounds( sphere, box ))
+        {
+            gGameState->mSphereCuller.Add( sphere );
+            gGameState->mCullObjects.push_back( obj.get() );
+            gGameState->mCullBoxes.push_back( box );
+        }
+        else
+        {
+            obj->Render();
+        }
+    }
+
+    // Test all bounding spheres in one SIMD pass, then refine the survivors with their boxes.
+    Frustum const frustum( gGameState->mProjectionMatrix * gGameState->mViewMatrix );
+    gGameState->mSphereCuller.Cull( frustum, gGameState->mCullVisible );
+    for (uint32_t i = 0; i < gGameState->mCullObjects.size(); i++)
+    {
+        if (gGameState->mCullVisible[i] && frustum.Intersects( gGameState->mCullBoxes[i] ))
+        {
+            gGameState->mFrustumVisible.push_back( gGameState->mCullObjects[i] );
+            gGameState->mFrustumVisibleBoxes.push_back( gGameState->mCullBoxes[i] );
+        }
+        else
+        {
+            gGameState->mCulledObjects++;
+        }
+    }
+    RenderVisibleObjects();
+}
+
+//=============================================================================
+
+void Render()
 {
     //glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
     glEnable( GL_DEPTH_TEST );
 
-    // Set shader constants.
-    PrepareShader( shader );
+    // Set per frame constants.
+    PrepareFrame();
 
-    // Render objects
-    for (const auto& obj : gGameState->mObjects)
+    // Deferred shading draws the scene into the G-buffer with its own program.
+    int wd;
+    int ht;
+    glfwGetFramebufferSize( gGameState->mWindow, &wd, &ht );
+    gGameState->mDepthPrepass.BeginFrame();
+    bool const depthPrepass = gGameState->mDepthPrepass.IsEnabled();
+    const Shader* depthShader = gGameState->mDepthPrepass.GetShader().get();
+    if (gGameState->mDeferredShading)
     {
-        obj->Render();
+        gGameState->mDeferredRenderer.BeginGeometry( gGameState->mRenderBackend, glm::ivec2( wd, ht ) );
+    }
+
+    // Gather instances from visible objects.
+    if (gGameState->mOcclusionCulling)
+    {
+        gGameState->mOcclusionCuller.BeginFrame( gGameState->mFrame );
+    }
+    CullObjects();
+
+    // Gather every batch's instances into one stream and submit one instanced packet per mesh.
+    float const farDepth = CAMERA_FAR;
+    gGameState->mInstanceStream.clear();
+    for (auto& batch : gGameState->mBatches)
+    {
+        if (batch.mInstances.empty())
+            continue;
+
+        // Sort the batch by its nearest instance.
+        float depth = farDepth;
+        for (const auto& instance : batch.mInstances)
+        {
+            depth = glm::min( depth, -(gGameState->mViewMatrix * instance.Model[3]).z );
+        }
+
+        uint32_t const firstInstance = (uint32_t)gGameState->mInstanceStream.size();
+        gGameState->mInstanceStream.insert( gGameState->mInstanceStream.end(), batch.mInstances.begin(), batch.mInstances.end() );
+        float const pixelsPerUnit = batch.mScreenScale * 0.5f * (float)ht;
+        for (const auto& mesh : batch.mModel->meshes)
+        {
+            // Tell the streamer how finely the mesh's textures get sampled.
+            if (pixelsPerUnit > 0.0f)
+            {
+                for (const auto& texture : mesh.textures)
+                {
+                    gGameState->mTextureStreamer.Request( texture.id, mesh.uvDensity / pixelsPerUnit );
+                }
+            }
+
+            uint32_t const features = SelectShaderFeatures( batch.mMaterial, mesh );
+            const Shader* shader = gGameState->mDeferredShading ? gGameState->mDeferredRenderer.GetGeometryShader( features ) : batch.mShader->Get( features );
+            DrawPacket packet;
+            packet.mKey = gGameState->mRenderQueue.MakeKey( *shader, mesh, depth, farDepth );
+            packet.mShader = shader;
+            packet.mMesh = &mesh;
+            packet.mMaterial = batch.mMaterial;
+            packet.mLod = batch.mLod;
+            packet.mFirstInstance = firstInstance;
+            packet.mInstanceCount = (GLsizei)batch.mInstances.size();
+            packet.mDepthOnly = false;
+            gGameState->mRenderQueue.Submit( packet );
+
+            if (depthPrepass)
+            {
+                packet.mKey = gGameState->mDepthQueue.MakeDepthKey( *depthShader, mesh, depth, farDepth );
+                packet.mShader = depthShader;
+                packet.mDepthOnly = true;
+                gGameState->mDepthQueue.Submit( packet );
+            }
+        }
+
+        // Keep the batch (and its allocation) around for next frame.
+        batch.mInstances.clear();
+        batch.mScreenScale = 0.0f;
+    }
+
+    // Sort and draw.
+    // With the pre-pass, depth goes down first and the main pass only shades what is
+    // already known to be in front. Whichever pass lays depth down measures overdraw.
+    gGameState->mRenderBackend.UploadInstances( gGameState->mInstanceStream );
+    gGameState->mDepthPrepass.BeginMeasure( (uint32_t)(wd * ht) );
+    if (depthPrepass)
+    {
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        gGameState->mDepthQueue.Flush( gGameState->mRenderBackend );
+        glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+        gGameState->mDepthPrepass.EndMeasure();
+        glDepthMask( GL_FALSE );
+        glDepthFunc( GL_LEQUAL );
+    }
+    gGameState->mRenderQueue.Flush( gGameState->mRenderBackend );
+    if (depthPrepass)
+    {
+        glDepthMask( GL_TRUE );
+        glDepthFunc( GL_LESS );
+    }
+    else
+    {
+        gGameState->mDepthPrepass.EndMeasure();
+    }
+
+    // Light the G-buffer and composite it, depth included, into the window.
+    if (gGameState->mDeferredShading)
+    {
+        uint32_t const numLights = glm::min( (uint32_t)gGameState->mLights.size(), MAX_LIGHTS );
+        gGameState->mDeferredRenderer.Light( gGameState->mRenderBackend, numLights, gGameState->mProjectionMatrix * gGameState->mViewMatrix );
+        gGameState->mDeferredRenderer.Resolve( gGameState->mRenderBackend );
+    }
+
+    // Test hidden and due objects against this frame's depth, results are picked up next frame or later.
+    if (gGameState->mOcclusionCulling)
+    {
+        gGameState->mOcclusionCuller.IssueQueries( gGameState->mRenderBackend );
     }
 
     // Swap buffers.
     glfwSwapBuffers( gGameState->mWindow );
+
+    // Bring in the texture levels this frame asked for and upload whatever has arrived.
+    // Both bind textures behind the backend's back.
+    gGameState->mTextureStreamer.Update();
+    ModelTextureLoader().Update();
+    gGameState->mRenderBackend.Invalidate();
+}
+
+//=============================================================================
+
+void ReportStats()
+{
+    // Print last frame's counters about once a second.
+    double const time = glfwGetTime();
+    if (gGameState->mShowStats && time - gGameState->mStatsTime >= 1.0)
+    {
+        const RenderStats& stats = gGameState->mRenderBackend.GetStats();
+        std::cout << "frame " << gGameState->mFrame
+                  << ": packets " << stats.mPackets
+                  << ", draws " << stats.mDrawCalls
+                  << ", programs " << stats.mProgramChanges << " (" << stats.mProgramChangesElided << " elided)"
+                  << ", textures " << stats.mTextureChanges << " (" << stats.mTextureChangesElided << " elided)"
+                  << ", vertex arrays " << stats.mVertexArrayChanges << " (" << stats.mVertexArrayChangesElided << " elided)"
+                  << ", multi draws " << stats.mMultiDraws
+                  << ", instance rebinds " << stats.mInstanceRebinds
+                  << ", visible " << gGameState->mVisibleObjects
+                  << ", culled " << gGameState->mCulledObjects;
+        if (gGameState->mOcclusionCulling)
+        {
+            const OcclusionStats& occlusion = gGameState->mOcclusionCuller.GetStats();
+            std::cout << ", occluded " << occlusion.mOccluded
+                      << ", queries " << occlusion.mQueriesIssued
+                      << ", query latency " << (occlusion.mResultsReceived > 0 ? (float)occlusion.mLatencyFrames / (float)occlusion.mResultsReceived : 0.0f) << " frames";
+        }
+        if (gGameState->mLodSelection)
+        {
+            std::cout << ", lods";
+            for (uint32_t i = 0; i < Model::MAX_LODS; i++)
+            {
+                std::cout << " " << gGameState->mLodInstances[i];
+            }
+        }
+        static const char* const prepassModes[DepthPrepass::NUM_MODES] = { "off", "on", "auto" };
+        std::cout << ", depth prepass " << prepassModes[gGameState->mDepthPrepass.GetMode()]
+                  << (gGameState->mDepthPrepass.IsEnabled() ? " (running)" : "")
+                  << ", overdraw " << gGameState->mDepthPrepass.GetOverdraw();
+        if (gGameState->mDeferredShading)
+        {
+            std::cout << ", deferred";
+        }
+        else if (gGameState->mClusteredLighting)
+        {
+            std::cout << ", cluster light indices " << gGameState->mLightClusters.GetNumIndices()
+                      << " (max " << gGameState->mLightClusters.GetMaxClusterLights() << " per cluster)";
+        }
+        GeometryArenaStats const arena = MeshArena().GetStats();
+        std::cout << ", geometry arena " << arena.mVerticesUsed << "/" << arena.mVertexCapacity << " vertices"
+                  << ", " << (arena.mIndexBytesUsed >> 10) << "/" << (arena.mIndexCapacity >> 10) << " KB indices"
+                  << ", " << arena.mVertexGrowths + arena.mIndexGrowths << " grows";
+        const TextureStreamer& streamer = gGameState->mTextureStreamer;
+        std::cout << ", streamed textures " << streamer.GetNumTextures()
+                  << " (" << (streamer.GetResidentBytes() >> 20) << "/" << (streamer.GetBudget() >> 20) << " MB"
+                  << ", " << (streamer.GetPendingBytes() >> 20) << " MB loading"
+                  << ", " << streamer.GetNumLoads() << " loads, " << streamer.GetNumEvictions() << " evictions)";
+        const TextureRegistry& registry = ModelTextureRegistry();
+        std::cout << ", shared textures " << registry.GetNumTextures() << " (" << (registry.GetBytes() >> 20) << " MB"
+                  << ", " << registry.GetNumHits() << " hits, " << registry.GetNumContentHits() << " by content, " << registry.GetNumMisses() << " misses"
+                  << ", " << (registry.GetBytesSaved() >> 20) << " MB saved)";
+        if (gGameState->mSoftwareOcclusion)
+        {
+            const SoftwareOcclusionStats& occlusion = gGameState->mSoftwareOcclusionCuller.GetStats();
+            std::cout << ", software occluders " << occlusion.mOccluders << " (" << occlusion.mTriangles << " triangles)"
+                      << ", software occluded " << occlusion.mOccluded << "/" << occlusion.mTested
+                      << ", " << gGameState->mSoftwareOcclusionMs << " ms";
+        }
+        std::cout << std::endl;
+        gGameState->mStatsTime = time;
+    }
+    gGameState->mRenderBackend.ResetStats();
 }
 
 //=============================================================================
@@ -505,33 +1203,51 @@ int main()
     }
 
     // create shader program
-    std::shared_ptr<Shader> modelShader( new Shader( "shaders/model.vs", "shaders/model.fs" ) );
+    // Start every variant now, they build while the models load and are waited on at first use.
+    std::shared_ptr<ShaderVariants> modelShader( new ShaderVariants( "shaders/model.vs", "shaders/model.fs" ) );
+    // Meshes in a material array always have a diffuse map.
+    modelShader->Prewarm( SHADER_FEATURE_VERTEX_LIGHTING | SHADER_FEATURE_NO_SPECULAR | SHADER_FEATURE_NO_TEXTURE );
+    modelShader->Prewarm( SHADER_FEATURE_VERTEX_LIGHTING | SHADER_FEATURE_NO_SPECULAR | SHADER_FEATURE_MATERIAL_ARRAY );
 
     // load models
     // -----------
-    std::shared_ptr<Model> propModelA( new Model( "objects/nanosuit/nanosuit.obj" ) );
-    std::shared_ptr<Model> propModelB( new Model( "objects/cyborg/cyborg.obj" ) );
+    // All of them load at once on the workers, only their uploads come back to this thread.
+    AssetLoader assets( gGameState->mJobSystem.get() );
+    // The props have a map per body part, packing them lets all their meshes share one texture.
+    ModelOptions propOptions;
+    propOptions.packMaterials = true;
+    propOptions.loadNow = false;
+    std::shared_ptr<Model> propModelA( new Model( "objects/nanosuit/nanosuit.obj", propOptions ) );
+    std::shared_ptr<Model> propModelB( new Model( "objects/cyborg/cyborg.obj", propOptions ) );
+    assets.Add( propModelA );
+    assets.Add( propModelB );
 
     // create floor mesh
-    std::shared_ptr<Model> floorModel( new Model( "objects/floor/floor.obj" ) );
+    ModelOptions floorOptions;
+    floorOptions.loadNow = false;
+    std::shared_ptr<Model> floorModel( new Model( "objects/floor/floor.obj", floorOptions ) );
+    assets.Add( floorModel );
+
+    // Textures decode on the same workers while the meshes are cooked.
+    assets.Run( ModelTextureLoader() );
+    gGameState->mRenderBackend.Invalidate();
 
     // create camera object
-    gGameState->mObjects.push_back( std::shared_ptr<Object>( new Camera() ) );
+    AddObject( std::shared_ptr<Object>( new Camera() ) );
 
     // create floor object
-    gGameState->mObjects.push_back( std::shared_ptr<Object>( new Floor( floorModel, modelShader ) ) );
+    AddObject( std::shared_ptr<Object>( new Floor( floorModel, modelShader ) ) );
 
     // create prop object
     uint32_t const numProps = 150;
     for (uint32_t i = 0; i < numProps; i++)
     {
         uint32_t const modelIndex = rand() % 2;
-        gGameState->mObjects.push_back( std::shared_ptr<Object>( new Prop( modelIndex == 0 ? propModelA : propModelB, modelShader, modelIndex == 0 ? 0.125f : 0.5f ) ) );
+        AddObject( std::shared_ptr<Object>( new Prop( modelIndex == 0 ? propModelA : propModelB, modelShader, modelIndex == 0 ? 0.125f : 0.5f ) ) );
     }
 
     // create lights
     uint32_t const numColors = 6;
-    float const lightPower = 10.0f;
     glm::vec3 const colors[numColors] = 
     {
         glm::vec3( 0.25f, 1.0f, 0.25f ),
@@ -541,11 +1257,10 @@ int main()
         glm::vec3( 0.25f, 1.0f, 1.0f ),
         glm::vec3( 1.0f, 0.25f, 1.0f ),
     };
-    uint32_t const numLights = 10;
-    for (uint32_t i = 0; i < numLights; i++)
+    for (uint32_t i = 0; i < NUM_LIGHTS; i++)
     {
-        std::shared_ptr<Light> light( new Light( colors[rand() % numColors] * lightPower ) );
-        gGameState->mObjects.push_back( light );
+        std::shared_ptr<Light> light( new Light( colors[rand() % numColors] * LIGHT_POWER, LIGHT_RADIUS ) );
+        AddObject( light );
         gGameState->mLights.push_back( light );
     }
 
@@ -560,13 +1275,16 @@ int main()
         t0 = t1;
 
         // render objects (View Frustum Culling, Occlusion Culling, Draw Order Sorting, etc)
-        Render( modelShader );
+        Render();
 
+        ReportStats();
         gGameState->mFrame++;
     }
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
+    // Textures still in use die with the context.
+    ModelTextureRegistry().Shutdown();
     glfwTerminate();
     return 0;
 }
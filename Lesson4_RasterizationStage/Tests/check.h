@@ -0,0 +1,42 @@
+//=============================================================================
+// Test Checks
+//
+// Just enough to write the GL-free tests with: CHECK prints what failed and
+// where, and main() returns TestResult() so ctest sees any failure.
+//=============================================================================
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+
+//=============================================================================
+
+inline int& TestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+inline int TestResult()
+{
+    if (TestFailures() != 0)
+    {
+        std::cout << TestFailures() << " check(s) failed" << std::endl;
+    }
+    return TestFailures() == 0 ? 0 : 1;
+}
+
+#define CHECK( condition )                                                                  \
+    do                                                                                      \
+    {                                                                                       \
+        if (!(condition))                                                                   \
+        {                                                                                   \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK( " #condition " ) failed" << std::endl; \
+            TestFailures()++;                                                               \
+        }                                                                                   \
+    } while (false)
+
+//=============================================================================
+
+#endif
@@ -0,0 +1,134 @@
+//=============================================================================
+// Mesh Optimization Tests
+//=============================================================================
+
+#include "check.h"
+
+#include <meshoptimize.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+
+//=============================================================================
+
+struct TestVertex
+{
+    glm::vec3 mPosition;
+};
+
+// A unit sphere the way the OBJ importer hands meshes over: every face
+// corner its own vertex, triangles in no particular order.
+static void ShuffledSphere( uint32_t const slices, uint32_t const stacks, std::vector<TestVertex>& vertices, std::vector<uint32_t>& indices )
+{
+    auto point = [&]( uint32_t const slice, uint32_t const stack )
+    {
+        // Poles are one point, however many slices meet there.
+        float const theta = 3.14159265f * (float)stack / (float)stacks;
+        float const phi = 2.0f * 3.14159265f * (float)(stack == 0 || stack == stacks ? 0 : slice % slices) / (float)slices;
+        return glm::vec3( std::sin( theta ) * std::cos( phi ), std::cos( theta ), std::sin( theta ) * std::sin( phi ) );
+    };
+
+    std::vector<std::array<glm::vec3, 3>> triangles;
+    for (uint32_t stack = 0; stack < stacks; stack++)
+    {
+        for (uint32_t slice = 0; slice < slices; slice++)
+        {
+            glm::vec3 const a = point( slice, stack );
+            glm::vec3 const b = point( slice + 1, stack );
+            glm::vec3 const c = point( slice, stack + 1 );
+            glm::vec3 const d = point( slice + 1, stack + 1 );
+            if (stack != 0)
+                triangles.push_back( { a, b, c } );
+            if (stack + 1 != stacks)
+                triangles.push_back( { b, d, c } );
+        }
+    }
+    std::shuffle( triangles.begin(), triangles.end(), std::mt19937( 1 ) );
+
+    vertices.clear();
+    indices.clear();
+    for (const auto& triangle : triangles)
+    {
+        for (const glm::vec3& p : triangle)
+        {
+            indices.push_back( (uint32_t)vertices.size() );
+            vertices.push_back( TestVertex{ p } );
+        }
+    }
+}
+
+//=============================================================================
+
+// Welding, cache, overdraw and fetch ordering, as Model runs them, keep
+// every triangle and bring the vertex cache miss rate down to what a
+// well ordered grid gets.
+static void TestSphere()
+{
+    uint32_t const slices = 100;
+    uint32_t const stacks = 80;
+    std::vector<TestVertex> vertices;
+    std::vector<uint32_t> indices;
+    ShuffledSphere( slices, stacks, vertices, indices );
+    size_t const triangleCount = indices.size() / 3;
+
+    VertexCacheStats const before = AnalyzeVertexCache( indices, vertices.size() );
+    CHECK( std::abs( before.mAcmr - 3.0f ) < 1e-5f );
+
+    // Sorted corner positions of every triangle, to compare against afterwards.
+    auto triangleSet = [&]()
+    {
+        std::vector<std::array<float, 9>> set;
+        for (size_t t = 0; t < indices.size() / 3; t++)
+        {
+            std::array<glm::vec3, 3> corners = { vertices[indices[t * 3]].mPosition, vertices[indices[t * 3 + 1]].mPosition, vertices[indices[t * 3 + 2]].mPosition };
+            // Rotate the lowest corner first, winding stays as it was.
+            auto const lowest = std::min_element( corners.begin(), corners.end(), []( const glm::vec3& a, const glm::vec3& b )
+            {
+                return a.x != b.x ? a.x < b.x : (a.y != b.y ? a.y < b.y : a.z < b.z);
+            } );
+            std::rotate( corners.begin(), lowest, corners.end() );
+            set.push_back( { corners[0].x, corners[0].y, corners[0].z, corners[1].x, corners[1].y, corners[1].z, corners[2].x, corners[2].y, corners[2].z } );
+        }
+        std::sort( set.begin(), set.end() );
+        return set;
+    };
+    auto const trianglesBefore = triangleSet();
+
+    WeldVertices( vertices, indices );
+    CHECK( vertices.size() == slices * (stacks - 1) + 2 );
+
+    std::vector<uint32_t> clusters;
+    OptimizeVertexCache( indices, vertices.size(), &clusters );
+    CHECK( !clusters.empty() && clusters[0] == 0 );
+    OptimizeOverdraw( indices, clusters, (const uint8_t*)&vertices[0].mPosition, sizeof( TestVertex ) );
+    OptimizeVertexFetch( vertices, indices );
+
+    CHECK( indices.size() == triangleCount * 3 );
+    CHECK( triangleSet() == trianglesBefore );
+
+    // First use order: every vertex is used, and introduced one after another.
+    uint32_t next = 0;
+    for (uint32_t index : indices)
+    {
+        CHECK( index <= next );
+        next = std::max( next, index + 1 );
+    }
+    CHECK( next == vertices.size() );
+
+    VertexCacheStats const after = AnalyzeVertexCache( indices, vertices.size() );
+    std::cout << "ACMR " << before.mAcmr << " -> " << after.mAcmr << ", vertices " << triangleCount * 3 << " -> " << vertices.size() << std::endl;
+    CHECK( after.mAcmr < 0.7f );
+    CHECK( after.mAtvr < 1.4f );
+}
+
+//=============================================================================
+
+int main()
+{
+    TestSphere();
+    return TestResult();
+}
+
+//=============================================================================
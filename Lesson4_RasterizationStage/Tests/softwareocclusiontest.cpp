@@ -0,0 +1,112 @@
+//=============================================================================
+// Software Occlusion Culling Tests
+//=============================================================================
+
+#include "check.h"
+
+#include <softwareocclusion.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+
+//=============================================================================
+
+// Camera 5 units in front of the z = 0 plane, looking at it.
+static glm::mat4 ViewProjection()
+{
+    glm::mat4 const view = glm::lookAt( glm::vec3( 0.0f, 0.0f, 5.0f ), glm::vec3( 0.0f ), glm::vec3( 0.0f, 1.0f, 0.0f ) );
+    glm::mat4 const projection = glm::perspective( glm::radians( 45.0f ), 4.0f / 3.0f, 0.1f, 100.0f );
+    return projection * view;
+}
+
+static BoundingBox Box( const glm::vec3& center, float const halfSize )
+{
+    BoundingBox box;
+    box.mMin = center - glm::vec3( halfSize );
+    box.mMax = center + glm::vec3( halfSize );
+    return box;
+}
+
+//=============================================================================
+
+// A quad in the z = 0 plane covering the whole view hides what is behind it
+// and nothing in front of it.
+static void TestScreenCoveringQuad()
+{
+    OccluderMesh quad;
+    quad.mPositions = { glm::vec3( -10.0f, -10.0f, 0.0f ), glm::vec3( 10.0f, -10.0f, 0.0f ),
+                        glm::vec3( 10.0f, 10.0f, 0.0f ), glm::vec3( -10.0f, 10.0f, 0.0f ) };
+    quad.mIndices = { 0, 1, 2, 0, 2, 3 };
+
+    SoftwareOcclusion occlusion;
+    occlusion.Begin( ViewProjection(), 0.1f );
+    occlusion.AddOccluder( &quad, glm::mat4( 1.0f ) );
+    occlusion.Rasterize( nullptr );
+
+    // Depth is 1/w, the quad is 5 units away everywhere along the view axis.
+    float const depth = occlusion.GetDepth( SoftwareOcclusion::WIDTH / 2, SoftwareOcclusion::HEIGHT / 2 );
+    CHECK( std::abs( depth - 0.2f ) < 0.01f );
+    CHECK( occlusion.GetDepth( 0, 0 ) > 0.0f );
+    CHECK( occlusion.GetDepth( SoftwareOcclusion::WIDTH - 1, SoftwareOcclusion::HEIGHT - 1 ) > 0.0f );
+
+    CHECK( !occlusion.IsVisible( Box( glm::vec3( 0.0f, 0.0f, -5.0f ), 0.5f ) ) );
+    CHECK( occlusion.IsVisible( Box( glm::vec3( 0.0f, 0.0f, 2.0f ), 0.5f ) ) );
+    CHECK( occlusion.GetStats().mOccluded == 1 );
+}
+
+//=============================================================================
+
+// An inset triangle moves straight back along its normal by the distance
+// asked for and stays within the outline of the one it came from.
+static void TestInsetTriangle()
+{
+    OccluderMesh source;
+    source.mPositions = { glm::vec3( 0.0f, 0.0f, 0.0f ), glm::vec3( 2.0f, 0.0f, 0.0f ), glm::vec3( 0.0f, 2.0f, 0.0f ) };
+    source.mIndices = { 0, 1, 2 };
+
+    OccluderMesh inset = source;
+    float const distance = 0.25f;
+    InsetOccluder( inset, distance );
+    CHECK( inset.mIndices.size() == 3 );
+
+    for (const glm::vec3& p : inset.mPositions)
+    {
+        // Behind the source plane (its normal is +z) by at least the distance...
+        CHECK( p.z <= -distance + 1e-5f );
+        // ...and inside the source triangle once projected onto it.
+        CHECK( p.x >= -1e-5f && p.y >= -1e-5f && p.x + p.y <= 2.0f + 1e-5f );
+    }
+}
+
+// Every vertex of an inset cube ends up inside the cube by the distance.
+static void TestInsetCube()
+{
+    OccluderMesh cube;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        cube.mPositions.push_back( glm::vec3( (i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f ) );
+    }
+    cube.mIndices = { 0, 2, 3, 0, 3, 1,  4, 5, 7, 4, 7, 6,  0, 1, 5, 0, 5, 4,
+                      2, 6, 7, 2, 7, 3,  0, 4, 6, 0, 6, 2,  1, 3, 7, 1, 7, 5 };
+
+    float const distance = 0.25f;
+    InsetOccluder( cube, distance );
+    CHECK( cube.mIndices.size() == 36 );
+    for (const glm::vec3& p : cube.mPositions)
+    {
+        CHECK( glm::all( glm::lessThanEqual( glm::abs( p ), glm::vec3( 1.0f - distance + 1e-5f ) ) ) );
+    }
+}
+
+//=============================================================================
+
+int main()
+{
+    TestScreenCoveringQuad();
+    TestInsetTriangle();
+    TestInsetCube();
+    return TestResult();
+}
+
+//=============================================================================
@@ -0,0 +1,72 @@
+//=============================================================================
+// Vertex Format Tests
+//=============================================================================
+
+#include "check.h"
+
+#include <vertexformat.h>
+
+#include <cmath>
+#include <random>
+
+//=============================================================================
+
+// Random vertices in a box survive PackVertex and UnpackVertex within the
+// precision of their packed fields.
+static void TestRoundTrip()
+{
+    BoundingBox box;
+    box.mMin = glm::vec3( -3.0f, 0.0f, -1.0f );
+    box.mMax = glm::vec3( 5.0f, 2.0f, 1.0f );
+    // Half a quantization step along each axis.
+    glm::vec3 const positionBound = box.GetExtents() / POSITION_QUANTIZATION_SCALE * 0.5f + glm::vec3( 1e-5f );
+    float const directionBound = std::cos( glm::radians( 1.0f ) );
+
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<float> unit( 0.0f, 1.0f );
+    auto direction = [&]()
+    {
+        glm::vec3 d;
+        do
+        {
+            d = glm::vec3( unit( random ), unit( random ), unit( random ) ) * 2.0f - 1.0f;
+        } while (glm::dot( d, d ) < 1e-4f || glm::dot( d, d ) > 1.0f);
+        return glm::normalize( d );
+    };
+
+    glm::vec3 maxPositionError( 0.0f );
+    float minNormalCosine = 1.0f;
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        glm::vec3 const position = box.mMin + glm::vec3( unit( random ), unit( random ), unit( random ) ) * (box.mMax - box.mMin);
+        glm::vec3 const normal = direction();
+        glm::vec3 const tangent = glm::normalize( glm::cross( normal, direction() ) );
+        glm::vec3 const bitangent = glm::cross( normal, tangent ) * (i % 2 == 0 ? 1.0f : -1.0f);
+        glm::vec2 const texCoords( unit( random ) * 4.0f - 2.0f, unit( random ) );
+        uint32_t const layer = i % 7;
+
+        UnpackedVertex const v = UnpackVertex( PackVertex( position, normal, texCoords, tangent, bitangent, box, layer ), box );
+
+        maxPositionError = glm::max( maxPositionError, glm::abs( v.mPosition - position ) );
+        minNormalCosine = glm::min( minNormalCosine, glm::dot( v.mNormal, normal ) );
+        CHECK( glm::dot( v.mTangent, tangent ) >= directionBound );
+        CHECK( glm::dot( v.mBitangent, bitangent ) > 0.9f );
+        CHECK( glm::all( glm::lessThanEqual( glm::abs( v.mTexCoords - texCoords ), glm::abs( texCoords ) * 1e-3f + 1e-4f ) ) );
+        CHECK( v.mMaterialLayer == layer );
+    }
+
+    std::cout << "position error " << maxPositionError.x << " " << maxPositionError.y << " " << maxPositionError.z
+              << ", normal error " << glm::degrees( std::acos( glm::min( minNormalCosine, 1.0f ) ) ) << " degrees" << std::endl;
+    CHECK( glm::all( glm::lessThanEqual( maxPositionError, positionBound ) ) );
+    CHECK( minNormalCosine >= directionBound );
+}
+
+//=============================================================================
+
+int main()
+{
+    TestRoundTrip();
+    return TestResult();
+}
+
+//=============================================================================